@@ -144,6 +144,22 @@ public:
 	 */
 	virtual unsigned int classify_sync(const unsigned int* header, int priority) = 0;
 
+	/**
+	 * @brief Synchronous classification of a batch of packets.
+	 *        The default implementation classifies one packet at a time.
+	 * @param headers Per packet, an array of 32bit integers according to the number of supported fields.
+	 *        Invalid packets are set using invalid pointer (NULL) and are skipped.
+	 * @param num_of_packets The number of packets in the batch
+	 * @param[in,out] output Per packet, the result of a previous matching rule.
+	 *        Updated only for packets that match a rule with a better priority.
+	 */
+	virtual void classify_batch_sync(const unsigned int* const* headers, unsigned int num_of_packets, classifier_output_t* output) {
+		for (unsigned int i=0; i<num_of_packets; ++i) {
+			if (headers[i] == nullptr) continue;
+			update_output(output[i], classify_sync(headers[i], output[i].priority));
+		}
+	}
+
 	/**
 	 * @brief Prints debug information
 	 * @param verbose Set the verbosity level of printing
@@ -157,6 +173,16 @@ public:
 	 */
 	virtual const std::string to_string() const = 0;
 
+	/**
+	 * @brief Sets the output of a packet in case a matching priority is better (lower) than its current one.
+	 *        Priority -1 (not found) is never better.
+	 */
+	static inline void update_output(classifier_output_t& output, int priority) {
+		if ((unsigned int)priority < (unsigned int)output.priority) {
+			output = {priority, priority};
+		}
+	}
+
 	/**
 	 * @brief Adds new listener to this
 	 */
@@ -136,6 +136,30 @@ public:
 	 */
 	IntervalSetInfoBatch<N> rqrmi_search(PacketBatch<N>& packets) const;
 
+	/**
+	 * @brief Search for packets within several interval sets using a fused inference kernel.
+	 *        The fields of all iSets are gathered from each packet header at once, and the
+	 *        stages of iSets with the same specialized model shape are interleaved.
+	 * @param isets An array of interval sets
+	 * @param num_of_isets The number of interval sets
+	 * @param packets A batch of packets
+	 * @param[out] info An array of num_of_isets batches, one per iSet
+	 */
+	static void rqrmi_search_multi(IntervalSet<N>* const* isets, uint32_t num_of_isets,
+			PacketBatch<N>& packets, IntervalSetInfoBatch<N>* info);
+
+	/**
+	 * @brief Perform the secondary search of a single packet within several interval sets.
+	 *        The search is done across all iSets at once for exploiting memory parallelism.
+	 * @param isets An array of interval sets
+	 * @param num_of_isets The number of interval sets
+	 * @param info An array of num_of_isets RQRMI batches, one per iSet
+	 * @param packet_idx The index of the packet within the batches
+	 * @param[out] position An array of num_of_isets candidate rule indices, one per iSet
+	 */
+	static void secondary_search_multi(IntervalSet<N>* const* isets, uint32_t num_of_isets,
+			const IntervalSetInfoBatch<N>* info, uint32_t packet_idx, uint32_t* position);
+
 	/**
 	 * @brief Perform validation phase on packet header and a rule index
 	 * @param packet A pointer to packet headers
@@ -32,6 +32,7 @@
 #include <rqrmi_model.h>
 #include <pipeline_thread.h>
 #include <rqrmi_fast.h>
+#include <rqrmi_fast64.h>
 
 using namespace std;
 
@@ -87,15 +88,6 @@ protected:
 	// Holds listeners for search results
 	vector<LookupListener*> _listeners;
 
-	/**
-	 * @brief Perform binary search over the database
-	 * @param key The key to search
-	 * @param hint A hint to the possible location (RQRMI output)
-	 * @param error Maximum error bound for search
-	 * @throws out_of_range In case of lookup internal error
-	 */
-	void perform_binary_search(scalar_t key, scalar_t hint, uint32_t error);
-
 public:
 
 	/**
@@ -107,6 +99,68 @@ public:
 		uint32_t found;
 	} result_t;
 
+	/**
+	 * @brief Describe the records of a range query, contiguous in the database
+	 */
+	typedef struct {
+		uint32_t first;
+		uint32_t count;
+	} range_t;
+
+	/**
+	 * @brief Invoked by range_search for each record in the range, in order
+	 * @param index The record index
+	 * @param start The record start (inclusive)
+	 * @param end The record end (exclusive)
+	 * @param args User arguments
+	 */
+	typedef void (*range_callback_t)(uint32_t index, scalar_t start, scalar_t end, void* args);
+
+protected:
+
+	/**
+	 * @brief Returns the number of records that start at or before a key
+	 * @param key The key to search
+	 * @param hint A hint to the possible location (RQRMI output)
+	 * @param error Maximum error bound for search
+	 * @note In case the key is outside of the error bound, the whole database is searched
+	 */
+	uint32_t upper_bound(scalar_t key, scalar_t hint, uint32_t error) const;
+
+	/**
+	 * @brief Resolves a range query given the RQRMI output of its low key
+	 * @param lo The low key of the range (inclusive)
+	 * @param hi The high key of the range (inclusive)
+	 * @param hint The RQRMI output of lo
+	 * @param error The error bound of the RQRMI output
+	 */
+	range_t resolve_range(scalar_t lo, scalar_t hi, scalar_t hint, uint32_t error) const;
+
+	/**
+	 * @brief Perform binary search and validation over the database
+	 * @param key The key to search
+	 * @param hint A hint to the possible location (RQRMI output)
+	 * @param error Maximum error bound for search
+	 * @returns The search result
+	 */
+	result_t binary_search(scalar_t key, scalar_t hint, uint32_t error) const;
+
+	/**
+	 * @brief Perform binary search over the database, invokes the listeners with the result
+	 * @param key The key to search
+	 * @param hint A hint to the possible location (RQRMI output)
+	 * @param error Maximum error bound for search
+	 * @throws out_of_range In case of lookup internal error
+	 */
+	void perform_binary_search(scalar_t key, scalar_t hint, uint32_t error);
+
+	/**
+	 * @brief Invokes the listeners with a search result
+	 */
+	void notify_listeners(const result_t& result);
+
+public:
+
 	Lookup();
 	virtual ~Lookup();
 
@@ -155,7 +209,45 @@ public:
 	 * @returns A pair of scalars {interval_start_inclusive, interval_end_exclusive}
 	 * @throws overflow_error
 	 */
-	scalar_pair_t get_record(uint32_t index);
+	scalar_pair_t get_record(uint32_t index) const;
+
+	/**
+	 * @brief Returns the records that intersect the range [lo, hi]
+	 * @param lo The low key of the range (inclusive)
+	 * @param hi The high key of the range (inclusive)
+	 * @returns The first record and the number of records
+	 * @note Records must not overlap
+	 */
+	range_t range_search(scalar_t lo, scalar_t hi) const;
+
+	/**
+	 * @brief Streams the records that intersect the range [lo, hi] to a callback
+	 * @param lo The low key of the range (inclusive)
+	 * @param hi The high key of the range (inclusive)
+	 * @param callback Invoked for each record, in order
+	 * @param args User arguments for the callback
+	 * @returns The number of records in the range
+	 */
+	uint32_t range_search(scalar_t lo, scalar_t hi, range_callback_t callback, void* args) const;
+
+	/**
+	 * @brief Copies the records that intersect the range [lo, hi] to a buffer
+	 * @param lo The low key of the range (inclusive)
+	 * @param hi The high key of the range (inclusive)
+	 * @param[out] output Buffer of {start, end} pairs
+	 * @param max_records The size of the buffer
+	 * @returns The number of records in the range. At most max_records are copied.
+	 */
+	uint32_t range_search(scalar_t lo, scalar_t hi, scalar_pair_t* output, uint32_t max_records) const;
+
+	/**
+	 * @brief Perform many range queries. The RQRMI model is evaluated on SIMD words of
+	 *        low keys, and their database positions are prefetched before the searches.
+	 * @param ranges Pairs of {lo, hi}, both inclusive
+	 * @param num_of_ranges The number of ranges
+	 * @param[out] output The records of each range
+	 */
+	void range_search(const scalar_pair_t* ranges, uint32_t num_of_ranges, range_t* output) const;
 
 };
 
@@ -247,3 +339,147 @@ public:
 	void print() const;
 };
 
+
+
+/**
+ * @brief Performs lookup on the calling thread.
+ *        RQRMI inference, binary search and validation of a batch run in sequence,
+ *        without the hand-off between worker threads of LookupCPU.
+ * @tparam Batch size per lookup
+ */
+template <uint32_t N>
+class LookupInline : public Lookup<N> {
+public:
+
+	/**
+	 * @brief A batch job of input scalars
+	 */
+	typedef typename Lookup<N>::batch_t batch_t;
+
+	/**
+	 * @brief A lookup result
+	 */
+	typedef typename Lookup<N>::result_t result_t;
+
+private:
+
+	/**
+	 * @brief Perform lookup on a batch
+	 * @param input N keys to search
+	 * @param[out] output N results, in the order of the keys
+	 * @param[out] valid N flags, 0 for keys out of the model's input domain. May be NULL.
+	 */
+	void search_batch(const scalar_t* input, result_t* output, uint32_t* valid) const;
+
+public:
+
+	LookupInline() {};
+	virtual ~LookupInline() {};
+
+	// All overloads of load in super are visible here
+	using Lookup<N>::load;
+
+	/**
+	 * @brief Perform lookup on a batch, writes the results to a buffer
+	 * @param input N keys to search
+	 * @param[out] output N results, in the order of the keys.
+	 *             Keys out of the model's input domain are not found.
+	 */
+	void search(const scalar_t* input, result_t* output) const;
+
+	/**
+	 * @brief Perform lookup on the requested value, invokes the listeners with the results
+	 * @param input The input batch to search
+	 * @returns true, the search is always performed
+	 * @note Results of keys out of the model's input domain are not reported, as in LookupCPU
+	 */
+	virtual bool search(batch_t input);
+};
+
+
+/**
+ * @brief Performs lookup of 64-bit keys on the calling thread.
+ *        The RQRMI model is evaluated in double precision (see RQRMIFast64),
+ *        the secondary search and validation are exact over the integer records.
+ * @tparam Batch size per lookup
+ */
+template <uint32_t N>
+class Lookup64 {
+public:
+
+	/**
+	 * @brief Describe a lookup result
+	 */
+	typedef struct {
+		uint64_t input;
+		uint32_t index;
+		uint32_t found;
+	} result_t;
+
+protected:
+
+	// The lookup table of the secondary search
+	// Divided to index (fast lookup) and values (validation)
+	uint64_t* _index;
+	uint64_t* _values;
+	uint32_t _size;
+
+	// The RQRMI model
+	rqrmi_model_t* _model;
+	RQRMIFast64* _fast_model;
+	bool _own_model;
+
+	/**
+	 * @brief Perform binary search and validation over the database
+	 * @param key The key to search
+	 * @param hint A hint to the possible location (RQRMI output)
+	 * @param error Maximum error bound for search
+	 * @returns The search result
+	 * @note In case the key is outside of the error bound, the whole database is searched
+	 */
+	result_t binary_search(uint64_t key, scalar64_t hint, uint32_t error) const;
+
+public:
+
+	Lookup64();
+	virtual ~Lookup64();
+
+	/**
+	 * @brief Loads the RQRMI model and database from memory
+	 * @param object An object reader that contains the model, and the database:
+	 *        uint32 number of records, followed by {start, end} uint64 pairs
+	 * @throws invalid_argument, domain_error
+	 */
+	void load(ObjectReader object);
+
+	/**
+	 * @brief Loads the RQRMI model and database from arrays
+	 * @param model The RQRMI object
+	 * @param starts The inclusive start of each record, sorted
+	 * @param ends The exclusive end of each record
+	 * @param size The number of records
+	 * @throws domain_error
+	 */
+	void load(rqrmi_model_t* model, const uint64_t* starts, const uint64_t* ends, uint32_t size);
+
+	/**
+	 * @brief Perform lookup on a batch, writes the results to a buffer
+	 * @param input N keys to search
+	 * @param[out] output N results, in the order of the keys
+	 */
+	void search(const uint64_t* input, result_t* output) const;
+
+	/**
+	 * @brief Get the size of this
+	 */
+	uint32_t get_size() const { return _size; }
+
+	/**
+	 * @brief Returns a record from the database
+	 * @param index The requested index of the record
+	 * @param[out] start The inclusive start of the record
+	 * @param[out] end The exclusive end of the record
+	 * @throws overflow_error
+	 */
+	void get_record(uint32_t index, uint64_t* start, uint64_t* end) const;
+};
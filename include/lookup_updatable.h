@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/** @file lookup_updatable.h */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <lookup.h>
+#include <rqrmi_trainer.h>
+
+/**
+ * @brief Performs lookup over a database that supports inserting and deleting records.
+ *        Updates are kept in a small sorted delta (inserted records and starts of deleted records),
+ *        which is searched alongside the RQRMI path: a binary search to a block, then SIMD within
+ *        the block. Once the delta exceeds a threshold, a background thread merges it into a new
+ *        database, retrains only the affected submodels, and swaps the new database in using
+ *        read-copy-update. Lookups never wait for updates, and updates never wait for lookups:
+ *        replaced snapshots are freed by the background thread after a grace period.
+ * @tparam Batch size per lookup
+ * @note Records must not overlap. Updates are serialized.
+ */
+template <uint32_t N>
+class LookupUpdatable {
+public:
+
+	/**
+	 * @brief Describe a lookup result. Record indices change on merges, so the record is returned.
+	 */
+	typedef struct {
+		scalar_t input;
+		scalar_t start;
+		scalar_t end;
+		uint32_t found;
+	} result_t;
+
+private:
+
+	/**
+	 * @brief An immutable database with its RQRMI model
+	 */
+	struct base_t {
+		std::unique_ptr<LookupInline<N>> lookup;
+		rqrmi_model_t* model;
+		std::vector<unsigned char> packed_model;
+		base_t() : model(nullptr) {}
+		~base_t();
+	};
+
+	/**
+	 * @brief Inserted records, sorted by record start
+	 */
+	typedef struct {
+		std::vector<scalar_t> starts;
+		std::vector<scalar_t> ends;
+	} inserts_t;
+
+	/**
+	 * @brief The updates on top of a base. Both lists are immutable and shared between
+	 *        snapshots, so an update copies only the list it changes.
+	 */
+	struct delta_t {
+		std::shared_ptr<const inserts_t> inserts;
+		std::shared_ptr<const std::vector<scalar_t>> deleted;
+		delta_t() : inserts(new inserts_t()), deleted(new std::vector<scalar_t>()) {}
+		uint32_t size() const { return inserts->starts.size() + deleted->size(); }
+	};
+
+	/**
+	 * @brief An immutable view of the database, read by lookups
+	 */
+	typedef struct {
+		std::shared_ptr<base_t> base;
+		delta_t delta;
+	} snapshot_t;
+
+	// The current snapshot, and the readers of each epoch parity
+	std::atomic<snapshot_t*> _snapshot;
+	mutable std::atomic<uint32_t> _epoch;
+	mutable std::atomic<uint32_t> _readers[2];
+
+	// Serializes updates and merges
+	std::mutex _update_lock;
+
+	// Snapshots that were swapped out, freed by the background thread after a grace period
+	std::vector<snapshot_t*> _retired;
+
+	// Background merge
+	std::thread _merger;
+	std::condition_variable _merge_signal;
+	bool _stop;
+	uint32_t _merge_threshold;
+	uint32_t _next_merge_size;
+	std::atomic<uint32_t> _num_of_merges;
+
+	// Retraining parameters
+	rqrmi_trainer_params_t _params;
+	uint32_t _epochs;
+
+	/**
+	 * @brief Returns the current snapshot, which is valid until read_unlock
+	 * @param[out] parity The epoch parity to pass to read_unlock
+	 */
+	const snapshot_t* read_lock(uint32_t& parity) const;
+
+	/**
+	 * @brief Releases a snapshot acquired by read_lock
+	 */
+	void read_unlock(uint32_t parity) const;
+
+	/**
+	 * @brief Swaps the current snapshot, retires the previous one
+	 * @note Must be called with the update lock
+	 */
+	void publish(snapshot_t* snapshot);
+
+	/**
+	 * @brief Waits until all readers of snapshots that were swapped out before the call are done
+	 * @note Only called by the background thread, which is the only one to advance the epoch
+	 */
+	void synchronize() const;
+
+	/**
+	 * @brief Creates a base from a packed model and a database (two columns)
+	 * @throws invalid_argument, domain_error
+	 */
+	static base_t* create_base(const void* packed_model, uint32_t size, matrix_t* database);
+
+	/**
+	 * @brief Searches a base for a record that starts exactly at a key
+	 * @param[out] end The end of the record, if found
+	 */
+	static bool find_base(const base_t& base, scalar_t start, scalar_t* end);
+
+	/**
+	 * @brief Searches a delta for an inserted record that starts exactly at a key
+	 * @param[out] end The end of the record, if found
+	 */
+	static bool find_insert(const delta_t& delta, scalar_t start, scalar_t* end);
+
+	/**
+	 * @brief Returns true iff a base record that starts at a key is deleted in a delta
+	 */
+	static bool is_deleted(const delta_t& delta, scalar_t start);
+
+	/**
+	 * @brief Returns true iff the range [start, end) overlaps a live record of a snapshot
+	 */
+	static bool overlaps(const snapshot_t& snapshot, scalar_t start, scalar_t end);
+
+	/**
+	 * @brief Builds a new base of a base with a delta, retrains its affected submodels
+	 * @returns The new base, or nullptr in case of error
+	 */
+	base_t* merge(const base_t& base, const delta_t& delta) const;
+
+	/**
+	 * @brief The background thread. Frees retired snapshots and merges the delta.
+	 */
+	void merge_loop();
+
+public:
+
+	/**
+	 * @brief Initialize new updatable lookup
+	 * @param merge_threshold The delta size (inserted and deleted records) that triggers a merge
+	 */
+	LookupUpdatable(uint32_t merge_threshold = 1024);
+	virtual ~LookupUpdatable();
+
+	/**
+	 * @brief Loads the RQRMI model and database from memory, starts the background merge thread
+	 * @param object An object reader that contains the model, as read by Lookup::load
+	 * @throws invalid_argument, domain_error
+	 */
+	void load(ObjectReader object);
+
+	/**
+	 * @brief Sets the parameters for retraining submodels on merges
+	 * @param params The hyper parameters (by default, as LookupCpu with a single thread)
+	 * @param epochs The number of epochs per retrained submodel
+	 */
+	void set_training_params(const rqrmi_trainer_params_t& params, uint32_t epochs);
+
+	/**
+	 * @brief Inserts a record
+	 * @param start The record start (inclusive)
+	 * @param end The record end (exclusive)
+	 * @returns false in case the record is empty or overlaps an existing record
+	 */
+	bool insert(scalar_t start, scalar_t end);
+
+	/**
+	 * @brief Deletes a record
+	 * @param start The start of the record
+	 * @returns false in case no record starts at the value
+	 */
+	bool remove(scalar_t start);
+
+	/**
+	 * @brief Perform lookup on a batch, writes the results to a buffer
+	 * @param input N keys to search
+	 * @param[out] output N results, in the order of the keys
+	 */
+	void search(const scalar_t* input, result_t* output) const;
+
+	/**
+	 * @brief Returns the number of pending updates (inserted and deleted records)
+	 */
+	uint32_t get_delta_size() const;
+
+	/**
+	 * @brief Returns the number of completed merges
+	 */
+	uint32_t get_num_of_merges() const { return _num_of_merges; }
+};
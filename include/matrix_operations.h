@@ -83,6 +83,18 @@ void free_matrix(matrix_t *mat);
  */
 void mat_mul(matrix_t* mat_a, matrix_t* mat_b, matrix_t* result);
 
+/**
+ * @brief Performs matrix multiplication, adds bias and activation, without checks and memory allocations
+ * @param mat_a  Left hand side matrix
+ * @param mat_b  Right hand side matrix
+ * @param bias   Bias matrix, either with the size of the result or a single row (broadcast to all rows)
+ * @param op     Activation to perform element-wise, OPERATION_BYPASS for none
+ * @param result Preallocated matrix with enough space to store results, must not be one of the inputs
+ * @note  This method is unsafe, make sure to allocate enough space to result
+ * @note  The result is identical to mat_mul, mat_op with op_add, and mat_unary_op
+ */
+void mat_mul_bias_op(matrix_t* mat_a, matrix_t* mat_b, matrix_t* bias, unary_operation_t op, matrix_t* result);
+
 /**
  * @brief Performs an element-wise operation between two matrices without checks and memory allocations
  * @param mat_a  Left hand side matrix
@@ -90,6 +102,7 @@ void mat_mul(matrix_t* mat_a, matrix_t* mat_b, matrix_t* result);
  * @param op     Operation to perform element-wise
  * @param result Preallocated matrix with enough space to store results
  * @note  This method is unsafe, make sure to allocate enough space to result
+ * @note  The built-in operations (op_add, op_sub, op_mul, op_div) are vectorized
  */
 void mat_op(matrix_t* mat_a, matrix_t* mat_b, binary_operation_t op, matrix_t* result);
 
@@ -100,6 +113,7 @@ void mat_op(matrix_t* mat_a, matrix_t* mat_b, binary_operation_t op, matrix_t* r
  * @param op     Operation to perform element-wise
  * @param result Preallocated matrix with enough space to store results
  * @note  This method is unsafe, make sure to allocate enough space to result
+ * @note  The built-in operations (op_add, op_sub, op_mul, op_div) are vectorized
  */
 void mat_scalar_op(matrix_t* mat_a, scalar_t scalar, binary_operation_t op, matrix_t* result);
 
@@ -109,6 +123,7 @@ void mat_scalar_op(matrix_t* mat_a, scalar_t scalar, binary_operation_t op, matr
  * @param op     Operation to perform element-wise
  * @param result Preallocated matrix with enough space to store results
  * @note  This method is unsafe, make sure to allocate enough space to result
+ * @note  op_relu is vectorized
  */
 void mat_unary_op(matrix_t* mat, unary_operation_t op, matrix_t* result);
 
@@ -129,6 +129,15 @@ public:
 	 */
 	void load(ObjectReader& object);
 
+	/**
+	 * @brief Loads a single iSet out of a packed NuevoMatch classifier
+	 * @param reader An object-reader with the binary data of the classifier
+	 * @param iset_index The index of the iSet to load
+	 * @returns A new iSet, owned by the caller
+	 * @throws In case the classifier holds no such iSet
+	 */
+	static IntervalSet<N>* load_iset(ObjectReader& reader, uint32_t iset_index);
+
 	/**
 	 * @brief Returns the number of rules
 	 */
@@ -226,6 +235,13 @@ private:
 	 */
 	void load_subsets(ObjectReader& reader);
 
+	/**
+	 * @brief Reads the next stored iSet from file
+	 * @param reader An object-reader positioned at the iSet
+	 * @param iset_index The index of the iSet
+	 */
+	static IntervalSet<N>* read_iset(ObjectReader& reader, uint32_t iset_index);
+
         /**
          * @brief Manually build remainder classifier
          */
@@ -101,13 +101,8 @@ public:
 	 * @returns The result of the subset
 	 */
 	ActionBatch<N> classify(PacketBatch<N>& packets, ActionBatch<N>& output) {
-		for (uint32_t i=0; i<N; ++i) {
-			if (packets[i] == nullptr) {
-				continue;
-			}
-			int result = _classifier->classify_sync(packets[i], output[i].priority);
-			output[i] = {result, result};
-		}
+		// Results are kept only where the remainder found a better rule
+		_classifier->classify_batch_sync(packets.items, N, output.items);
 		return output;
 	}
 
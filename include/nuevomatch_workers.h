@@ -127,9 +127,8 @@ protected:
 
 			// Perform inference on all iSets
 			// -----------------------------
-			for (uint32_t k=0; k<num_of_isets; ++k) {
-				info[k] = instance->_isets[k]->rqrmi_search(job.packets);
-			}
+			// Note: The stages of iSets with the same model shape are interleaved for exploiting instruction level parallelism
+			IntervalSet<N>::rqrmi_search_multi(instance->_isets.data(), num_of_isets, job.packets, info);
 
 			// Perform secondary search
 			// -----------------------------
@@ -144,67 +143,8 @@ protected:
 			// For each packet in batch
 			for (uint32_t i=0; i<N; ++i) {
 
-				scalar_t key[num_of_isets];
-				uint32_t position[num_of_isets], u_bound[num_of_isets], l_bound[num_of_isets];
-				uint32_t max_error = 0;
-
-				// Initiate all variables from all iSets
-				for (uint32_t k=0; k<num_of_isets; ++k) {
-					uint32_t error = info[k][i].rqrmi_error;
-					// Used for debugging
-					#if defined CUSTOM_ERROR_VALUE
-						error = CUSTOM_ERROR_VALUE;
-					#endif
-					// Update all variables
-					key[k] = info[k][i].rqrmi_input;
-					position[k] = info[k][i].rqrmi_output * instance->_isets[k]->size();
-					u_bound[k] = std::min(instance->_isets[k]->size()-1, position[k]+error);
-					l_bound[k] = std::max(0, (int)position[k]-(int)error);
-					max_error = std::max(error, max_error);
-				}
-
-				// In case of binary search (default)
-				#ifndef LINEAR_SEARCH
-					uint32_t current_value[num_of_isets], next_value[num_of_isets];
-
-					// Perform binary search
-					do {
-
-						// Fetch index database information from memory
-						for (uint32_t k=0; k<num_of_isets; ++k) {
-							current_value[k] = instance->_isets[k]->get_index(position[k]) <= key[k];
-							next_value[k] = instance->_isets[k]->get_index(position[k]+1) > key[k];
-						}
-
-						// Calculate the next position per packet in batch
-						for (uint32_t k=0; k<num_of_isets; ++k) {
-							if (current_value[k] & next_value[k]) {
-								// Do nothing
-							} else if (current_value[k]) {
-								l_bound[k] = position[k];
-								position[k]=(l_bound[k]+u_bound[k]);
-								position[k]=(position[k]>>1)+(position[k]&0x1); // Ceil
-							} else if (info[k][i].valid) {
-								u_bound[k] = position[k];
-								position[k]=(l_bound[k]+u_bound[k])>>1; // Floor
-							}
-						}
-
-						// Update error
-						max_error >>= 1;
-					} while (max_error > 0);
-				// In case of linear search (used for debugging)
-				#else
-					for (uint32_t k=0; k<num_of_isets; ++k) {
-						for (position[k]=l_bound[k]; position[k]<u_bound[k]; ++position[k]) {
-							uint32_t current_value = _isets[k]->get_iset()->get_index(position[k]) <= key[k];
-							uint32_t next_value = _isets[k]->get_iset()->get_index(position[k]+1) > key[k];
-							if (current_value & next_value) {
-								break;
-							}
-						}
-					}
-				#endif
+				uint32_t position[num_of_isets];
+				IntervalSet<N>::secondary_search_multi(instance->_isets.data(), num_of_isets, info, i, position);
 
 				// Perform validation phase across all iSets
 				// -----------------------------
@@ -24,6 +24,7 @@
 #pragma once
 
 #include <stdexcept>
+#include <vector>
 #include <basic_types.h>
 #include <rqrmi_model.h>
 #include <simd_aux.h>
@@ -37,44 +38,98 @@ typedef union {
 	uint32_t integers[SIMD_WIDTH];
 } CACHE_ALIGNED wide_scalar_t;
 
+/**
+ * @brief Evaluates RQRMI models using SIMD acceleration.
+ *        This is the generic path: any number of stages, hidden widths of 4, 8 or 16.
+ *        Use RQRMIFast::create for getting a specialized instance when available.
+ */
 class RQRMIFast {
-private:
-
-	/**
-	 * @brief Used to store immediate vectors of RQRMI models
-	 * @note RQRMI models have at most 8 scalars per vector
-	 */
-	typedef union {
-		scalar_t scalars[8];
-		uint32_t integers[8];
-	} CACHE_ALIGNED rqrmi_vector_t;
+protected:
 
 	/**
 	 * @brief Holds information of a single submodel
+	 * @tparam Width The number of hidden neurons (4, 8 or 16)
+	 * @note The input normalization is folded into layer 0 at load time:
+	 *       w0 = w0/stddev, b0 = b0 - w0*mean/stddev
+	 * @note Vectors come first, so they are aligned for SIMD loads
 	 */
-	typedef struct {
-		uint8_t compiled;
-		uint32_t error;
+	template <uint32_t Width>
+	struct fast_submodel_t {
+		scalar_t w1[Width];
+		scalar_t b1[Width];
+		scalar_t w2[Width];
+		scalar_t b2[Width];
 		scalar_t w0;
 		scalar_t b0;
-		rqrmi_vector_t w1;
-		rqrmi_vector_t b1;
-		rqrmi_vector_t w2;
-		rqrmi_vector_t b2;
 		scalar_t output_factor;
 		scalar_t output_min;
-		scalar_t input_mean;
-		scalar_t input_stddev;
-	} fast_submodel_t CACHE_ALIGNED;
-
-	typedef fast_submodel_t* submodel_collection_t[SIMD_WIDTH];
+		uint32_t error;
+		uint32_t compiled;
+	} CACHE_ALIGNED;
 
 	// Stage information
 	uint32_t _num_of_stages;
 	uint32_t *_stage_submodels;
 
 	// Submodel information
-	fast_submodel_t* _submodles;
+	void* _submodels;
+	uint32_t _total_submodels;
+	uint32_t _hidden_width;
+	uint32_t _submodels_bytes;
+
+	/**
+	 * @brief Initiates an empty instance, used by derived classes with their own submodel tables
+	 */
+	RQRMIFast();
+
+	/**
+	 * @brief Reads the stage structure and the information of all submodels of a model
+	 * @param model The RQRMI model
+	 * @param[out] info The information of all submodels, ordered by stage
+	 * @returns The maximal hidden width of all submodels
+	 * @throws std::runtime_error in case the model is not valid RQRMI model
+	 */
+	uint32_t load_stages(rqrmi_model_t *model, std::vector<rqrmi_submodel_info_t>& info);
+
+	/**
+	 * @brief Copies the submodels information to the array of this
+	 * @tparam Width The hidden width of the array
+	 * @param info The information of all submodels, ordered by stage
+	 */
+	template <uint32_t Width>
+	void load_submodels(const std::vector<rqrmi_submodel_info_t>& info);
+
+	/**
+	 * @brief Generates inputs for probing the model: uniformly spread inputs over the
+	 *        input domain, and the trigger inputs of all submodels with their neighbours.
+	 * @param model The RQRMI model this was created from
+	 */
+	std::vector<scalar_t> generate_probes(rqrmi_model_t *model) const;
+
+	/**
+	 * @brief Evaluates a single stage for a vector of inputs
+	 * @tparam Width The hidden width of the submodels
+	 * @param stage_idx The stage to evaluate
+	 * @param base_idx The index of the first submodel of the stage
+	 * @param[in] inputs a vector of inputs
+	 * @param[in,out] status a vector of output status (1 valid, 0 error)
+	 * @param[in,out] next_idx The output of the previous stage, updated with the output of this stage
+	 * @param[out] submodels The submodels used per input
+	 */
+	template <uint32_t Width>
+	void evaluate_stage(uint32_t stage_idx, uint32_t base_idx, wide_scalar_t& inputs,
+			wide_scalar_t& status, wide_scalar_t& next_idx,
+			const fast_submodel_t<Width>** submodels) const;
+
+	/**
+	 * @brief The evaluation kernel of all RQRMIFast variants
+	 * @tparam Stages The number of stages, or 0 for reading it in runtime
+	 * @tparam Width The hidden width of the submodels
+	 * @param[out] submodel_idx The index of the last submodel per input. Ignored when null.
+	 */
+	template <uint32_t Stages, uint32_t Width>
+	void evaluate_kernel(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output,
+			wide_scalar_t& error, uint32_t* submodel_idx) const;
 
 public:
 
@@ -88,7 +143,45 @@ public:
 	 * @throws std::runtime_error in case the model is not valid RQRMI model
 	 */
 	RQRMIFast(rqrmi_model_t *model);
-	~RQRMIFast();
+	virtual ~RQRMIFast();
+
+	/**
+	 * @brief Creates the best RQRMIFast instance for the shape of the model.
+	 *        Falls back to the generic path when no specialization is available.
+	 * @throws std::runtime_error in case the model is not valid RQRMI model
+	 * @note The instance should be deleted by the user
+	 */
+	static RQRMIFast* create(rqrmi_model_t *model);
+
+	/**
+	 * @brief Evaluates this on all record boundaries, widens the error of
+	 *        last stage submodels in case their bounds do not hold.
+	 * @param index The records indexed by the model (range start values, sorted)
+	 * @param num_of_records The number of records indexed by the model
+	 * @returns The maximal number of positions added to the error of a submodel
+	 */
+	virtual uint32_t validate_error_bounds(const scalar_t* index, uint32_t num_of_records);
+
+	/**
+	 * @brief Returns the number of stages of the model
+	 */
+	uint32_t get_num_of_stages() const { return _num_of_stages; }
+
+	/**
+	 * @brief Returns the hidden width of the submodels (after padding)
+	 */
+	uint32_t get_hidden_width() const { return _hidden_width; }
+
+	/**
+	 * @brief Evicts the submodel tables of this from all cache levels.
+	 *        Used for measuring cold-cache inference.
+	 */
+	void flush_caches() const;
+
+	/**
+	 * @brief Returns true iff this is specialized in compile time for the model's shape
+	 */
+	virtual bool is_specialized() const { return false; }
 
 	/**
 	 * @brief Evaluate fast RQRMI models using SIMD acceleration
@@ -98,6 +191,54 @@ public:
 	 * @param[out] error a vector of error values
 	 * @note The SIMD acceleration method should be set in compilation time (FMA, AVX512, AVX, SSE, NO_RQRMI_OPT)
 	 */
-	void evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const;
+	virtual void evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const;
+
+	/**
+	 * @brief Evaluate several RQRMI models, each on its own vector of inputs.
+	 *        Specialized models of the same shape are evaluated together, stage by stage,
+	 *        so their independent dependency chains overlap in the CPU.
+	 *        Other models are evaluated on their own.
+	 * @param models An array of models
+	 * @param num_of_models The number of models
+	 * @param[in] inputs an array of input vectors, one per model
+	 * @param[out] status an array of output status vectors (1 valid, 0 error)
+	 * @param[out] output an array of output vectors
+	 * @param[out] error an array of error vectors
+	 */
+	static void evaluate_interleaved(const RQRMIFast* const* models, uint32_t num_of_models,
+			wide_scalar_t* inputs, wide_scalar_t* status, wide_scalar_t* output, wide_scalar_t* error);
 };
 
+/**
+ * @brief RQRMIFast specialized in compile time for a fixed number of stages
+ *        and hidden width. The stage loop is fully unrolled.
+ * @tparam Stages The number of stages in the model
+ * @tparam Width The hidden width of the submodels (4, 8 or 16)
+ */
+template <uint32_t Stages, uint32_t Width>
+class RQRMIFastT : public RQRMIFast {
+public:
+
+	/**
+	 * @brief Create new RQRMIFastT instance from RQRMI model
+	 * @throws std::runtime_error in case the model does not match the specialization
+	 */
+	RQRMIFastT(rqrmi_model_t *model);
+
+	virtual bool is_specialized() const { return true; }
+
+	virtual void evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const;
+
+	/**
+	 * @brief Evaluate a group of models of this shape, stage by stage
+	 * @param models An array of models
+	 * @param group The indices of the models of this shape in the array
+	 * @param group_size The number of models in the group
+	 * @param[in] inputs an array of input vectors, one per model in the array
+	 * @param[out] status an array of output status vectors, one per model in the array
+	 * @param[out] output an array of output vectors, one per model in the array
+	 * @param[out] error an array of error vectors, one per model in the array
+	 */
+	static void evaluate_interleaved(const RQRMIFast* const* models, const uint32_t* group, uint32_t group_size,
+			wide_scalar_t* inputs, wide_scalar_t* status, wide_scalar_t* output, wide_scalar_t* error);
+};
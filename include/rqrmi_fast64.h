@@ -0,0 +1,151 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file rqrmi_fast64.h */
+
+#pragma once
+
+#include <vector>
+#include <basic_types.h>
+#include <rqrmi_model.h>
+#include <simd_aux.h>
+
+// The number of 64-bit keys evaluated at once (4 doubles per AVX2 register)
+#define SIMD_WIDTH64 4
+
+/**
+ * @brief Used to pass 64-bit keys, double outputs and integer status
+ * @note Must be aligned, as AVX loads/stores must be aligned
+ */
+typedef union {
+	scalar64_t doubles[SIMD_WIDTH64];
+	uint64_t integers[SIMD_WIDTH64];
+} CACHE_ALIGNED wide_double_t;
+
+/**
+ * @brief Evaluates RQRMI models on uint64_t keys in double precision.
+ *        The input normalization of layer 0 is split: the key is first offset by an
+ *        integer center of each submodel (exact), and only the offset is converted to
+ *        double. Keys far above 2^24 (or 2^53) keep their resolution near the center.
+ * @note  The error bounds of the original model were calculated over float inputs,
+ *        validate_error_bounds must be called with the 64-bit records before performing lookups
+ */
+class RQRMIFast64 {
+protected:
+
+	/**
+	 * @brief Holds information of a single submodel
+	 * @tparam Width The number of hidden neurons (4, 8 or 16)
+	 * @note The input normalization is folded into layer 0 at load time:
+	 *       layer0(key) = w0 * (key - center) + b0
+	 */
+	template <uint32_t Width>
+	struct fast_submodel64_t {
+		scalar64_t w1[Width];
+		scalar64_t b1[Width];
+		scalar64_t w2[Width];
+		scalar64_t w0;
+		scalar64_t b0;
+		scalar64_t b2;
+		scalar64_t output_factor;
+		scalar64_t output_min;
+		uint64_t center;
+		uint32_t error;
+		uint32_t compiled;
+	} CACHE_ALIGNED;
+
+	// Stage information
+	uint32_t _num_of_stages;
+	std::vector<uint32_t> _stage_submodels;
+
+	// Submodel information
+	void* _submodels;
+	uint32_t _total_submodels;
+	uint32_t _hidden_width;
+
+	/**
+	 * @brief Copies the submodels information to the array of this
+	 * @tparam Width The hidden width of the array
+	 * @param info The information of all submodels, ordered by stage
+	 */
+	template <uint32_t Width>
+	void load_submodels(const std::vector<rqrmi_submodel_info_t>& info);
+
+	/**
+	 * @brief The evaluation kernel
+	 * @tparam Width The hidden width of the submodels
+	 * @param[out] submodel_idx The index of the last submodel per key. Ignored when null.
+	 */
+	template <uint32_t Width>
+	void evaluate_kernel(const wide_double_t& keys, wide_double_t& status, wide_double_t& output,
+			wide_double_t& error, uint32_t* submodel_idx) const;
+
+	/**
+	 * @brief Returns a pointer to the error of a submodel
+	 */
+	uint32_t* error_of(uint32_t submodel_idx);
+
+public:
+
+	/**
+	 * @brief Returns the number of keys evaluated at once
+	 */
+	static constexpr uint32_t input_width() { return SIMD_WIDTH64; }
+
+	/**
+	 * @brief Create new RQRMIFast64 instance from RQRMI model
+	 * @throws std::runtime_error in case the model is not valid RQRMI model
+	 */
+	RQRMIFast64(rqrmi_model_t *model);
+	virtual ~RQRMIFast64();
+
+	/**
+	 * @brief Evaluates the model on all record boundaries (the first and last key of each record),
+	 *        widens the error of last stage submodels in case their bounds do not hold.
+	 * @param index The first key of each record, sorted
+	 * @param num_of_records The number of records indexed by the model
+	 * @returns The maximal number of positions added to the error of a submodel
+	 * @note Error bounds are only widened, never tightened
+	 */
+	uint32_t validate_error_bounds(const uint64_t* index, uint32_t num_of_records);
+
+	/**
+	 * @brief Evaluate the model on a vector of keys
+	 * @param[in] keys a vector of keys
+	 * @param[out] status a vector of output status (non zero valid, 0 error)
+	 * @param[out] output a vector of outputs, in [0, 1)
+	 * @param[out] error a vector of error values
+	 * @note Uses AVX2 when available
+	 */
+	void evaluate(const wide_double_t& keys, wide_double_t& status, wide_double_t& output, wide_double_t& error) const;
+
+	/**
+	 * @brief Returns the number of stages of the model
+	 */
+	uint32_t get_num_of_stages() const { return _num_of_stages; }
+
+	/**
+	 * @brief Returns the hidden width of the submodels (after padding)
+	 */
+	uint32_t get_hidden_width() const { return _hidden_width; }
+};
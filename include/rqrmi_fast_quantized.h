@@ -0,0 +1,148 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <vector>
+#include <basic_types.h>
+#include <rqrmi_model.h>
+#include <rqrmi_fast.h>
+
+// Route of probes with invalid outputs
+#define RQRMI_INVALID_ROUTE 0xFFFFFFFF
+
+/**
+ * @brief Evaluates RQRMI models using int16 fixed-point arithmetic.
+ *        Layer 0 and the post-processing run in float32, the hidden layer and
+ *        the output layer run in fixed-point (_mm256_madd_epi16 on AVX2 hosts).
+ *        The scales are picked per submodel at load time.
+ * @note The hidden layer is padded to 8 or 16 neurons
+ * @note The error bounds of the original model do not hold for this instance,
+ *       validate_error_bounds must be called before performing lookups
+ */
+class RQRMIFastQuantized : public RQRMIFast {
+protected:
+
+	/**
+	 * @brief Holds information of a single quantized submodel
+	 * @tparam Width The number of hidden neurons (8 or 16)
+	 * @note Layer 0 holds the input normalization and the input scale
+	 * @note The post-processing holds the output scale and the bias of layer 2
+	 */
+	template <uint32_t Width>
+	struct quantized_submodel_t {
+		int32_t w1[Width];			// int16 values, sign extended
+		int32_t b1[Width];
+		int16_t w2[Width];			// Ordered as the packed hidden layer
+		uint8_t shift[Width];		// Right shift of each hidden neuron to int16
+		scalar_t w0;
+		scalar_t b0;
+		scalar_t output_factor;
+		scalar_t output_min;
+		uint32_t error;
+		uint32_t compiled;
+	} CACHE_ALIGNED;
+
+	// Inputs for re-probing the error bounds (trigger inputs and their neighbours)
+	std::vector<scalar_t> _probes;
+
+	/**
+	 * @brief Measures the maximum absolute output of layer 0 per submodel,
+	 *        over the inputs the submodel is responsible for.
+	 * @param info The information of all submodels, ordered by stage
+	 * @returns A vector with the range of each submodel
+	 */
+	std::vector<scalar64_t> measure_input_range(const std::vector<rqrmi_submodel_info_t>& info) const;
+
+	/**
+	 * @brief Quantizes the submodels to the array of this
+	 * @tparam Width The hidden width of the array
+	 * @param info The information of all submodels, ordered by stage
+	 * @param input_range The maximum absolute output of layer 0 per submodel
+	 */
+	template <uint32_t Width>
+	void quantize_submodels(const std::vector<rqrmi_submodel_info_t>& info,
+			const std::vector<scalar64_t>& input_range);
+
+	/**
+	 * @brief The evaluation kernel of the quantized model
+	 * @tparam Width The hidden width of the submodels
+	 * @param[out] submodel_idx The index of the last submodel per input. Ignored when null.
+	 */
+	template <uint32_t Width>
+	void evaluate_kernel(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output,
+			wide_scalar_t& error, uint32_t* submodel_idx) const;
+
+	/**
+	 * @brief Evaluates the quantized model on probes, updates the required error per submodel
+	 * @param probes The inputs to probe
+	 * @param num_of_probes The number of inputs
+	 * @param index The records indexed by the model (range start values, sorted)
+	 * @param num_of_records The number of records indexed by the model
+	 * @param[in,out] required The required error per submodel
+	 * @param[out] route The last submodel per probe (RQRMI_INVALID_ROUTE for invalid outputs)
+	 */
+	void probe_errors(const scalar_t* probes, uint32_t num_of_probes,
+			const scalar_t* index, uint32_t num_of_records,
+			std::vector<int32_t>& required, uint32_t* route) const;
+
+	/**
+	 * @brief Sets the error of a submodel
+	 */
+	void set_error(uint32_t submodel_idx, uint32_t value);
+
+	/**
+	 * @brief Returns the error of a submodel
+	 */
+	uint32_t get_error(uint32_t submodel_idx) const;
+
+public:
+
+	/**
+	 * @brief Create new quantized instance from RQRMI model
+	 * @throws std::runtime_error in case the model is not valid RQRMI model
+	 */
+	RQRMIFastQuantized(rqrmi_model_t *model);
+	virtual ~RQRMIFastQuantized() {}
+
+	/**
+	 * @brief Re-probes the error bounds of all last-stage submodels using the quantized model.
+	 *        Probes the records boundaries, the trigger inputs of the original model,
+	 *        and the inputs in which the quantized model switches between submodels.
+	 *        Error bounds are only widened, never tightened.
+	 * @param index The records indexed by the model (range start values, sorted)
+	 * @param num_of_records The number of records indexed by the model
+	 * @returns The maximal number of positions added to the error of a submodel
+	 */
+	virtual uint32_t validate_error_bounds(const scalar_t* index, uint32_t num_of_records);
+
+	/**
+	 * @brief Evaluate RQRMI models using fixed-point arithmetic
+	 * @param[in] inputs a vector of inputs
+	 * @param[out] status a vector of output status (1 valid, 0 error)
+	 * @param[out] output a vector of outputs
+	 * @param[out] error a vector of error values
+	 */
+	virtual void evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const;
+};
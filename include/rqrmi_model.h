@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <matrix_operations.h>
 #include <vector_list.h>
 
@@ -38,6 +39,9 @@
 // Defines the number of input nodes of the RQRMI model
 #define RQRMI_MODEL_INPUT_SIZE 1
 
+// Maximum number of hidden neurons of RQRMI submodels
+#define RQRMI_MAX_HIDDEN_WIDTH 16
+
 typedef struct rqrmi_submodel rqrmi_submodel_t;
 typedef struct rqrmi_stage rqrmi_stage_t;
 typedef struct rqrmi_model rqrmi_model_t;
@@ -48,10 +52,11 @@ typedef struct rqrmi_model rqrmi_model_t;
 typedef struct {
 	scalar_t w0;
 	scalar_t b0;
-	scalar_t w1[8];
-	scalar_t b1[8];
-	scalar_t w2[8];
+	scalar_t w1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t b1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t w2[RQRMI_MAX_HIDDEN_WIDTH];
 	scalar_t b2;
+	uint32_t hidden_width;
 	scalar_t output_factor;
 	scalar_t output_min;
 	scalar_t input_mean;
@@ -79,6 +84,21 @@ rqrmi_model_t* rqrmi_load_model(void* ptr, int size);
  */
 void rqrmi_free_model(rqrmi_model_t* rqrmi_model);
 
+/**
+ * @brief Creates a model that shares the submodels of another model, with its own
+ *        input placeholder and scratchpads. Forks of a model can be evaluated concurrently.
+ * @param rqrmi_model The RQRMI model
+ * @returns The fork, or RQRMI_MODEL_ERROR in case of an error
+ * @note The fork is valid as long as the original model is. Free with rqrmi_free_fork.
+ */
+rqrmi_model_t* rqrmi_fork_model(rqrmi_model_t* rqrmi_model);
+
+/**
+ * @brief Frees the memory allocated for a fork of an RQRMI model
+ * @param fork A fork created by rqrmi_fork_model
+ */
+void rqrmi_free_fork(rqrmi_model_t* fork);
+
 /**
  * @brief Places an input to an RQRMI model (and all of its submodels)
  * @param rqrmi_model An RQRMI model
@@ -121,6 +141,20 @@ matrix_t* rqrmi_evaluate_sub_model(rqrmi_model_t* rqrmi_model, rqrmi_submodel_t*
  */
 scalar_t rqrmi_evaluate_model(rqrmi_model_t* rqrmi_model, scalar_t input);
 
+/**
+ * @brief Feed the RQRMI model with a batch of inputs.
+ *        RQRMI submodels are evaluated with SIMD, several inputs at once.
+ * @param rqrmi_model The RQRMI model
+ * @param inputs The inputs to feed to the model
+ * @param[out] outputs The outputs of the model
+ * @param[out] submodel_idx The submodel of the last stage used per input, may be NULL
+ * @param num_of_inputs The number of inputs
+ * @note Might throw exceptions
+ * @note The outputs are identical to those of rqrmi_evaluate_model
+ */
+void rqrmi_evaluate_model_batch(rqrmi_model_t* rqrmi_model, const scalar_t* inputs, scalar_t* outputs,
+		uint32_t* submodel_idx, size_t num_of_inputs);
+
 /**
  * @brief Calculate the trigger inputs of an RQRMI submodel
  * @param rqrmi_model the RQRMI model
@@ -202,6 +236,7 @@ void rqrmi_set_num_of_stages(rqrmi_model_t* rqrmi_model, uint32_t value);
  * @param[out] output The output information
  * @returns 1 on success, 0 on error
  * @note RMI will not work here, only used for RQRMI models
+ * @note Hidden layers narrower than RQRMI_MAX_HIDDEN_WIDTH are zero padded
  */
 uint32_t rqrmi_get_submodel_info(rqrmi_model_t* rqrmi_model, uint32_t stage_idx,
 		uint32_t submodel_idx, rqrmi_submodel_info_t* output);
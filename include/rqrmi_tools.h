@@ -31,10 +31,14 @@
 #include <rqrmi_model.h>
 
 #define RQRMI_PROBING_ERROR NULL
+#define RQRMI_DATASET_STREAM_ERROR NULL
 
 // Used to store probing datasets for fast operations
 typedef struct rqrmi_probing rqrmi_probing_t;
 
+// Used to generate the dataset of a bucket in mini-batches, without materializing it
+typedef struct rqrmi_dataset_stream rqrmi_dataset_stream_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,6 +58,12 @@ rqrmi_probing_t* rqrmi_tools_probe_new(matrix_t* records, uint32_t stage_num, ui
  */
 void rqrmi_tools_probe_free(rqrmi_probing_t* probe);
 
+/**
+ * @brief Sets the number of threads used for calculating transition sets and responsibilities
+ * @param num_of_threads The number of threads, 0 for all available cores (default)
+ */
+void rqrmi_tools_set_num_of_threads(uint32_t num_of_threads);
+
 /**
  * @brief Calculate the transition set of a stage
  * @param model An RQRMI model
@@ -64,6 +74,7 @@ void rqrmi_tools_probe_free(rqrmi_probing_t* probe);
  * @note  The responsibility of stage stage_idx must be defined prior to this method
  * @note  The transition set is an ordered vector list and stored at the probe data structure
  * 		  Vector format: [ x,  B_i( M_i(x-epsilon) ),  B_i( M_i(x+epsilon) ) ]
+ * @note  The transition inputs of the submodels are calculated in parallel
  */
 vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_probing_t* probe, uint32_t stage_idx);
 
@@ -76,6 +87,7 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
  * @note  User should not free the returned pointer
  * @note  First stage has width of 1
  * @note  The responsibilities of stages {0,1,...,x-1} must be calculated before that of stage x
+ * @note  The transition points of the previous stage are evaluated in parallel
  */
 vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi_probing_t* probe, uint32_t stage_idx);
 
@@ -93,6 +105,71 @@ vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi
 matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
 		uint32_t num_of_samples, bool random, bool shuffle);
 
+/**
+ * @brief Generate the datasets of multiple buckets of a stage in parallel
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The required stage
+ * @param bucket_indices The required buckets in stage
+ * @param num_of_buckets The number of buckets to generate
+ * @param num_of_samples Dataset maximum size per bucket
+ * @param random Smart random sampling
+ * @param shuffle Shuffle datasets
+ * @param[out] output The datasets, indexed by bucket_indices, in the format of rqrmi_tools_generate_dataset
+ * @returns True on success. On error, no dataset is allocated.
+ * @note  The probe is only read, so it must not be modified concurrently
+ */
+bool rqrmi_tools_generate_datasets(rqrmi_probing_t* probe, uint32_t stage_idx, const uint32_t* bucket_indices,
+		uint32_t num_of_buckets, uint32_t num_of_samples, bool random, bool shuffle, matrix_t** output);
+
+/**
+ * @brief Creates a stream over the dataset of a stage bucket.
+ *        Only the sampling plan is stored; samples are generated on demand by rqrmi_tools_dataset_stream_next.
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The required stage
+ * @param bucket_idx The required bucket in stage
+ * @param num_of_samples Dataset maximum size
+ * @param random Smart random sampling
+ * @param seed Seed for random sampling
+ * @returns A stream, or RQRMI_DATASET_STREAM_ERROR on error
+ * @note  Streams of different buckets may be created and used concurrently, as long as the probe is not modified
+ * @note  Without random sampling, the samples are the same as the ones of rqrmi_tools_generate_dataset
+ */
+rqrmi_dataset_stream_t* rqrmi_tools_dataset_stream_new(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		uint32_t num_of_samples, bool random, uint32_t seed);
+
+/**
+ * @brief Frees a dataset stream
+ */
+void rqrmi_tools_dataset_stream_free(rqrmi_dataset_stream_t* stream);
+
+/**
+ * @brief Returns the number of samples of a dataset stream
+ */
+uint32_t rqrmi_tools_dataset_stream_get_size(rqrmi_dataset_stream_t* stream);
+
+/**
+ * @brief Shuffles the order of the samples and rewinds the stream
+ * @param stream A dataset stream
+ * @param seed Seed of the permutation
+ */
+void rqrmi_tools_dataset_stream_shuffle(rqrmi_dataset_stream_t* stream, uint32_t seed);
+
+/**
+ * @brief Rewinds the stream, keeps the current order of the samples
+ */
+void rqrmi_tools_dataset_stream_rewind(rqrmi_dataset_stream_t* stream);
+
+/**
+ * @brief Generates the next mini-batch of the stream
+ * @param stream A dataset stream
+ * @param batch_size The maximum number of samples to generate
+ * @param[out] inputs The input of each sample, not normalized
+ * @param[out] record_indices The expected record index of each sample
+ * @returns The number of generated samples, 0 once all samples were generated (call rewind or shuffle to start over)
+ */
+uint32_t rqrmi_tools_dataset_stream_next(rqrmi_dataset_stream_t* stream, uint32_t batch_size,
+		scalar_t* inputs, uint32_t* record_indices);
+
 /**
  * @brief Calculates the maximum error and bucket coverage of a submodel
  * @param model An RQRMI model
@@ -104,11 +181,30 @@ matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe, uint32_t stage_id
  */
 scalar_pair_t rqrmi_tools_calculate_submodel_error(rqrmi_model_t* model, rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t submodel_idx);
 
+/**
+ * @brief Calculates the exact error of all submodels in the last stage, by evaluating the model
+ *        on its breakpoints and on the record edges (the model is piecewise linear between them)
+ * @param model An RQRMI model
+ * @param starts The start values of the records, sorted
+ * @param ends The end values of the records (inclusive), NULL in case the records are contiguous
+ * @param num_of_records The number of records indexed by the model
+ * @param[out] error_list The error of each submodel of the last stage, including the lookup margin
+ * @note Does not require a probe, can be used on loaded models
+ * @note May throw exceptions
+ */
+void rqrmi_tools_calculate_exact_errors(rqrmi_model_t* model, const scalar_t* starts, const scalar_t* ends,
+		uint32_t num_of_records, uint32_t* error_list);
+
 /**
  * @brief Returns the width of a stage
  */
 uint32_t rqrmi_tools_get_stage_width(rqrmi_probing_t* probe, uint32_t stage_idx);
 
+/**
+ * @brief Returns the number of records indexed by the probe
+ */
+uint32_t rqrmi_tools_get_num_of_records(rqrmi_probing_t* probe);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,142 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file rqrmi_trainer.h */
+
+#pragma once
+
+#include <basic_types.h>
+#include <matrix_operations.h>
+#include <rqrmi_model.h>
+#include <rqrmi_tools.h>
+
+#define RQRMI_TRAINER_ERROR NULL
+
+/**
+ * @brief Hyper parameters for training RQRMI submodels
+ */
+typedef struct {
+	uint32_t hidden_width;				// Number of hidden neurons (at most RQRMI_MAX_HIDDEN_WIDTH)
+	uint32_t batch_size;				// Mini-batch size
+	scalar_t learning_rate;				// Adam learning rate
+	uint32_t samples_per_bucket;		// Initial dataset size per submodel
+	scalar_t threshold_submodel_error;	// Retrain last stage submodels with higher error (in records)
+	scalar_t threshold_bucket_coverage;	// Retrain inner stage submodels with lower bucket coverage
+	scalar_t retraining_multiplier;		// Dataset growth per retraining iteration
+	uint32_t retraining_times;			// Maximum number of training iterations per stage
+	uint32_t num_of_threads;			// Number of training threads, 0 for all available cores
+	uint32_t seed;						// Seed for weight initialization and shuffling
+} rqrmi_trainer_params_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sets the default hyper parameters, as used by LookupCpu
+ * @param[out] params The parameters to initialize
+ */
+void rqrmi_trainer_default_params(rqrmi_trainer_params_t* params);
+
+/**
+ * @brief Trains a single 1 x W x 1 submodel on a dataset using Adam on mini-batches
+ * @param dataset A matrix. Each row is a sample with format [input, record_index], as generated by rqrmi_tools_generate_dataset
+ * @param num_of_records The number of records indexed by the model, used to normalize the expected outputs
+ * @param epochs Number of epochs to train
+ * @param params The hyper parameters
+ * @param seed Seed for weight initialization and shuffling
+ * @param[out] output The trained submodel
+ * @returns The average loss of the last epoch
+ * @note Might throw exceptions
+ */
+scalar_t rqrmi_trainer_train_submodel(matrix_t* dataset, uint32_t num_of_records, uint32_t epochs,
+		const rqrmi_trainer_params_t* params, uint32_t seed, rqrmi_submodel_info_t* output);
+
+/**
+ * @brief Trains submodels of a stage in parallel, each on its own worker thread.
+ *        Each worker streams the dataset of its current submodel.
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The stage to train
+ * @param submodel_indices The submodels to train within the stage
+ * @param num_of_submodels The number of submodels to train
+ * @param num_of_samples The dataset size per submodel
+ * @param epochs Number of epochs to train
+ * @param params The hyper parameters
+ * @param[out] output The trained submodels, indexed by submodel_indices.
+ *             Submodels with no inputs are marked as not compiled.
+ * @note  The responsibility of the stage must be calculated prior to this method
+ * @note  The probe must not be modified concurrently
+ * @note  Might throw exceptions
+ */
+void rqrmi_trainer_train_stage(rqrmi_probing_t* probe, uint32_t stage_idx, const uint32_t* submodel_indices,
+		uint32_t num_of_submodels, uint32_t num_of_samples, uint32_t epochs,
+		const rqrmi_trainer_params_t* params, rqrmi_submodel_info_t* output);
+
+/**
+ * @brief Packs RQRMI stages to a byte array, in the format read by rqrmi_load_model
+ * @param input_domain_min The minimum input of the model
+ * @param input_domain_max The maximum input of the model
+ * @param num_of_stages The number of stages to pack
+ * @param stage_widths The width of each stage
+ * @param submodels Per stage, the information of its submodels
+ * @param error_list The error of each submodel of the last stage, NULL for all zeros
+ * @param[out] size The size of the output in bytes
+ * @returns A buffer the user should free, RQRMI_TRAINER_ERROR on error
+ */
+void* rqrmi_trainer_pack_model(scalar_t input_domain_min, scalar_t input_domain_max, uint32_t num_of_stages,
+		const uint32_t* stage_widths, rqrmi_submodel_info_t** submodels, const uint32_t* error_list, uint32_t* size);
+
+/**
+ * @brief Trains a complete RQRMI model over records: calculates the responsibilities,
+ *        trains each stage, and retrains submodels that do not meet the thresholds.
+ * @param records The records to index. Nx1 matrix. The key values / range start values. Should be sorted.
+ * @param num_of_stages The number of stages
+ * @param stage_widths The width of each stage
+ * @param epochs The number of epochs per stage
+ * @param params The hyper parameters
+ * @param[out] size The size of the output in bytes
+ * @returns The packed model, the user should free it. RQRMI_TRAINER_ERROR on error.
+ */
+void* rqrmi_trainer_train_model(matrix_t* records, uint32_t num_of_stages, const uint32_t* stage_widths,
+		const uint32_t* epochs, const rqrmi_trainer_params_t* params, uint32_t* size);
+
+/**
+ * @brief Retrains an existing RQRMI model after some of its records changed.
+ *        Only last stage submodels whose responsibility contains changed records are retrained,
+ *        other submodels are shifted to the new record indices. The internal stages are kept.
+ * @param packed_model The packed model to retrain, as read by rqrmi_load_model
+ * @param packed_size The size of the packed model in bytes
+ * @param old_records The records indexed by the model. Nx1 matrix. Should be sorted.
+ * @param new_records The records to index. Mx1 matrix. Should be sorted.
+ * @param epochs The number of epochs for the last stage
+ * @param params The hyper parameters
+ * @param[out] size The size of the output in bytes
+ * @param[out] num_of_retrained The number of retrained submodels, may be NULL
+ * @returns The packed model with exact error list, the user should free it. RQRMI_TRAINER_ERROR on error.
+ */
+void* rqrmi_trainer_retrain_model(void* packed_model, uint32_t packed_size, matrix_t* old_records, matrix_t* new_records,
+		uint32_t epochs, const rqrmi_trainer_params_t* params, uint32_t* size, uint32_t* num_of_retrained);
+
+#ifdef __cplusplus
+}
+#endif
@@ -29,13 +29,31 @@
 #include <matrix_operations.h>
 
 #define VECTOR_LIST_ERROR NULL
+#define VECTOR_ARENA_ERROR NULL
 
+// A list of vectors, stored contiguously
 typedef struct vector_list vector_list_t;
 
+// Memory arena for vector lists. Memory of freed lists is recycled, and all memory is freed in bulk.
+typedef struct vector_arena vector_arena_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Creates a new memory arena for vector lists
+ * @returns The arena or VECTOR_ARENA_ERROR in case of an error
+ * @note The arena is not thread safe
+ */
+vector_arena_t* vector_arena_create();
+
+/**
+ * @brief Frees an arena with all the lists that were created in it
+ * @param arena A vector list arena
+ */
+void vector_arena_free(vector_arena_t* arena);
+
 /**
  * @brief Creates a new instance of vector list of width @a width (each element is 4 bytes)
  * @param width The width of each vector in the list
@@ -43,9 +61,18 @@ extern "C" {
  */
 vector_list_t* vector_list_create(uint32_t width);
 
+/**
+ * @brief Creates a new instance of vector list of width @a width in an arena
+ * @param width The width of each vector in the list
+ * @param arena The arena to allocate the list from, NULL for the heap
+ * @returns The instance or VECTOR_LIST_ERROR in case of an error
+ */
+vector_list_t* vector_list_create_in_arena(uint32_t width, vector_arena_t* arena);
+
 /**
  * @brief Frees a list
  * @param list a vector list
+ * @note  Lists in arenas are recycled by their arena
  */
 void vector_list_free(vector_list_t* list);
 
@@ -59,6 +86,7 @@ uint32_t vector_list_get_size(vector_list_t* list);
  * @brief Adds new empty vector to the list
  * @param list Pointer to the list
  * @returns On success returns 1, otherwise 0
+ * @note  Invalidates pointers to the vectors of the list in case the list grows
  */
 int vector_list_push_back(vector_list_t* list);
 
@@ -87,6 +115,7 @@ void* vector_list_get_last(vector_list_t* list);
 /**
  * @brief Push back new element to the list and return a pointer to it
  * @param list The vector list
+ * @note  Invalidates pointers to the vectors of the list in case the list grows
   * @note Might throw exceptions
  */
 void* vector_list_push_back_and_get(vector_list_t* list);
@@ -106,6 +135,13 @@ void* vector_list_begin(vector_list_t* list);
  */
 void* vector_list_iterate(vector_list_t* list);
 
+/**
+ * @brief Returns a pointer to the contiguous vectors of the list
+ * @returns The vectors (row major, width scalars each), NULL for empty lists
+ * @note  The pointer is invalidated when the list grows
+ */
+scalar_t* vector_list_data(vector_list_t* list);
+
 /**
  * @brief Sort the vector list by a column value
  * @param list The vector list
@@ -30,6 +30,7 @@
 #include <algorithms.h>
 #include <rqrmi_model.h>
 #include <rqrmi_fast.h>
+#include <rqrmi_fast_quantized.h>
 #include <interval_set.h>
 
 using namespace std;
@@ -99,7 +100,11 @@ void IntervalSet<N>::load(ObjectReader& object) {
 	matrix_t* database = load_matrix(index_db_handler.buffer(), index_db_handler.size());
 
 	// Load RQRMIFast
-	_model_fast = new RQRMIFast(this->_model);
+#ifdef RQRMI_QUANTIZED
+	_model_fast = new RQRMIFastQuantized(this->_model);
+#else
+	_model_fast = RQRMIFast::create(this->_model);
+#endif
 
 	// Initiate the rule database
 	this->_size=database->rows;
@@ -117,6 +122,9 @@ void IntervalSet<N>::load(ObjectReader& object) {
 	}
 	free_matrix(database);
 
+	// The fast model rounds differently than the generic one
+	_model_fast->validate_error_bounds(this->_index, this->_size);
+
 	// Read the validation database
 	ObjectReader validation_reader(validation_db_handler.buffer(), validation_db_handler.size());
 
@@ -457,6 +465,147 @@ IntervalSetInfoBatch<N> IntervalSet<N>::rqrmi_search(PacketBatch<N>& packets) co
 	return rqrmi_info;
 }
 
+/**
+ * @brief Search for packets within several interval sets using a fused inference kernel.
+ *        The fields of all iSets are gathered from each packet header at once, and the
+ *        stages of iSets with the same specialized model shape are interleaved.
+ * @param isets An array of interval sets
+ * @param num_of_isets The number of interval sets
+ * @param packets A batch of packets
+ * @param[out] info An array of num_of_isets batches, one per iSet
+ */
+template <uint32_t N>
+void IntervalSet<N>::rqrmi_search_multi(IntervalSet<N>* const* isets, uint32_t num_of_isets,
+		PacketBatch<N>& packets, IntervalSetInfoBatch<N>* info)
+{
+	// RQRMIFast input/output parameters, per iSet
+	wide_scalar_t rqrmi_input[num_of_isets], rqrmi_outputs[num_of_isets];
+	wide_scalar_t rqrmi_status[num_of_isets], rqrmi_error[num_of_isets];
+	const RQRMIFast* models[num_of_isets];
+	uint32_t field_index[num_of_isets];
+
+	for (uint32_t m=0; m<num_of_isets; ++m) {
+		models[m] = isets[m]->_model_fast;
+		field_index[m] = isets[m]->_field_index;
+	}
+
+	for (uint32_t i=0; i<N; i+=RQRMIFast::input_width()) {
+		uint32_t count = MIN(RQRMIFast::input_width(), N-i);
+
+		// Gather the fields of all iSets from each header
+		for (uint32_t k=0; k<RQRMIFast::input_width(); ++k) {
+			const uint32_t* header = (k < count) ? packets[i+k] : nullptr;
+			for (uint32_t m=0; m<num_of_isets; ++m) {
+				rqrmi_input[m].scalars[k] = (header == nullptr) ? 0 : header[field_index[m]];
+			}
+		}
+
+		// Perform SIMD inference of all iSets
+		RQRMIFast::evaluate_interleaved(models, num_of_isets,
+				rqrmi_input, rqrmi_status, rqrmi_outputs, rqrmi_error);
+
+		// Update RQRMI info
+		for (uint32_t m=0; m<num_of_isets; ++m) {
+			for (uint32_t k=0; k<count; ++k) {
+				info[m][i+k].rqrmi_input = rqrmi_input[m].scalars[k];
+				info[m][i+k].rqrmi_output = rqrmi_outputs[m].scalars[k];
+				info[m][i+k].rqrmi_error = rqrmi_error[m].integers[k];
+				info[m][i+k].valid = rqrmi_status[m].integers[k] & (packets[i+k] != nullptr);
+				info[m][i+k].header = packets[i+k];
+			}
+		}
+	}
+
+	// Show debug messages
+#ifndef NDEBUG
+	for (uint32_t m=0; m<num_of_isets; ++m) {
+		infof("IntervalSet %u information for batch:", field_index[m]);
+		for (uint32_t i=0; i<N; ++i) {
+			infof("%u: input: %f, output: %.12f, error: %u, valid: %u, db_idx: %u",
+					i, info[m][i].rqrmi_input, info[m][i].rqrmi_output,
+					info[m][i].rqrmi_error, info[m][i].valid,
+					(uint32_t)(info[m][i].rqrmi_output * isets[m]->_size));
+		}
+	}
+#endif
+}
+
+/**
+ * @brief Perform the secondary search of a single packet within several interval sets.
+ *        The search is done across all iSets at once for exploiting memory parallelism.
+ * @param isets An array of interval sets
+ * @param num_of_isets The number of interval sets
+ * @param info An array of num_of_isets RQRMI batches, one per iSet
+ * @param packet_idx The index of the packet within the batches
+ * @param[out] position An array of num_of_isets candidate rule indices, one per iSet
+ */
+template <uint32_t N>
+void IntervalSet<N>::secondary_search_multi(IntervalSet<N>* const* isets, uint32_t num_of_isets,
+		const IntervalSetInfoBatch<N>* info, uint32_t packet_idx, uint32_t* position)
+{
+	scalar_t key[num_of_isets];
+	uint32_t u_bound[num_of_isets], l_bound[num_of_isets];
+	uint32_t max_error = 0;
+
+	// Initiate all variables from all iSets
+	for (uint32_t k=0; k<num_of_isets; ++k) {
+		uint32_t error = info[k][packet_idx].rqrmi_error;
+		// Used for debugging
+		#if defined CUSTOM_ERROR_VALUE
+			error = CUSTOM_ERROR_VALUE;
+		#endif
+		// Update all variables
+		key[k] = info[k][packet_idx].rqrmi_input;
+		position[k] = info[k][packet_idx].rqrmi_output * isets[k]->_size;
+		u_bound[k] = std::min(isets[k]->_size-1, position[k]+error);
+		l_bound[k] = std::max(0, (int)position[k]-(int)error);
+		max_error = std::max(error, max_error);
+	}
+
+	// In case of binary search (default)
+#ifndef LINEAR_SEARCH
+	uint32_t current_value[num_of_isets], next_value[num_of_isets];
+
+	// Perform binary search
+	do {
+
+		// Fetch index database information from memory
+		for (uint32_t k=0; k<num_of_isets; ++k) {
+			current_value[k] = isets[k]->_index[position[k]] <= key[k];
+			next_value[k] = isets[k]->_index[position[k]+1] > key[k];
+		}
+
+		// Calculate the next position per iSet
+		for (uint32_t k=0; k<num_of_isets; ++k) {
+			if (current_value[k] & next_value[k]) {
+				// Do nothing
+			} else if (current_value[k]) {
+				l_bound[k] = position[k];
+				position[k]=(l_bound[k]+u_bound[k]);
+				position[k]=(position[k]>>1)+(position[k]&0x1); // Ceil
+			} else if (info[k][packet_idx].valid) {
+				u_bound[k] = position[k];
+				position[k]=(l_bound[k]+u_bound[k])>>1; // Floor
+			}
+		}
+
+		// Update error
+		max_error >>= 1;
+	} while (max_error > 0);
+	// In case of linear search (used for debugging)
+#else
+	for (uint32_t k=0; k<num_of_isets; ++k) {
+		for (position[k]=l_bound[k]; position[k]<u_bound[k]; ++position[k]) {
+			uint32_t current_value = isets[k]->_index[position[k]] <= key[k];
+			uint32_t next_value = isets[k]->_index[position[k]+1] > key[k];
+			if (current_value & next_value) {
+				break;
+			}
+		}
+	}
+#endif
+}
+
 /**
  * @brief Perform validation phase on packet header and a rule index
  * @param packet A pointer to packet headers
@@ -27,6 +27,7 @@
 #include <object_io.h>
 #include <matrix_operations.h>
 #include <lookup.h>
+#include <rqrmi_fast_quantized.h>
 #include <cpu_core_tools.h>
 #include <logging.h>
 
@@ -56,11 +57,14 @@ template <uint32_t N>
 void Lookup<N>::load(rqrmi_model_t* model, matrix_t* database) {
 	// Set model
 	_model = model;
-	_fast_model = new RQRMIFast(_model);
+#ifdef RQRMI_QUANTIZED
+	_fast_model = new RQRMIFastQuantized(_model);
+#else
+	_fast_model = RQRMIFast::create(_model);
+#endif
 
 	// Allocate members
 	_size=database->rows;
-
 	_index = new scalar_t[_size];
 	_values = new scalar_t[_size];
 
@@ -75,6 +79,9 @@ void Lookup<N>::load(rqrmi_model_t* model, matrix_t* database) {
 			throw domain_error("index column in database is not ordered");
 		}
 	}
+
+	// The fast model rounds differently than the generic one
+	_fast_model->validate_error_bounds(_index, _size);
 }
 
 /**
@@ -93,10 +100,6 @@ void Lookup<N>::load(ObjectReader object) {
 	_model = rqrmi_load_model(model_handler.buffer(), model_handler.size());
 	matrix_t* database = load_matrix(database_handler.buffer(), database_handler.size());
 
-	_fast_model = new RQRMIFast(_model);
-
-	_fast_model = new RQRMIFast(_model);
-
 	// Validate inputs
 	if (database == MATRIX_ERROR) {
 		throw invalid_argument("data matrix invalid");
@@ -126,21 +129,18 @@ void Lookup<N>::add_listener(LookupListener& listener) {
 }
 
 /**
- * @brief Perform binary search over the database
+ * @brief Perform binary search and validation over the database
  * @param key The key to search
  * @param hint A hint to the possible location (RQRMI output)
  * @param error Maximum error bound for search
- * @throws out_of_range In case of lookup internal error
+ * @returns The search result
  */
 template <uint32_t N>
-void Lookup<N>::perform_binary_search(scalar_t key, scalar_t hint, uint32_t error) {
+typename Lookup<N>::result_t Lookup<N>::binary_search(scalar_t key, scalar_t hint, uint32_t error) const {
 
 // Used for debugging
 #ifdef NO_BIN_SEARCH
-	for (auto it : _listeners) {
-		it->on_new_result(key, 0, 1);
-	}
-	return;
+	return (result_t){ key, 0, 1 };
 #endif
 
 // Used for debugging
@@ -190,12 +190,31 @@ void Lookup<N>::perform_binary_search(scalar_t key, scalar_t hint, uint32_t erro
 
 	info("Performing validation");
 
-	// Perform validation
-	int found = _values[pos] < key;
+	// Perform validation, the record range is [index, value)
+	uint32_t found = (_index[pos] <= key) & (key < _values[pos]);
+	return (result_t){ key, pos, found };
+}
+
+/**
+ * @brief Perform binary search over the database, invokes the listeners with the result
+ * @param key The key to search
+ * @param hint A hint to the possible location (RQRMI output)
+ * @param error Maximum error bound for search
+ * @throws out_of_range In case of lookup internal error
+ */
+template <uint32_t N>
+void Lookup<N>::perform_binary_search(scalar_t key, scalar_t hint, uint32_t error) {
+	notify_listeners(binary_search(key, hint, error));
+}
+
+/**
+ * @brief Invokes the listeners with a search result
+ */
+template <uint32_t N>
+void Lookup<N>::notify_listeners(const result_t& result) {
 	for (auto it : _listeners) {
-		it->on_new_result(key, pos, found);
+		it->on_new_result(result.input, result.index, result.found);
 	}
-	return;
 }
 
 /**
@@ -205,13 +224,157 @@ void Lookup<N>::perform_binary_search(scalar_t key, scalar_t hint, uint32_t erro
  * @throws overflow_error
  */
 template <uint32_t N>
-scalar_pair_t Lookup<N>::get_record(uint32_t index) {
+scalar_pair_t Lookup<N>::get_record(uint32_t index) const {
 	if (index >= _size) {
 		throw overflow_error("record index our of range");
 	}
 	return (scalar_pair_t) { _index[index], _values[index] };
 }
 
+/**
+ * @brief Returns the number of records that start at or before a key
+ * @param key The key to search
+ * @param hint A hint to the possible location (RQRMI output)
+ * @param error Maximum error bound for search
+ */
+template <uint32_t N>
+uint32_t Lookup<N>::upper_bound(scalar_t key, scalar_t hint, uint32_t error) const {
+
+	uint32_t pos = hint * _size;
+	uint32_t l_bound = (pos > error) ? pos - error : 0;
+	uint32_t u_bound = MIN((uint64_t)_size, (uint64_t)pos + error + 1);
+
+	// Keys outside of the error bound are searched over the whole database
+	if ((l_bound > 0 && _index[l_bound-1] > key) || (u_bound < _size && _index[u_bound] <= key)) {
+		l_bound = 0;
+		u_bound = _size;
+	}
+
+	// Find the first record that starts after the key
+	while (l_bound < u_bound) {
+		pos = (l_bound + u_bound) >> 1;
+		if (_index[pos] <= key) {
+			l_bound = pos+1;
+		} else {
+			u_bound = pos;
+		}
+	}
+	return l_bound;
+}
+
+/**
+ * @brief Resolves a range query given the RQRMI output of its low key
+ * @param lo The low key of the range (inclusive)
+ * @param hi The high key of the range (inclusive)
+ * @param hint The RQRMI output of lo
+ * @param error The error bound of the RQRMI output
+ */
+template <uint32_t N>
+typename Lookup<N>::range_t Lookup<N>::resolve_range(scalar_t lo, scalar_t hi, scalar_t hint, uint32_t error) const {
+	if (hi < lo) {
+		return (range_t){ 0, 0 };
+	}
+
+	// The first record is the one that contains lo, or the one after it
+	uint32_t first = upper_bound(lo, hint, error);
+	if (first > 0 && lo < _values[first-1]) {
+		--first;
+	}
+
+	// Stream the records until the first that starts after hi
+	uint32_t last = first;
+	while (last < _size && _index[last] <= hi) {
+		__builtin_prefetch(&_index[last+16]);
+		++last;
+	}
+	return (range_t){ first, last-first };
+}
+
+/**
+ * @brief Returns the records that intersect the range [lo, hi]
+ * @param lo The low key of the range (inclusive)
+ * @param hi The high key of the range (inclusive)
+ * @returns The first record and the number of records
+ */
+template <uint32_t N>
+typename Lookup<N>::range_t Lookup<N>::range_search(scalar_t lo, scalar_t hi) const {
+	range_t output;
+	scalar_pair_t range = { lo, hi };
+	range_search(&range, 1, &output);
+	return output;
+}
+
+/**
+ * @brief Streams the records that intersect the range [lo, hi] to a callback
+ * @param lo The low key of the range (inclusive)
+ * @param hi The high key of the range (inclusive)
+ * @param callback Invoked for each record, in order
+ * @param args User arguments for the callback
+ * @returns The number of records in the range
+ */
+template <uint32_t N>
+uint32_t Lookup<N>::range_search(scalar_t lo, scalar_t hi, range_callback_t callback, void* args) const {
+	range_t range = range_search(lo, hi);
+	for (uint32_t i=range.first; i<range.first+range.count; ++i) {
+		__builtin_prefetch(&_values[i+16]);
+		callback(i, _index[i], _values[i], args);
+	}
+	return range.count;
+}
+
+/**
+ * @brief Copies the records that intersect the range [lo, hi] to a buffer
+ * @param lo The low key of the range (inclusive)
+ * @param hi The high key of the range (inclusive)
+ * @param[out] output Buffer of {start, end} pairs
+ * @param max_records The size of the buffer
+ * @returns The number of records in the range. At most max_records are copied.
+ */
+template <uint32_t N>
+uint32_t Lookup<N>::range_search(scalar_t lo, scalar_t hi, scalar_pair_t* output, uint32_t max_records) const {
+	range_t range = range_search(lo, hi);
+	uint32_t count = MIN(range.count, max_records);
+	for (uint32_t i=0; i<count; ++i) {
+		output[i] = (scalar_pair_t){ _index[range.first+i], _values[range.first+i] };
+	}
+	return range.count;
+}
+
+/**
+ * @brief Perform many range queries
+ * @param ranges Pairs of {lo, hi}, both inclusive
+ * @param num_of_ranges The number of ranges
+ * @param[out] output The records of each range
+ */
+template <uint32_t N>
+void Lookup<N>::range_search(const scalar_pair_t* ranges, uint32_t num_of_ranges, range_t* output) const {
+
+	constexpr uint32_t width = RQRMIFast::input_width();
+	wide_scalar_t inputs, outputs, status, error;
+	scalar_t hints[width];
+	uint32_t errors[width];
+
+	for (uint32_t i=0; i<num_of_ranges; i+=width) {
+		uint32_t count = MIN(width, num_of_ranges-i);
+
+		// Evaluate the RQRMI model on the low keys, prefetch their database positions
+		for (uint32_t k=0; k<width; ++k) {
+			inputs.scalars[k] = ranges[i + (k<count ? k : 0)].first;
+		}
+		_fast_model->evaluate(inputs, status, outputs, error);
+		for (uint32_t k=0; k<count; ++k) {
+			// Keys out of the model's input domain search the whole database
+			hints[k] = status.integers[k] ? outputs.scalars[k] : 0;
+			errors[k] = status.integers[k] ? error.integers[k] : _size;
+			__builtin_prefetch(&_index[(uint32_t)(hints[k] * _size)]);
+		}
+
+		for (uint32_t k=0; k<count; ++k) {
+			output[i+k] = resolve_range(ranges[i+k].first, ranges[i+k].second, hints[k], errors[k]);
+		}
+	}
+}
+
 template <uint32_t N>
 LookupCPU<N>::LookupCPU() : _worker_rqrmi(nullptr), _worker_lookup(nullptr) {}
 
@@ -290,8 +453,8 @@ bool LookupCPU<N>::consumer_rqrmi_thread(batch_t& input, void* lookup_instance)
 		for (uint32_t k=0; k<RQRMIFast::input_width(); ++k) {
 			rqrmi_produced_job[i+k].input = inputs.scalars[k];
 			rqrmi_produced_job[i+k].result = outputs.scalars[k];
-			rqrmi_produced_job[i+k].error = error.scalars[k];
-			rqrmi_produced_job[i+k].valid = status.scalars[k];
+			rqrmi_produced_job[i+k].error = error.integers[k];
+			rqrmi_produced_job[i+k].valid = status.integers[k];
 		}
 	}
 
@@ -307,8 +470,8 @@ bool LookupCPU<N>::consumer_rqrmi_thread(batch_t& input, void* lookup_instance)
 	for (uint32_t k=0; k<counter; ++k) {
 		rqrmi_produced_job[start+k].input = inputs.scalars[k];
 		rqrmi_produced_job[start+k].result = outputs.scalars[k];
-		rqrmi_produced_job[start+k].error = error.scalars[k];
-		rqrmi_produced_job[start+k].valid = status.scalars[k];
+		rqrmi_produced_job[start+k].error = error.integers[k];
+		rqrmi_produced_job[start+k].valid = status.integers[k];
 	}
 
 	info("Done with RQRMIFast");
@@ -369,16 +532,260 @@ void LookupCPU<N>::stop_performance_measurement() {
  */
 template <uint32_t N>
 void LookupCPU<N>::print() const {
-	SimpleLogger::get().format("RQRMI utilization: %.2f%% "
+	messagef("RQRMI utilization: %.2f%% "
 		   "(throughput: %.2f rpus, backpressure: %.2f rpus, average time per batch: %.2f us)\n"
 		   "Lookup utilization: %.2f%% "
-		   "(throughput: %.2f rpus, backpressure: %.2f rpus, average time per batch: %.2f us)\n",
+		   "(throughput: %.2f rpus, backpressure: %.2f rpus, average time per batch: %.2f us)",
 			_worker_rqrmi->get_utilization(),   _worker_rqrmi->get_throughput(),
 			_worker_rqrmi->get_backpressure(), _worker_rqrmi->get_average_work_time(),
 			_worker_lookup->get_utilization(), _worker_lookup->get_throughput(),
 			_worker_lookup->get_backpressure(), _worker_lookup->get_average_work_time());
 }
 
+/**
+ * @brief Perform lookup on a batch
+ * @param input N keys to search
+ * @param[out] output N results, in the order of the keys
+ * @param[out] valid N flags, 0 for keys out of the model's input domain. May be NULL.
+ */
+template <uint32_t N>
+void LookupInline<N>::search_batch(const scalar_t* input, result_t* output, uint32_t* valid) const {
+
+	constexpr uint32_t width = RQRMIFast::input_width();
+	constexpr uint32_t num_of_words = (N + width - 1) / width;
+	wide_scalar_t inputs;
+	// RQRMI results, per SIMD word
+	wide_scalar_t outputs[num_of_words], status[num_of_words], error[num_of_words];
+
+	// Evaluate the RQRMI model on SIMD words. The database positions of a word are
+	// prefetched before the next word is evaluated, so their misses overlap
+	for (uint32_t i=0, w=0; i<N; i+=width, ++w) {
+		uint32_t count = MIN(width, N-i);
+		// Unused lanes of the last word replicate its first key
+		for (uint32_t k=0; k<width; ++k) {
+			inputs.scalars[k] = input[i + (k<count ? k : 0)];
+		}
+		this->_fast_model->evaluate(inputs, status[w], outputs[w], error[w]);
+		for (uint32_t k=0; k<count; ++k) {
+			if (status[w].integers[k]) {
+				__builtin_prefetch(&this->_index[(uint32_t)(outputs[w].scalars[k] * this->_size)]);
+			}
+		}
+	}
+
+	// Binary search and validation
+	for (uint32_t i=0; i<N; ++i) {
+		uint32_t w = i / width;
+		uint32_t k = i % width;
+		bool in_domain = status[w].integers[k];
+		if (valid) valid[i] = in_domain;
+		if (!in_domain) {
+			output[i] = (result_t){ input[i], 0, 0 };
+			continue;
+		}
+		output[i] = this->binary_search(input[i], outputs[w].scalars[k], error[w].integers[k]);
+	}
+}
+
+/**
+ * @brief Perform lookup on a batch, writes the results to a buffer
+ * @param input N keys to search
+ * @param[out] output N results, in the order of the keys.
+ *             Keys out of the model's input domain are not found.
+ */
+template <uint32_t N>
+void LookupInline<N>::search(const scalar_t* input, result_t* output) const {
+	search_batch(input, output, nullptr);
+}
+
+/**
+ * @brief Perform lookup on the requested value, invokes the listeners with the results
+ * @param input The input batch to search
+ * @returns true, the search is always performed
+ */
+template <uint32_t N>
+bool LookupInline<N>::search(batch_t input) {
+	result_t results[N];
+	uint32_t valid[N];
+	search_batch(input.items, results, valid);
+	for (uint32_t i=0; i<N; ++i) {
+		// Skip invalid inputs
+		if (!valid[i]) continue;
+		this->notify_listeners(results[i]);
+	}
+	return true;
+}
+
+template <uint32_t N>
+Lookup64<N>::Lookup64() : _index(nullptr), _values(nullptr),
+	_size(0), _model(nullptr), _fast_model(nullptr), _own_model(false) {};
+
+template <uint32_t N>
+Lookup64<N>::~Lookup64() {
+	delete[] _index;
+	delete[] _values;
+	delete _fast_model;
+	if (_own_model) {
+		rqrmi_free_model(_model);
+	}
+}
+
+/**
+ * @brief Loads the RQRMI model and database from arrays
+ * @param model The RQRMI object
+ * @param starts The inclusive start of each record, sorted
+ * @param ends The exclusive end of each record
+ * @param size The number of records
+ * @throws domain_error
+ */
+template <uint32_t N>
+void Lookup64<N>::load(rqrmi_model_t* model, const uint64_t* starts, const uint64_t* ends, uint32_t size) {
+	// Set model
+	_model = model;
+	_fast_model = new RQRMIFast64(_model);
+
+	// Allocate members
+	_size = size;
+	_index = new uint64_t[_size];
+	_values = new uint64_t[_size];
+
+	// Copy data
+	for (uint32_t i=0; i<_size; ++i) {
+		_index[i] = starts[i];
+		_values[i] = ends[i];
+
+		// Check for order
+		if (i>0 && _index[i] <= _index[i-1]) {
+			throw domain_error("index column in database is not ordered");
+		}
+	}
+
+	// The model was trained over float inputs, its errors do not hold for 64-bit records
+	_fast_model->validate_error_bounds(_index, _size);
+}
+
+/**
+ * @brief Loads the RQRMI model and database from memory
+ * @param object An object reader that contains the model, and the database:
+ *        uint32 number of records, followed by {start, end} uint64 pairs
+ * @throws invalid_argument, domain_error
+ */
+template <uint32_t N>
+void Lookup64<N>::load(ObjectReader object) {
+
+	// Read both database and model
+	ObjectReader model_handler = object.extract();
+	ObjectReader database_handler = object.extract();
+
+	// Validate inputs
+	uint32_t size = database_handler.read<uint32_t>();
+	if (database_handler.size() != size * 2 * sizeof(uint64_t)) {
+		throw invalid_argument("data records invalid");
+	}
+	rqrmi_model_t* model = rqrmi_load_model(model_handler.buffer(), model_handler.size());
+	if (model == RQRMI_MODEL_ERROR){
+		throw invalid_argument("invalid RQRMI model");
+	}
+
+	// Read records
+	vector<uint64_t> starts(size), ends(size);
+	for (uint32_t i=0; i<size; ++i) {
+		starts[i] = database_handler.read<uint64_t>();
+		ends[i] = database_handler.read<uint64_t>();
+	}
+
+	// This owns the model
+	_own_model = true;
+
+	// Call load
+	load(model, starts.data(), ends.data(), size);
+}
+
+/**
+ * @brief Perform binary search and validation over the database
+ * @param key The key to search
+ * @param hint A hint to the possible location (RQRMI output)
+ * @param error Maximum error bound for search
+ * @returns The search result
+ */
+template <uint32_t N>
+typename Lookup64<N>::result_t Lookup64<N>::binary_search(uint64_t key, scalar64_t hint, uint32_t error) const {
+
+	uint32_t pos = hint * _size;
+	uint32_t l_bound = (pos > error) ? pos - error : 0;
+	uint32_t u_bound = MIN((uint64_t)_size-1, (uint64_t)pos + error);
+
+	// The error bounds were validated on record boundaries only,
+	// keys outside of the bound are searched over the whole database
+	if ((l_bound > 0 && _index[l_bound] > key) || (u_bound+1 < _size && _index[u_bound+1] <= key)) {
+		l_bound = 0;
+		u_bound = _size-1;
+	}
+
+	// Find the last record that starts before the key
+	while (l_bound < u_bound) {
+		pos = (l_bound + u_bound + 1) >> 1; // Ceil
+		if (_index[pos] <= key) {
+			l_bound = pos;
+		} else {
+			u_bound = pos-1;
+		}
+	}
+
+	// Perform validation, the record range is [index, value)
+	uint32_t found = (_index[l_bound] <= key) & (key < _values[l_bound]);
+	return (result_t){ key, l_bound, found };
+}
+
+/**
+ * @brief Perform lookup on a batch, writes the results to a buffer
+ * @param input N keys to search
+ * @param[out] output N results, in the order of the keys
+ */
+template <uint32_t N>
+void Lookup64<N>::search(const uint64_t* input, result_t* output) const {
+
+	constexpr uint32_t width = RQRMIFast64::input_width();
+	wide_double_t keys, outputs, status, error;
+	scalar64_t hints[N];
+
+	// Evaluate the RQRMI model on SIMD words, prefetch the database positions of each word
+	for (uint32_t i=0; i<N; i+=width) {
+		uint32_t count = MIN(width, N-i);
+		for (uint32_t k=0; k<width; ++k) {
+			keys.integers[k] = input[i + (k<count ? k : 0)];
+		}
+		_fast_model->evaluate(keys, status, outputs, error);
+		for (uint32_t k=0; k<count; ++k) {
+			// Submodels that were not compiled have no error bound, search the whole database
+			hints[i+k] = status.integers[k] ? outputs.doubles[k] : 0;
+			output[i+k].index = status.integers[k] ? error.integers[k] : _size;
+			__builtin_prefetch(&_index[(uint32_t)(hints[i+k] * _size)]);
+		}
+	}
+
+	// Binary search and validation
+	for (uint32_t i=0; i<N; ++i) {
+		output[i] = binary_search(input[i], hints[i], output[i].index);
+	}
+}
+
+/**
+ * @brief Returns a record from the database
+ * @param index The requested index of the record
+ * @param[out] start The inclusive start of the record
+ * @param[out] end The exclusive end of the record
+ * @throws overflow_error
+ */
+template <uint32_t N>
+void Lookup64<N>::get_record(uint32_t index, uint64_t* start, uint64_t* end) const {
+	if (index >= _size) {
+		throw overflow_error("record index our of range");
+	}
+	*start = _index[index];
+	*end = _values[index];
+}
+
 // Explicit template Instantiation
 template class Lookup<1>;
 template class Lookup<4>;
@@ -394,3 +801,17 @@ template class LookupCPU<16>;
 template class LookupCPU<32>;
 template class LookupCPU<64>;
 template class LookupCPU<128>;
+template class LookupInline<1>;
+template class LookupInline<4>;
+template class LookupInline<8>;
+template class LookupInline<16>;
+template class LookupInline<32>;
+template class LookupInline<64>;
+template class LookupInline<128>;
+template class Lookup64<1>;
+template class Lookup64<4>;
+template class Lookup64<8>;
+template class Lookup64<16>;
+template class Lookup64<32>;
+template class Lookup64<64>;
+template class Lookup64<128>;
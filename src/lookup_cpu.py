@@ -62,6 +62,7 @@ class LookupCpu:
         self.threshold_bucket_coverage = 0.5
         self.retraining_multiplier = 3
         self.retraining_times = 3
+        self.native_training = True
 
         # Private objects
         self.model = None
@@ -149,8 +150,12 @@ class LookupCpu:
 
                 _log(self.verbose, '** Starting stage training iteration %d (out of %d max) **\n' % (t, self.retraining_times))
 
-                buckets = self.model.generate_buckets(i, submodels_to_train, current_samples_per_bucket, verbose=self.verbose)
-                self.model.train_stage(i, self.submodel_structure, buckets, submodels_to_train, None, self.epochs[i], self.batch_size, verbose=self.verbose)
+                if self.native_training:
+                    self.model.train_stage_native(i, self.submodel_structure, submodels_to_train, current_samples_per_bucket,
+                                                  self.epochs[i], self.batch_size, verbose=self.verbose)
+                else:
+                    buckets = self.model.generate_buckets(i, submodels_to_train, current_samples_per_bucket, verbose=self.verbose)
+                    self.model.train_stage(i, self.submodel_structure, buckets, submodels_to_train, None, self.epochs[i], self.batch_size, verbose=self.verbose)
                 self.model.calculate_transition_set(i, verbose=self.verbose)
 
                 # Measure error for refinement
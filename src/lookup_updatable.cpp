@@ -0,0 +1,545 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include <lookup_updatable.h>
+#include <simd_aux.h>
+#include <logging.h>
+
+/**
+ * @brief Returns the number of elements in a sorted array that are lower or equal to a key.
+ *        Binary-searches the block of up to 8 elements that holds the boundary,
+ *        then compares the block with SIMD.
+ */
+static inline uint32_t count_lower_equal(const std::vector<scalar_t>& array, scalar_t key) {
+	const scalar_t* data = array.data();
+	uint32_t first = 0, size = array.size();
+	if (size == 0) return 0;
+
+	// Elements before first are lower or equal to the key, elements from first+size are greater
+	while (size > 8) {
+		uint32_t half = size / 2;
+		if (data[first+half] <= key) {
+			first += half;
+			size -= half;
+		} else {
+			size = half;
+		}
+	}
+
+#ifdef __AVX2__
+	__m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(size), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 block = _mm256_maskload_ps(&data[first], mask);
+	__m256 cmp = _mm256_cmp_ps(block, _mm256_set1_ps(key), _CMP_LE_OQ);
+	cmp = _mm256_and_ps(cmp, _mm256_castsi256_ps(mask));
+	return first + __builtin_popcount(_mm256_movemask_ps(cmp));
+#else
+	uint32_t count = first;
+	for (uint32_t i=0; i<size; ++i) {
+		count += (data[first+i] <= key);
+	}
+	return count;
+#endif
+}
+
+template <uint32_t N>
+LookupUpdatable<N>::base_t::~base_t() {
+	// The lookup refers to the model
+	lookup.reset();
+	if (model != nullptr) {
+		rqrmi_free_model(model);
+	}
+}
+
+template <uint32_t N>
+LookupUpdatable<N>::LookupUpdatable(uint32_t merge_threshold)
+	: _snapshot(nullptr), _epoch(0), _stop(false),
+	  _merge_threshold(merge_threshold), _next_merge_size(merge_threshold), _num_of_merges(0), _epochs(20)
+{
+	_readers[0] = 0;
+	_readers[1] = 0;
+	rqrmi_trainer_default_params(&_params);
+	// Do not compete with lookups on all cores
+	_params.num_of_threads = 1;
+}
+
+template <uint32_t N>
+LookupUpdatable<N>::~LookupUpdatable() {
+	{
+		std::lock_guard<std::mutex> lock(_update_lock);
+		_stop = true;
+	}
+	_merge_signal.notify_one();
+	if (_merger.joinable()) {
+		_merger.join();
+	}
+	for (snapshot_t* snapshot : _retired) {
+		delete snapshot;
+	}
+	delete _snapshot.load();
+}
+
+/**
+ * @brief Returns the current snapshot, which is valid until read_unlock
+ * @param[out] parity The epoch parity to pass to read_unlock
+ */
+template <uint32_t N>
+const typename LookupUpdatable<N>::snapshot_t* LookupUpdatable<N>::read_lock(uint32_t& parity) const {
+	parity = _epoch.load() & 1;
+	_readers[parity].fetch_add(1);
+	return _snapshot.load();
+}
+
+/**
+ * @brief Releases a snapshot acquired by read_lock
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::read_unlock(uint32_t parity) const {
+	_readers[parity].fetch_sub(1);
+}
+
+/**
+ * @brief Swaps the current snapshot, retires the previous one
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::publish(snapshot_t* snapshot) {
+	snapshot_t* previous = _snapshot.exchange(snapshot);
+	if (previous != nullptr) {
+		_retired.push_back(previous);
+		_merge_signal.notify_one();
+	}
+}
+
+/**
+ * @brief Waits until all readers of snapshots that were swapped out before the call are done
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::synchronize() const {
+	// Readers that read the epoch before a flip may still register on the old parity,
+	// so the grace period flips twice and waits for the old parity each time
+	for (uint32_t i=0; i<2; ++i) {
+		uint32_t parity = _epoch.fetch_add(1) & 1;
+		while (_readers[parity].load() > 0) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+/**
+ * @brief Creates a base from a packed model and a database (two columns)
+ * @throws invalid_argument, domain_error
+ */
+template <uint32_t N>
+typename LookupUpdatable<N>::base_t* LookupUpdatable<N>::create_base(const void* packed_model, uint32_t size, matrix_t* database) {
+	std::unique_ptr<base_t> base(new base_t());
+	base->packed_model.assign((const unsigned char*)packed_model, (const unsigned char*)packed_model + size);
+	base->model = rqrmi_load_model(base->packed_model.data(), size);
+	if (base->model == RQRMI_MODEL_ERROR) {
+		base->model = nullptr;
+		throw invalid_argument("invalid RQRMI model");
+	}
+	base->lookup.reset(new LookupInline<N>());
+	base->lookup->load(base->model, database);
+	return base.release();
+}
+
+/**
+ * @brief Loads the RQRMI model and database from memory, starts the background merge thread
+ * @param object An object reader that contains the model, as read by Lookup::load
+ * @throws invalid_argument, domain_error
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::load(ObjectReader object) {
+
+	// Read both database and model
+	ObjectReader model_handler = object.extract();
+	ObjectReader database_handler = object.extract();
+
+	matrix_t* database = load_matrix(database_handler.buffer(), database_handler.size());
+	if (database == MATRIX_ERROR) {
+		throw invalid_argument("data matrix invalid");
+	}
+
+	// Create the initial snapshot
+	snapshot_t* snapshot = new snapshot_t();
+	snapshot->base.reset(create_base(model_handler.buffer(), model_handler.size(), database));
+	free_matrix(database);
+
+	std::lock_guard<std::mutex> lock(_update_lock);
+	publish(snapshot);
+	if (!_merger.joinable()) {
+		_merger = std::thread(&LookupUpdatable<N>::merge_loop, this);
+	}
+}
+
+/**
+ * @brief Sets the parameters for retraining submodels on merges
+ * @param params The hyper parameters
+ * @param epochs The number of epochs per retrained submodel
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::set_training_params(const rqrmi_trainer_params_t& params, uint32_t epochs) {
+	std::lock_guard<std::mutex> lock(_update_lock);
+	_params = params;
+	_epochs = epochs;
+}
+
+/**
+ * @brief Searches a base for a record that starts exactly at a key
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::find_base(const base_t& base, scalar_t start, scalar_t* end) {
+	typename Lookup<N>::range_t range = base.lookup->range_search(start, start);
+	if (range.count == 0) return false;
+	scalar_pair_t record = base.lookup->get_record(range.first);
+	*end = record.second;
+	return record.first == start;
+}
+
+/**
+ * @brief Searches a delta for an inserted record that starts exactly at a key
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::find_insert(const delta_t& delta, scalar_t start, scalar_t* end) {
+	const inserts_t& inserts = *delta.inserts;
+	uint32_t pos = count_lower_equal(inserts.starts, start);
+	if (pos == 0 || inserts.starts[pos-1] != start) return false;
+	*end = inserts.ends[pos-1];
+	return true;
+}
+
+/**
+ * @brief Returns true iff a base record that starts at a key is deleted in a delta
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::is_deleted(const delta_t& delta, scalar_t start) {
+	uint32_t pos = count_lower_equal(*delta.deleted, start);
+	return (pos > 0) && ((*delta.deleted)[pos-1] == start);
+}
+
+/**
+ * @brief Returns true iff the range [start, end) overlaps a live record of a snapshot
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::overlaps(const snapshot_t& snapshot, scalar_t start, scalar_t end) {
+	const delta_t& delta = snapshot.delta;
+	const inserts_t& inserts = *delta.inserts;
+
+	// Inserted records do not overlap, so only the last one that starts before the end may overlap
+	uint32_t pos = count_lower_equal(inserts.starts, nextafterf(end, -INFINITY));
+	if (pos > 0 && inserts.ends[pos-1] > start) return true;
+
+	const LookupInline<N>& lookup = *snapshot.base->lookup;
+	typename Lookup<N>::range_t range = lookup.range_search(start, nextafterf(end, -INFINITY));
+	for (uint32_t i=range.first; i<range.first+range.count; ++i) {
+		if (!is_deleted(delta, lookup.get_record(i).first)) return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Inserts a record
+ * @param start The record start (inclusive)
+ * @param end The record end (exclusive)
+ * @returns false in case the record is empty or overlaps an existing record
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::insert(scalar_t start, scalar_t end) {
+	if (!(start < end)) return false;
+
+	std::lock_guard<std::mutex> lock(_update_lock);
+	const snapshot_t* current = _snapshot.load();
+	if (current == nullptr) {
+		throw runtime_error("lookup is not loaded");
+	}
+	if (overlaps(*current, start, end)) return false;
+
+	// Only the inserted records are copied, the base and the deleted records are shared
+	inserts_t* inserts = new inserts_t(*current->delta.inserts);
+	uint32_t pos = count_lower_equal(inserts->starts, start);
+	inserts->starts.insert(inserts->starts.begin() + pos, start);
+	inserts->ends.insert(inserts->ends.begin() + pos, end);
+
+	snapshot_t* next = new snapshot_t(*current);
+	next->delta.inserts.reset(inserts);
+	// Wakes the background thread, which also merges the delta once it is large enough
+	publish(next);
+	return true;
+}
+
+/**
+ * @brief Deletes a record
+ * @param start The start of the record
+ * @returns false in case no record starts at the value
+ */
+template <uint32_t N>
+bool LookupUpdatable<N>::remove(scalar_t start) {
+	std::lock_guard<std::mutex> lock(_update_lock);
+	const snapshot_t* current = _snapshot.load();
+	if (current == nullptr) {
+		throw runtime_error("lookup is not loaded");
+	}
+
+	scalar_t end;
+	snapshot_t* next;
+
+	if (find_insert(current->delta, start, &end)) {
+		// An inserted record, hides no live base record
+		inserts_t* inserts = new inserts_t(*current->delta.inserts);
+		uint32_t pos = count_lower_equal(inserts->starts, start);
+		inserts->starts.erase(inserts->starts.begin() + pos-1);
+		inserts->ends.erase(inserts->ends.begin() + pos-1);
+		next = new snapshot_t(*current);
+		next->delta.inserts.reset(inserts);
+	} else if (!is_deleted(current->delta, start) && find_base(*current->base, start, &end)) {
+		std::vector<scalar_t>* deleted = new std::vector<scalar_t>(*current->delta.deleted);
+		uint32_t pos = count_lower_equal(*deleted, start);
+		deleted->insert(deleted->begin() + pos, start);
+		next = new snapshot_t(*current);
+		next->delta.deleted.reset(deleted);
+	} else {
+		return false;
+	}
+	// Wakes the background thread, which also merges the delta once it is large enough
+	publish(next);
+	return true;
+}
+
+/**
+ * @brief Perform lookup on a batch, writes the results to a buffer
+ * @param input N keys to search
+ * @param[out] output N results, in the order of the keys
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::search(const scalar_t* input, result_t* output) const {
+	typename Lookup<N>::result_t results[N];
+	uint32_t parity;
+	const snapshot_t* snapshot = read_lock(parity);
+	const delta_t& delta = snapshot->delta;
+	const inserts_t& inserts = *delta.inserts;
+	const LookupInline<N>& lookup = *snapshot->base->lookup;
+
+	// The RQRMI path
+	lookup.search(input, results);
+
+	// Inserted records take precedence, deleted records hide base results
+	for (uint32_t i=0; i<N; ++i) {
+		scalar_t key = input[i];
+		uint32_t pos = count_lower_equal(inserts.starts, key);
+		if (pos > 0 && key < inserts.ends[pos-1]) {
+			output[i] = (result_t){ key, inserts.starts[pos-1], inserts.ends[pos-1], 1 };
+			continue;
+		}
+		if (results[i].found) {
+			scalar_pair_t record = lookup.get_record(results[i].index);
+			if (!is_deleted(delta, record.first)) {
+				output[i] = (result_t){ key, record.first, record.second, 1 };
+				continue;
+			}
+		}
+		output[i] = (result_t){ key, 0, 0, 0 };
+	}
+
+	read_unlock(parity);
+}
+
+/**
+ * @brief Returns the number of pending updates (inserted and deleted records)
+ */
+template <uint32_t N>
+uint32_t LookupUpdatable<N>::get_delta_size() const {
+	uint32_t parity;
+	const snapshot_t* snapshot = read_lock(parity);
+	uint32_t size = snapshot->delta.size();
+	read_unlock(parity);
+	return size;
+}
+
+/**
+ * @brief Builds a new base of a base with a delta, retrains its affected submodels
+ * @returns The new base, or nullptr in case of error
+ */
+template <uint32_t N>
+typename LookupUpdatable<N>::base_t* LookupUpdatable<N>::merge(const base_t& base, const delta_t& delta) const {
+
+	// Merge the live base records with the inserted records
+	const LookupInline<N>& lookup = *base.lookup;
+	const inserts_t& inserts = *delta.inserts;
+	uint32_t old_size = lookup.get_size();
+	std::vector<scalar_pair_t> records;
+	records.reserve(old_size + inserts.starts.size());
+	uint32_t next_insert = 0;
+	for (uint32_t i=0; i<old_size; ++i) {
+		scalar_pair_t record = lookup.get_record(i);
+		while (next_insert < inserts.starts.size() && inserts.starts[next_insert] < record.first) {
+			records.push_back((scalar_pair_t){ inserts.starts[next_insert], inserts.ends[next_insert] });
+			++next_insert;
+		}
+		if (!is_deleted(delta, record.first)) {
+			records.push_back(record);
+		}
+	}
+	for (; next_insert < inserts.starts.size(); ++next_insert) {
+		records.push_back((scalar_pair_t){ inserts.starts[next_insert], inserts.ends[next_insert] });
+	}
+	if (records.empty()) {
+		warning("cannot merge a delta that deletes all records");
+		return nullptr;
+	}
+
+	matrix_t* old_records = new_matrix(old_size, 1);
+	matrix_t* new_records = new_matrix(records.size(), 1);
+	matrix_t* database = new_matrix(records.size(), 2);
+	for (uint32_t i=0; i<old_size; ++i) {
+		GET_SCALAR(old_records, i, 0) = lookup.get_record(i).first;
+	}
+	for (uint32_t i=0; i<records.size(); ++i) {
+		GET_SCALAR(new_records, i, 0) = records[i].first;
+		GET_SCALAR(database, i, 0) = records[i].first;
+		GET_SCALAR(database, i, 1) = records[i].second;
+	}
+
+	// Retrain the submodels whose responsibility changed
+	uint32_t size, num_of_retrained = 0;
+	void* packed_model = rqrmi_trainer_retrain_model((void*)base.packed_model.data(), base.packed_model.size(),
+			old_records, new_records, _epochs, &_params, &size, &num_of_retrained);
+	free_matrix(old_records);
+	free_matrix(new_records);
+
+	base_t* output = nullptr;
+	if (packed_model != RQRMI_TRAINER_ERROR) {
+		info("merged " << inserts.starts.size() << " inserted and " << delta.deleted->size()
+				<< " deleted records, retrained " << num_of_retrained << " submodels");
+		try {
+			output = create_base(packed_model, size, database);
+		} catch (const exception& e) {
+			warning("cannot load merged database: " << e.what());
+			output = nullptr;
+		}
+		free(packed_model);
+	}
+	free_matrix(database);
+	return output;
+}
+
+/**
+ * @brief The background thread. Frees retired snapshots and merges the delta.
+ */
+template <uint32_t N>
+void LookupUpdatable<N>::merge_loop() {
+	std::unique_lock<std::mutex> lock(_update_lock);
+	while (true) {
+		_merge_signal.wait(lock, [this]() {
+			return _stop || !_retired.empty() || (_snapshot.load()->delta.size() >= _next_merge_size);
+		});
+		if (_stop) break;
+
+		// Free the retired snapshots without blocking updates
+		if (!_retired.empty()) {
+			std::vector<snapshot_t*> retired;
+			retired.swap(_retired);
+			lock.unlock();
+			synchronize();
+			for (snapshot_t* snapshot : retired) {
+				delete snapshot;
+			}
+			lock.lock();
+			if (_stop || _snapshot.load()->delta.size() < _next_merge_size) continue;
+		}
+
+		// Build the new base without blocking updates
+		std::shared_ptr<base_t> old_base = _snapshot.load()->base;
+		delta_t merged = _snapshot.load()->delta;
+		lock.unlock();
+		base_t* new_base = merge(*old_base, merged);
+		lock.lock();
+
+		const delta_t& current = _snapshot.load()->delta;
+		if (new_base == nullptr) {
+			// Retry once the delta doubles
+			_next_merge_size = MAX(_merge_threshold, 2 * current.size());
+			warning("merge failed, next merge at " << _next_merge_size << " updates");
+			continue;
+		}
+
+		// Updates during the merge are kept as the delta of the new base.
+		// Only starts that were updated in either delta can differ between the new base and the current state
+		std::vector<scalar_t> candidates;
+		const std::vector<scalar_t>* lists[] = {
+				&merged.inserts->starts, merged.deleted.get(), &current.inserts->starts, current.deleted.get() };
+		for (const std::vector<scalar_t>* list : lists) {
+			candidates.insert(candidates.end(), list->begin(), list->end());
+		}
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+		inserts_t* inserts = new inserts_t();
+		std::vector<scalar_t>* deleted = new std::vector<scalar_t>();
+		for (scalar_t start : candidates) {
+			scalar_t base_end = 0, merged_end = 0, current_end = 0;
+			bool in_base = find_base(*old_base, start, &base_end);
+
+			// The record that starts at the value in the new base, and in the current state
+			bool in_merged = find_insert(merged, start, &merged_end);
+			if (!in_merged && in_base && !is_deleted(merged, start)) {
+				in_merged = true;
+				merged_end = base_end;
+			}
+			bool in_current = find_insert(current, start, &current_end);
+			if (!in_current && in_base && !is_deleted(current, start)) {
+				in_current = true;
+				current_end = base_end;
+			}
+
+			if (in_merged == in_current && (!in_merged || merged_end == current_end)) continue;
+			if (in_merged) {
+				deleted->push_back(start);
+			}
+			if (in_current) {
+				inserts->starts.push_back(start);
+				inserts->ends.push_back(current_end);
+			}
+		}
+
+		snapshot_t* next = new snapshot_t();
+		next->base.reset(new_base);
+		next->delta.inserts.reset(inserts);
+		next->delta.deleted.reset(deleted);
+		publish(next);
+		_next_merge_size = _merge_threshold;
+		_num_of_merges++;
+	}
+}
+
+// Explicit template Instantiation
+template class LookupUpdatable<1>;
+template class LookupUpdatable<4>;
+template class LookupUpdatable<8>;
+template class LookupUpdatable<16>;
+template class LookupUpdatable<32>;
+template class LookupUpdatable<64>;
+template class LookupUpdatable<128>;
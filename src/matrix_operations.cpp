@@ -23,6 +23,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <x86intrin.h>
 
 #include <matrix_operations.h>
 #include <logging.h>
@@ -48,6 +51,153 @@
 #  define matrix_info(...)
 #endif
 
+// Cache blocking of mat_mul: rows of A, shared dimension, and columns of B per block.
+// A block of B (MAT_BLOCK_K x MAT_BLOCK_COLS) fits in L1.
+#define MAT_BLOCK_ROWS 32
+#define MAT_BLOCK_K 64
+#define MAT_BLOCK_COLS 128
+
+// The kernels reproduce the rounding of the naive loops: the accumulation order of each element
+// is kept, and with FMA the compiler fuses the accumulation of mat_mul, and nothing else.
+// Contraction is disabled here, and the fused operations are explicit.
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+
+#ifdef __FMA__
+#  define MAT_MUL_ADD(a, b, c) fmaf(a, b, c)
+#  define MAT_MUL_ADD256(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#  define MAT_MUL_ADD(a, b, c) ((a)*(b)+(c))
+#  define MAT_MUL_ADD256(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+/**
+ * @brief Element-wise kernels of the built-in operations
+ */
+enum builtin_op_t { BUILTIN_NONE, BUILTIN_ADD, BUILTIN_SUB, BUILTIN_MUL, BUILTIN_DIV, BUILTIN_RELU };
+
+/**
+ * @brief Returns the kernel of a built-in operation, BUILTIN_NONE for custom operations
+ */
+static builtin_op_t get_binary_builtin(binary_operation_t op) {
+	if (op == op_add) return BUILTIN_ADD;
+	if (op == op_sub) return BUILTIN_SUB;
+	if (op == op_mul) return BUILTIN_MUL;
+	if (op == op_div) return BUILTIN_DIV;
+	return BUILTIN_NONE;
+}
+
+/**
+ * @brief Applies a built-in binary operation on arrays (b is broadcast when b_stride is 0)
+ */
+static void builtin_binary(builtin_op_t op, const scalar_t* a, const scalar_t* b, uint32_t b_stride,
+		scalar_t* result, uint32_t size)
+{
+	uint32_t i=0;
+#ifdef __AVX__
+	for (; i+8<=size; i+=8) {
+		__m256 va = _mm256_loadu_ps(a+i);
+		__m256 vb = b_stride ? _mm256_loadu_ps(b+i) : _mm256_set1_ps(*b);
+		__m256 vr;
+		switch (op) {
+		case BUILTIN_ADD: vr = _mm256_add_ps(va, vb); break;
+		case BUILTIN_SUB: vr = _mm256_sub_ps(va, vb); break;
+		case BUILTIN_MUL: vr = _mm256_mul_ps(va, vb); break;
+		default: vr = _mm256_div_ps(va, vb); break;
+		}
+		_mm256_storeu_ps(result+i, vr);
+	}
+#endif
+	for (; i<size; ++i) {
+		scalar_t vb = b[i*b_stride];
+		switch (op) {
+		case BUILTIN_ADD: result[i] = a[i] + vb; break;
+		case BUILTIN_SUB: result[i] = a[i] - vb; break;
+		case BUILTIN_MUL: result[i] = a[i] * vb; break;
+		default: result[i] = a[i] / vb; break;
+		}
+	}
+}
+
+/**
+ * @brief Applies ReLU on an array (same as op_relu: NaN and negative zero become zero)
+ */
+static void builtin_relu(const scalar_t* a, scalar_t* result, uint32_t size) {
+	uint32_t i=0;
+#ifdef __AVX__
+	__m256 zero = _mm256_setzero_ps();
+	for (; i+8<=size; i+=8) {
+		// Returns the second operand in case the first is not greater
+		_mm256_storeu_ps(result+i, _mm256_max_ps(_mm256_loadu_ps(a+i), zero));
+	}
+#endif
+	for (; i<size; ++i) {
+		result[i] = a[i] > 0 ? a[i] : 0;
+	}
+}
+
+/**
+ * @brief Cache blocked GEMM, result = A x B. Each element accumulates in the order of the shared dimension.
+ */
+static void blocked_gemm(const scalar_t* a, const scalar_t* b, scalar_t* result,
+		uint32_t rows, uint32_t shared, uint32_t cols)
+{
+	// Small matrices (as in RQRMI submodels) fit in cache, accumulate in registers
+	if (shared <= MAT_BLOCK_K && cols <= MAT_BLOCK_COLS) {
+		for (uint32_t row=0; row<rows; ++row) {
+			const scalar_t* a_row = a + row * shared;
+			scalar_t* c_row = result + row * cols;
+			uint32_t col=0;
+#ifdef __AVX__
+			for (; col+8<=cols; col+=8) {
+				__m256 acc = _mm256_setzero_ps();
+				for (uint32_t k=0; k<shared; ++k) {
+					acc = MAT_MUL_ADD256(_mm256_set1_ps(a_row[k]), _mm256_loadu_ps(b + k * cols + col), acc);
+				}
+				_mm256_storeu_ps(c_row+col, acc);
+			}
+#endif
+			for (; col<cols; ++col) {
+				scalar_t acc = 0;
+				for (uint32_t k=0; k<shared; ++k) {
+					acc = MAT_MUL_ADD(a_row[k], b[k * cols + col], acc);
+				}
+				c_row[col] = acc;
+			}
+		}
+		return;
+	}
+
+	memset(result, 0, sizeof(scalar_t) * rows * cols);
+	for (uint32_t row_block=0; row_block<rows; row_block+=MAT_BLOCK_ROWS) {
+		uint32_t row_end = MIN(row_block+MAT_BLOCK_ROWS, rows);
+		for (uint32_t k_block=0; k_block<shared; k_block+=MAT_BLOCK_K) {
+			uint32_t k_end = MIN(k_block+MAT_BLOCK_K, shared);
+			for (uint32_t col_block=0; col_block<cols; col_block+=MAT_BLOCK_COLS) {
+				uint32_t col_end = MIN(col_block+MAT_BLOCK_COLS, cols);
+				for (uint32_t row=row_block; row<row_end; ++row) {
+					scalar_t* c_row = result + row * cols;
+					for (uint32_t k=k_block; k<k_end; ++k) {
+						scalar_t a_value = a[row * shared + k];
+						const scalar_t* b_row = b + k * cols;
+						uint32_t col=col_block;
+#ifdef __AVX__
+						__m256 va = _mm256_set1_ps(a_value);
+						for (; col+8<=col_end; col+=8) {
+							_mm256_storeu_ps(c_row+col,
+									MAT_MUL_ADD256(va, _mm256_loadu_ps(b_row+col), _mm256_loadu_ps(c_row+col)));
+						}
+#endif
+						for (; col<col_end; ++col) {
+							c_row[col] = MAT_MUL_ADD(a_value, b_row[col], c_row[col]);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
 /**
  * @brief Creates new matrix
  * @param rows Number of rows
@@ -131,14 +281,37 @@ void mat_mul(matrix_t* mat_a, matrix_t* mat_b, matrix_t* result) {
 	// Set the result size
 	result->rows = mat_a->rows;
 	result->cols = mat_b->cols;
-	// Set the result elements
-	for (uint32_t row=0; row<mat_a->rows; ++row) {
-		for (uint32_t col=0; col<mat_b->cols; ++col) {
-			scalar_t element = 0;
-			for (uint32_t i=0; i<mat_a->cols; ++i) {
-				element += (*(scalar_t*)get_element(mat_a, row, i)) * (*(scalar_t*)get_element(mat_b, i, col));
+	blocked_gemm((scalar_t*)mat_a->elements, (scalar_t*)mat_b->elements, (scalar_t*)result->elements,
+			mat_a->rows, mat_a->cols, mat_b->cols);
+}
+
+/**
+ * @brief Performs matrix multiplication, adds bias and activation, without checks and memory allocations
+ * @param mat_a  Left hand side matrix
+ * @param mat_b  Right hand side matrix
+ * @param bias   Bias matrix, either with the size of the result or a single row (broadcast to all rows)
+ * @param op     Activation to perform element-wise, OPERATION_BYPASS for none
+ * @param result Preallocated matrix with enough space to store results, must not be one of the inputs
+ * @note  This method is unsafe, make sure to allocate enough space to result
+ * @note  The result is identical to mat_mul, mat_op with op_add, and mat_unary_op
+ */
+void mat_mul_bias_op(matrix_t* mat_a, matrix_t* mat_b, matrix_t* bias, unary_operation_t op, matrix_t* result) {
+	mat_mul(mat_a, mat_b, result);
+
+	uint32_t cols = result->cols;
+	scalar_t* elements = (scalar_t*)result->elements;
+	for (uint32_t row=0; row<result->rows; ++row) {
+		scalar_t* current = elements + row * cols;
+		const scalar_t* bias_row = (scalar_t*)bias->elements + (bias->rows == 1 ? 0 : row * cols);
+		builtin_binary(BUILTIN_ADD, current, bias_row, 1, current, cols);
+		if (op == OPERATION_BYPASS) {
+			continue;
+		} else if (op == op_relu) {
+			builtin_relu(current, current, cols);
+		} else {
+			for (uint32_t col=0; col<cols; ++col) {
+				current[col] = op(&current[col]);
 			}
-			*(scalar_t*)get_element(result, row, col) = element;
 		}
 	}
 }
@@ -158,6 +331,13 @@ void mat_op(matrix_t* mat_a, matrix_t* mat_b, binary_operation_t op, matrix_t* r
 	// Set the result size
 	result->rows = mat_a->rows;
 	result->cols = mat_a->cols;
+	// Built-in operations are vectorized
+	builtin_op_t builtin = get_binary_builtin(op);
+	if (builtin != BUILTIN_NONE) {
+		builtin_binary(builtin, (scalar_t*)mat_a->elements, (scalar_t*)mat_b->elements, 1,
+				(scalar_t*)result->elements, mat_a->rows * mat_a->cols);
+		return;
+	}
 	// Set the result elements
 	for (uint32_t row=0; row<mat_a->rows; ++row) {
 		for (uint32_t col=0; col<mat_a->cols; ++col) {
@@ -180,6 +360,13 @@ void mat_scalar_op(matrix_t* mat_a, scalar_t scalar, binary_operation_t op, matr
 	// Set the result size
 	result->rows = mat_a->rows;
 	result->cols = mat_a->cols;
+	// Built-in operations are vectorized
+	builtin_op_t builtin = get_binary_builtin(op);
+	if (builtin != BUILTIN_NONE) {
+		builtin_binary(builtin, (scalar_t*)mat_a->elements, &scalar, 0,
+				(scalar_t*)result->elements, mat_a->rows * mat_a->cols);
+		return;
+	}
 	// Set the result elements
 	for (uint32_t row=0; row<mat_a->rows; ++row) {
 		for (uint32_t col=0; col<mat_a->cols; ++col) {
@@ -203,6 +390,11 @@ void mat_unary_op(matrix_t* mat, unary_operation_t op, matrix_t* result) {
 	// Set the result size
 	result->rows = mat->rows;
 	result->cols = mat->cols;
+	// Built-in operations are vectorized
+	if (op == op_relu) {
+		builtin_relu((scalar_t*)mat->elements, (scalar_t*)result->elements, mat->rows * mat->cols);
+		return;
+	}
 	// Set the result elements
 	for (uint32_t row=0; row<mat->rows; ++row) {
 		for (uint32_t col=0; col<mat->cols; ++col) {
@@ -211,6 +403,8 @@ void mat_unary_op(matrix_t* mat, unary_operation_t op, matrix_t* result) {
 	}
 }
 
+#pragma GCC pop_options
+
 /**
  * @brief Prints the matrix to the destination file
  * @param mat The matrix to print
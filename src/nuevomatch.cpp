@@ -355,6 +355,51 @@ void NuevoMatch<N>::print(uint32_t verbose) const {
 	}
 }
 
+/**
+ * @brief Loads a single iSet out of a packed NuevoMatch classifier
+ * @param reader An object-reader with the binary data of the classifier
+ * @param iset_index The index of the iSet to load
+ * @returns A new iSet, owned by the caller
+ * @throws In case the classifier holds no such iSet
+ */
+template <uint32_t N>
+IntervalSet<N>* NuevoMatch<N>::load_iset(ObjectReader& reader, uint32_t iset_index) {
+
+	// Read static information
+	uint32_t num_of_isets, num_of_rules, size, build_time;
+	reader 	>> num_of_isets >> num_of_rules
+			>> size >> build_time;
+
+	if (iset_index >= num_of_isets) {
+		throw error("Classifier has only " << num_of_isets << " iSets");
+	}
+
+	// Skip all preceding iSets
+	ObjectReader sub_reader;
+	for (uint32_t i=0; i<iset_index; ++i) {
+		reader >> sub_reader;
+	}
+
+	return read_iset(reader, iset_index);
+}
+
+/**
+ * @brief Reads the next stored iSet from file
+ * @param reader An object-reader positioned at the iSet
+ * @param iset_index The index of the iSet
+ */
+template <uint32_t N>
+IntervalSet<N>* NuevoMatch<N>::read_iset(ObjectReader& reader, uint32_t iset_index) {
+
+	// Get the handler of the next stored iSet
+	ObjectReader sub_reader;
+	reader >> sub_reader;
+
+	IntervalSet<N>* iset = new IntervalSet<N>(iset_index);
+	iset->load(sub_reader);
+	return iset;
+}
+
 /**
  * @brief Loads all subsets (iSets/Remainder) from file
  * @param reader An object-reader with binary data
@@ -373,13 +418,8 @@ void NuevoMatch<N>::load_subsets(ObjectReader& reader) {
 	// Populate lists based on configuration
 	for (uint32_t i=0; i<_num_of_isets; ++i) {
 
-		// Get the handler of the next stored iSet
-		ObjectReader sub_reader;
-		reader >> sub_reader;
-
 		// Read the current iSet
-		IntervalSet<N>* iset = new IntervalSet<N>(i);
-		iset->load(sub_reader);
+		IntervalSet<N>* iset = read_iset(reader, i);
 
 		bool skip_current_iset =
 				// Skip the current iSet in case the maximum number of iSets is limited
@@ -29,6 +29,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <time.h>
+#include <vector>
 
 // Include path set by makefile according to python-dev version
 #include <Python.h>
@@ -38,6 +39,7 @@
 #include <object_io.h>
 #include <rqrmi_model.h>
 #include <rqrmi_tools.h>
+#include <rqrmi_trainer.h>
 #include <lookup.h>
 
 // RQRMI Capsules names
@@ -381,24 +383,29 @@ static PyObject* py_evaluate_model(PyObject *self, PyObject *args) {
 	// Catch model evaluation errors
 	try {
 
+		// Gather the input values
+		std::vector<scalar_t> inputs(num_of_packets), outputs(num_of_packets);
+		for (uint32_t i=0; i<num_of_packets; ++i) {
+			inputs[i] = GET_SCALAR(data, i, 0);
+		}
+
 		// Measure inference time
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-		// Perform the evaluation per input value
-		for (uint32_t i=0; i<num_of_packets; ++i) {
-			scalar_t input = GET_SCALAR(data, i, 0);
-			// Evaluate current packet
-			// Note: No AVX used since we don't know what is the submodels' size (RMI, for instance)
-			// The Lookup object, which works with RQRMI only, uses AVX when possible.
-			double out = (double)rqrmi_evaluate_model(rqrmi_model, input);
-			// Set the output element
-			// See: https://docs.python.org/3/c-api/float.html
-			PyList_SetItem(result_list, i, PyFloat_FromDouble(out));
-		}
+		// Evaluate all inputs at once
+		// Note: RQRMI submodels are evaluated with SIMD, other submodels (RMI, for instance)
+		// are evaluated one input at a time
+		rqrmi_evaluate_model_batch(rqrmi_model, inputs.data(), outputs.data(), NULL, num_of_packets);
 
 		// Measure inference time
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
 
+		// Set the output elements
+		// See: https://docs.python.org/3/c-api/float.html
+		for (uint32_t i=0; i<num_of_packets; ++i) {
+			PyList_SetItem(result_list, i, PyFloat_FromDouble((double)outputs[i]));
+		}
+
 	} catch (const std::exception& e) {
 		warning(e.what());
 		PyErr_SetString(PyExc_RuntimeError, SimpleLogger::get().get_buffer());
@@ -463,6 +470,70 @@ static PyObject* py_create_dataset(PyObject *self, PyObject *args) {
 	return capsule;
 }
 
+/**
+ * @brief Python adapter for rqrmi_tools_generate_datasets method
+ * @param An RQRMI Probe Capsule
+ * @param Boolean, randomize datasets
+ * @param Boolean, shuffle datasets
+ * @param Integer, stage index
+ * @param A list of integers, the bucket indices
+ * @param Integer, The number of samples to sample from each generated dataset.
+ * @returns A list of RQRMI Matrix Capsules (scalar_t), the generated datasets
+ * @throws RuntimeError
+ */
+static PyObject* py_create_datasets(PyObject *self, PyObject *args) {
+	PyObject *probe_capsule, *bucket_list;
+	int stage_idx, samples;
+	bool random, shuffle;
+
+	// Parse input according to format
+	if (!PyArg_ParseTuple(args, "OppiOi:create_datasets",
+			&probe_capsule, &random, &shuffle, &stage_idx, &bucket_list, &samples)) {
+		return NULL;
+	}
+
+	// Extract pointers from capsules
+	rqrmi_probing_t* rqrmi_probe = (rqrmi_probing_t*)PyCapsule_GetPointer(probe_capsule, rqrmi_probe_capsule_name);
+
+	// Check that fifth argument is a list
+	if (!PyList_Check(bucket_list)) {
+		PyErr_SetString(PyExc_ValueError, "fifth argument is not a valid list");
+		return NULL;
+	}
+
+	// Read list
+	uint32_t num_of_buckets = PyList_Size(bucket_list);
+	std::vector<uint32_t> bucket_indices(num_of_buckets);
+	for (uint32_t i=0; i<num_of_buckets; ++i) {
+		bucket_indices[i] = PyLong_AsLong(PyList_GetItem(bucket_list, i));
+	}
+	if (PyErr_Occurred()) {
+		return NULL;
+	}
+
+	// Generate without holding the GIL
+	std::vector<matrix_t*> datasets(num_of_buckets);
+	bool success;
+	Py_BEGIN_ALLOW_THREADS
+	success = rqrmi_tools_generate_datasets(rqrmi_probe, stage_idx, bucket_indices.data(), num_of_buckets,
+			samples, random, shuffle, datasets.data());
+	Py_END_ALLOW_THREADS
+
+	if (!success) {
+		PyErr_SetString(PyExc_RuntimeError, SimpleLogger::get().get_buffer());
+		return NULL;
+	}
+
+	// Wrap the results as Python capsules
+	PyObject* output_list = PyList_New(num_of_buckets);
+	for (uint32_t i=0; i<num_of_buckets; ++i) {
+		PyObject* capsule = PyCapsule_New(datasets[i], rqrmi_matrix_capsule_name, py_rqrmi_matrix_capsule_destructor);
+		NEW_CAPSULE(rqrmi_matrix_capsule_name, datasets[i]);
+		PyList_SetItem(output_list, i, capsule);
+	}
+	return output_list;
+}
+
 /**
  * @brief Python adapter for rqrmi_tools_probe_new method
  * @param An RQRMI Matrix Capsule, records
@@ -658,6 +729,103 @@ static PyObject* py_calculate_submodel_error(PyObject *self, PyObject *args) {
 	return output_list;
 }
 
+/**
+ * @brief Python adapter for rqrmi_trainer_train_stage method
+ * @param An RQRMI Probe Capsule
+ * @param Integer, stage index
+ * @param A list of integers, the submodels to train
+ * @param Integer, number of samples per submodel
+ * @param Integer, number of epochs
+ * @param Integer, batch size
+ * @param Float, learning rate
+ * @param Integer, hidden width
+ * @param Integer, number of threads (0 for all available cores)
+ * @returns A list with an item per submodel: None in case the submodel has no inputs,
+ *          otherwise a tuple (mu, sig, fac, omin, [b0, b1, w1, b2, w2]) with lists of scalars
+ * @throws RuntimeError
+ */
+static PyObject* py_train_stage(PyObject *self, PyObject *args) {
+
+	PyObject *probe_capsule, *submodel_list;
+	int stage_idx, samples, epochs, batch_size, hidden_width, threads;
+	float learning_rate;
+
+	// Parse input according to format
+	if (!PyArg_ParseTuple(args, "OiOiiifii:train_stage", &probe_capsule, &stage_idx, &submodel_list,
+			&samples, &epochs, &batch_size, &learning_rate, &hidden_width, &threads)) {
+		return NULL;
+	}
+
+	// Extract pointers from capsules
+	rqrmi_probing_t* rqrmi_probe = (rqrmi_probing_t*)PyCapsule_GetPointer(probe_capsule, rqrmi_probe_capsule_name);
+
+	// Check that third argument is a list
+	if (!PyList_Check(submodel_list)) {
+		PyErr_SetString(PyExc_ValueError, "third argument is not a valid list");
+		return NULL;
+	}
+
+	// Read list
+	uint32_t num_of_submodels = PyList_Size(submodel_list);
+	std::vector<uint32_t> submodel_indices(num_of_submodels);
+	for (uint32_t i=0; i<num_of_submodels; ++i) {
+		submodel_indices[i] = PyLong_AsLong(PyList_GetItem(submodel_list, i));
+	}
+	if (PyErr_Occurred()) {
+		return NULL;
+	}
+
+	rqrmi_trainer_params_t params;
+	rqrmi_trainer_default_params(&params);
+	params.batch_size = batch_size;
+	params.learning_rate = learning_rate;
+	params.hidden_width = hidden_width;
+	params.num_of_threads = threads;
+
+	// Train without holding the GIL
+	std::vector<rqrmi_submodel_info_t> trained(num_of_submodels);
+	bool success = true;
+	Py_BEGIN_ALLOW_THREADS
+	try {
+		rqrmi_trainer_train_stage(rqrmi_probe, stage_idx, submodel_indices.data(), num_of_submodels,
+				samples, epochs, &params, trained.data());
+	} catch (const std::exception& e) {
+		warning(e.what());
+		success = false;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (!success) {
+		PyErr_SetString(PyExc_RuntimeError, SimpleLogger::get().get_buffer());
+		return NULL;
+	}
+
+	// Generate the output list
+	PyObject* output_list = PyList_New(num_of_submodels);
+	for (uint32_t i=0; i<num_of_submodels; ++i) {
+		const rqrmi_submodel_info_t& submodel = trained[i];
+		if (!submodel.compiled) {
+			Py_INCREF(Py_None);
+			PyList_SetItem(output_list, i, Py_None);
+			continue;
+		}
+
+		PyObject* b1 = PyList_New(submodel.hidden_width);
+		PyObject* w1 = PyList_New(submodel.hidden_width);
+		PyObject* w2 = PyList_New(submodel.hidden_width);
+		for (uint32_t k=0; k<submodel.hidden_width; ++k) {
+			PyList_SetItem(b1, k, PyFloat_FromDouble(submodel.b1[k]));
+			PyList_SetItem(w1, k, PyFloat_FromDouble(submodel.w1[k]));
+			PyList_SetItem(w2, k, PyFloat_FromDouble(submodel.w2[k]));
+		}
+		PyObject* values = Py_BuildValue("[dNNdN]", (double)submodel.b0, b1, w1, (double)submodel.b2, w2);
+		PyList_SetItem(output_list, i, Py_BuildValue("(ddddN)", (double)submodel.input_mean,
+				(double)submodel.input_stddev, (double)submodel.output_factor, (double)submodel.output_min, values));
+	}
+
+	return output_list;
+}
+
 /**
  * @brief Converts RQRMI Matrix Capsule to list of lists
  * @param An RQRMI Matrix Capsule
@@ -728,6 +896,19 @@ static PyMethodDef module_methods[] = {
 			"\t An RQRMI matrix object (scalars). Each row is a sample with format [input, expected_output]. \n"
 			"Throws: RuntimeError with relevant message \n"
 	},
+	{"create_datasets", py_create_datasets, METH_VARARGS,
+			"Generates dynamic datasets of multiple buckets in parallel \n"
+			"Args: \n"
+			"\t probe: An RQRMI Probe object \n"
+			"\t random: True in case the datasets' values should be randomized \n"
+			"\t shuffle: True in case the datasets should be shuffled \n"
+			"\t stage_idx: The required stage \n"
+			"\t bucket_indices: A list of the required buckets \n"
+			"\t samples: The number of samples to sample from each generated dataset. \n"
+			"Returns: \n"
+			"\t A list of RQRMI matrix objects (scalars), one per bucket. Each row is a sample with format [input, expected_output]. \n"
+			"Throws: RuntimeError with relevant message \n"
+	},
 	{"create_probe", py_create_probe, METH_VARARGS,
 			"Generates an RQRMI probing data structure. \n"
 			"Args: \n"
@@ -795,6 +976,23 @@ static PyMethodDef module_methods[] = {
 			"\t A list with two values: [maximum error, bucket coverage] \n"
 			"Throws: RuntimeError with relevant message \n"
 	},
+	{"train_stage", py_train_stage, METH_VARARGS,
+			"Trains submodels of a stage natively, in parallel. Each submodel is 1 x hidden_width x 1, trained using Adam \n"
+			"Args: \n"
+			"\t probe: An RQRMI Probe object \n"
+			"\t stage_idx: The required stage \n"
+			"\t submodels: A list of integers, the submodels to train \n"
+			"\t samples: The number of samples per submodel \n"
+			"\t epochs: The number of epochs \n"
+			"\t batch_size: The mini-batch size \n"
+			"\t learning_rate: The learning rate \n"
+			"\t hidden_width: The number of hidden neurons \n"
+			"\t threads: The number of threads (0 for all available cores) \n"
+			"Returns: \n"
+			"\t A list with an item per submodel: None in case the submodel has no inputs, \n"
+			"\t otherwise a tuple (mu, sig, fac, omin, [b0, b1, w1, b2, w2]) \n"
+			"Throws: RuntimeError with relevant message \n"
+	},
 	{"matrix_to_list", py_matrix_to_list, METH_VARARGS,
 			"Converts an RQRMI Matrix object to list of lists \n"
 			"Args: \n"
@@ -21,12 +21,31 @@
  * SOFTWARE.
  */
 
+#include <math.h>
+#include <vector>
+
 #include <rqrmi_fast.h>
 #include <logging.h>
 
 // 0x11111111 float32 representation
 #define BINARY_ONES 1.14437421e-28
 
+// Number of uniformly spread inputs to probe the model with
+#define DEVIATION_PROBES 1024
+
+// The submodel errors hold a margin of two positions for the lookup procedure
+// (see rqrmi_tools_calculate_submodel_error). Rounding of the fast evaluation
+// may consume up to one of them.
+#define LOOKUP_MARGIN 2
+#define ROUNDING_MARGIN 1
+
+// Fast multiple add for 128bit vectors (the FMA macro is set to the widest engine)
+#ifdef __FMA__
+#	define FMA128(a,b,c) a = _mm_fmadd_ps(a, b, c);
+#else
+#	define FMA128(a,b,c) a = _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+
 // Model information is often not required for debugging.
 // Set dedicated debugging flag for models
 #ifdef DEBUG_MODEL
@@ -45,86 +64,413 @@ void print_wide_scalar(wide_scalar_t& x) {
 	fprintf(stderr, "\n");
 }
 
+#if !defined NO_RQRMI_OPT && !defined __AVX512F__
+/**
+ * @brief Sums all elements of a 128bit vector
+ */
+static inline scalar_t reduce_add(__m128 x) {
+	// Reduce output (https://stackoverflow.com/a/13222410/4103200)
+	// x = ( x3, x2, x1, x0 )
+	const __m128 loDual = x;								// ( -, -, x1, x0 )
+	const __m128 hiDual = _mm_movehl_ps(x, x);				// ( -, -, x3, x2 )
+	const __m128 sumDual = _mm_add_ps(loDual, hiDual);		// ( -, -, x1 + x3, x0 + x2 )
+	const __m128 lo = sumDual;								// ( -, -, -, x0 + x2 )
+	const __m128 hi = _mm_shuffle_ps(sumDual, sumDual, 0x1);// ( -, -, -, x1 + x3 )
+	const __m128 sum = _mm_add_ss(lo, hi);					// ( -, -, -, x0 + x1 + x2 + x3 )
+	return _mm_cvtss_f32(sum);
+}
+#endif
+
+#if !defined NO_RQRMI_OPT && !defined __AVX512F__ && defined __AVX__
+/**
+ * @brief Sums all elements of a 256bit vector
+ */
+static inline scalar_t reduce_add(__m256 x) {
+	// x = ( x7, x6, x5, x4, x3, x2, x1, x0 )
+	const __m128 hiQuad = _mm256_extractf128_ps(x, 1); 	// ( x7, x6, x5, x4 )
+	const __m128 loQuad = _mm256_castps256_ps128(x);	// ( x3, x2, x1, x0 )
+	return reduce_add(_mm_add_ps(loQuad, hiQuad));		// ( x3 + x7, x2 + x6, x1 + x5, x0 + x4 )
+}
+#endif
+
+/**
+ * @brief Computes the hidden layer and the output layer of a single submodel
+ * @tparam Width The hidden width of the submodel
+ * @param x The output of layer 0
+ * @param submodel The submodel
+ * @returns The submodel output before post-processing
+ * @note Each element of b2 holds b2/Width, so the bias is added by the reduction
+ */
+template <uint32_t Width, typename T>
+static inline scalar_t hidden_layers(scalar_t x, const T* submodel) {
+#ifdef NO_RQRMI_OPT
+	scalar_t result = 0;
+	for (uint32_t k=0; k<Width; ++k) {
+		scalar_t neuron = x * submodel->w1[k] + submodel->b1[k];
+		if (neuron < 0) neuron = 0; // ReLU
+		result += neuron * submodel->w2[k] + submodel->b2[k];
+	}
+	return result;
+
+#elif __AVX512F__
+	// Used for masked load operations
+	static const __mmask16 mask = (Width >= 16) ? 0xffff : ((1<<Width)-1);
+	static const __m512 zeros = _mm512_setzero_ps();
+
+	// Set current input
+	__m512 reg1 = _mm512_set1_ps(x);
+
+	// Compute layer1 (masked elements are zero)
+	__m512 reg2 = _mm512_maskz_loadu_ps(mask, submodel->w1);
+	__m512 reg3 = _mm512_maskz_loadu_ps(mask, submodel->b1);
+	FMA(reg1, reg2, reg3);
+	reg1 = _mm512_max_ps(reg1, zeros); // ReLU
+
+	// Compute layer2
+	reg2 = _mm512_maskz_loadu_ps(mask, submodel->w2);
+	reg3 = _mm512_maskz_loadu_ps(mask, submodel->b2);
+	FMA(reg1, reg2, reg3);
+
+	return _mm512_reduce_add_ps(reg1);
+
+#elif __AVX__
+	// Narrow submodels fit a single 128bit vector
+	if (Width == 4) {
+		static const __m128 zeros = _mm_setzero_ps();
+		__m128 reg1 = _mm_set1_ps(x);
+		FMA128(reg1, _mm_load_ps(submodel->w1), _mm_load_ps(submodel->b1));
+		reg1 = _mm_max_ps(reg1, zeros); // ReLU
+		FMA128(reg1, _mm_load_ps(submodel->w2), _mm_load_ps(submodel->b2));
+		return reduce_add(reg1);
+	}
+
+	static const __m256 zeros = _mm256_setzero_ps();
+	__m256 sum = zeros;
+
+	// Compute 8 neurons at a time
+	for (uint32_t k=0; k<Width; k+=8) {
+		// Set current input
+		__m256 reg1 = _mm256_set1_ps(x);
+
+		// Load registers
+		__m256 reg2 = _mm256_load_ps(&submodel->w1[k]);
+		__m256 reg3 = _mm256_load_ps(&submodel->b1[k]);
+
+		// Compute layer1
+		FMA(reg1, reg2, reg3);
+		reg1 = _mm256_max_ps(reg1, zeros); // ReLU
+
+		// Load registers
+		reg2 = _mm256_load_ps(&submodel->w2[k]);
+		reg3 = _mm256_load_ps(&submodel->b2[k]);
+
+		// Compute layer2
+		FMA(reg1, reg2, reg3);
+		sum = _mm256_add_ps(sum, reg1);
+	}
+
+	return reduce_add(sum);
+
+#elif __SSE__
+	static const __m128 zeros = _mm_setzero_ps();
+	__m128 sum = zeros;
+
+	// Compute 4 neurons at a time
+	for (uint32_t k=0; k<Width; k+=4) {
+		__m128 reg1 = _mm_set1_ps(x);
+		FMA128(reg1, _mm_load_ps(&submodel->w1[k]), _mm_load_ps(&submodel->b1[k]));
+		reg1 = _mm_max_ps(reg1, zeros); // ReLU
+		FMA128(reg1, _mm_load_ps(&submodel->w2[k]), _mm_load_ps(&submodel->b2[k]));
+		sum = _mm_add_ps(sum, reg1);
+	}
+
+	return reduce_add(sum);
+#endif
+}
+
 /**
  * @brief Create new RQRMIFast instance from RQRMI model
  * @throws std::runtime_error in case the model is not valid RQRMI model
  */
-RQRMIFast::RQRMIFast(rqrmi_model_t *model) {
+RQRMIFast::RQRMIFast(rqrmi_model_t *model) : RQRMIFast() {
+
+	std::vector<rqrmi_submodel_info_t> info;
+	uint32_t hidden_width = load_stages(model, info);
+
+	// Pad the hidden layer to the nearest supported width
+	model_info("Allocating data for " << _total_submodels << " submodels (in total)");
+	if (hidden_width <= 4) {
+		load_submodels<4>(info);
+	} else if (hidden_width <= 8) {
+		load_submodels<8>(info);
+	} else {
+		load_submodels<16>(info);
+	}
+}
+
+/**
+ * @brief Initiates an empty instance, used by derived classes with their own submodel tables
+ */
+RQRMIFast::RQRMIFast() : _num_of_stages(0), _stage_submodels(nullptr), _submodels(nullptr),
+		_total_submodels(0), _hidden_width(0), _submodels_bytes(0) {}
+
+/**
+ * @brief Reads the stage structure and the information of all submodels of a model
+ * @param model The RQRMI model
+ * @param[out] info The information of all submodels, ordered by stage
+ * @returns The maximal hidden width of all submodels
+ * @throws std::runtime_error in case the model is not valid RQRMI model
+ */
+uint32_t RQRMIFast::load_stages(rqrmi_model_t *model, std::vector<rqrmi_submodel_info_t>& info) {
 	_num_of_stages = rqrmi_get_num_of_stages(model);
 
-	if (_num_of_stages > 3) {
-		throw std::runtime_error("input model have more than three stages!");
+	if (_num_of_stages == 0) {
+		throw std::runtime_error("input model has no stages!");
 	}
 
-	model_info("Allocating data for %u stages", _num_of_stages);
+	model_info("Allocating data for " << _num_of_stages << " stages");
 
-	uint32_t total_submodels = 1;
 	_stage_submodels = new uint32_t[_num_of_stages];
+	uint32_t hidden_width = 0;
 
-	// Initiate number of submodels
+	// Get submodel information
 	for (uint32_t s=0; s<_num_of_stages; ++s) {
 		_stage_submodels[s] = rqrmi_get_num_of_submodels(model, s);
-		if (s > 0) {
-			total_submodels += total_submodels*_stage_submodels[s];
+		for (uint32_t m=0; m<_stage_submodels[s]; ++m) {
+			rqrmi_submodel_info_t current;
+			if (!rqrmi_get_submodel_info(model, s, m, &current)) {
+				delete[] _stage_submodels;
+				_stage_submodels = nullptr;
+				throw std::runtime_error("error while extracting information of a submodel");
+			}
+			hidden_width = MAX(hidden_width, current.hidden_width);
+			info.push_back(current);
 		}
 	}
+	_total_submodels = info.size();
+	return hidden_width;
+}
+
+RQRMIFast::~RQRMIFast() {
+	delete[] _stage_submodels;
+	free(_submodels);
+}
+
+/**
+ * @brief Evicts the submodel tables of this from all cache levels.
+ *        Used for measuring cold-cache inference.
+ */
+void RQRMIFast::flush_caches() const {
+	const char* submodels = (const char*)_submodels;
+	for (uint32_t i=0; i<_submodels_bytes; i+=64) {
+		_mm_clflush(&submodels[i]);
+	}
+	for (uint32_t i=0; i<_num_of_stages; i+=16) {
+		_mm_clflush(&_stage_submodels[i]);
+	}
+	_mm_mfence();
+}
+
+/**
+ * @brief Copies the submodels information to the array of this
+ * @tparam Width The hidden width of the array
+ * @param info The information of all submodels, ordered by stage
+ */
+template <uint32_t Width>
+void RQRMIFast::load_submodels(const std::vector<rqrmi_submodel_info_t>& info) {
 
 	// Allocate memory
-	model_info("Allocating data for %u submodels (in total)", total_submodels);
-	_submodles = (fast_submodel_t*)aligned_alloc(64,
-			sizeof(fast_submodel_t) * total_submodels);
+	_hidden_width = Width;
+	_submodels_bytes = sizeof(fast_submodel_t<Width>) * info.size();
+	fast_submodel_t<Width>* submodels = (fast_submodel_t<Width>*)aligned_alloc(64, _submodels_bytes);
+	_submodels = submodels;
+
+	for (uint32_t i=0; i<info.size(); ++i) {
+		// Copy info
+		submodels[i].compiled = info[i].compiled;
+		submodels[i].output_factor = info[i].output_factor;
+		submodels[i].error = info[i].error;
+		submodels[i].output_min = info[i].output_min;
+		// Fold the input normalization into layer 0 (computed in double precision)
+		scalar64_t w0 = info[i].w0, b0 = info[i].b0;
+		scalar64_t mean = info[i].input_mean, stddev = info[i].input_stddev;
+		submodels[i].w0 = w0 / stddev;
+		submodels[i].b0 = b0 - w0 * mean / stddev;
+		for (uint32_t k=0; k<Width; ++k) {
+			submodels[i].b1[k] = info[i].b1[k];
+			submodels[i].w1[k] = info[i].w1[k];
+			submodels[i].b2[k] = info[i].b2 / Width; // Menachem's tip for including this in reduce
+			submodels[i].w2[k] = info[i].w2[k];
+		}
+	}
+}
 
-	// Get submodel information
-	uint32_t counter = 0;
+/**
+ * @brief Creates the best RQRMIFast instance for the shape of the model.
+ *        Falls back to the generic path when no specialization is available.
+ * @throws std::runtime_error in case the model is not valid RQRMI model
+ * @note The instance should be deleted by the user
+ */
+RQRMIFast* RQRMIFast::create(rqrmi_model_t *model) {
+
+	// Get the shape of the model without constructing it
+	uint32_t stages = rqrmi_get_num_of_stages(model);
+	uint32_t hidden_width = 0;
+	for (uint32_t s=0; s<stages; ++s) {
+		for (uint32_t m=0; m<rqrmi_get_num_of_submodels(model, s); ++m) {
+			rqrmi_submodel_info_t current;
+			if (!rqrmi_get_submodel_info(model, s, m, &current)) {
+				// The generic constructor reports invalid models
+				return new RQRMIFast(model);
+			}
+			hidden_width = MAX(hidden_width, current.hidden_width);
+		}
+	}
+
+	// Pad the hidden layer to the nearest supported width (as in the constructor)
+	uint32_t width = (hidden_width <= 4) ? 4 : (hidden_width <= 8) ? 8 : 16;
+
+#	define SPECIALIZE(S, W) 									\
+	if (stages == S && width == W) {							\
+		return new RQRMIFastT<S, W>(model);						\
+	}
+
+	// Common shapes, e.g. [1,4,128] and [1,8,256] with 8 hidden neurons
+	SPECIALIZE(1, 4);  SPECIALIZE(1, 8);  SPECIALIZE(1, 16);
+	SPECIALIZE(2, 4);  SPECIALIZE(2, 8);  SPECIALIZE(2, 16);
+	SPECIALIZE(3, 4);  SPECIALIZE(3, 8);  SPECIALIZE(3, 16);
+	SPECIALIZE(4, 4);  SPECIALIZE(4, 8);  SPECIALIZE(4, 16);
+
+#	undef SPECIALIZE
+
+	info("No RQRMIFast specialization for " << stages << " stages with hidden width "
+			<< width << ", using generic path");
+	return new RQRMIFast(model);
+}
+
+/**
+ * @brief Generates inputs for probing the model: uniformly spread inputs over the
+ *        input domain, and the trigger inputs of all submodels with their neighbours.
+ * @param model The RQRMI model this was created from
+ */
+std::vector<scalar_t> RQRMIFast::generate_probes(rqrmi_model_t *model) const {
+
+	std::vector<scalar_t> probes;
+	scalar_pair_t input_domain = rqrmi_get_input_domain(model);
+
+	// Uniformly spread inputs over the input domain
+	scalar64_t step = ((scalar64_t)input_domain.second - input_domain.first) / DEVIATION_PROBES;
+	for (uint32_t i=0; i<=DEVIATION_PROBES; ++i) {
+		probes.push_back(input_domain.first + step*i);
+	}
+
+	// Trigger inputs of all compiled submodels
 	for (uint32_t s=0; s<_num_of_stages; ++s) {
 		for (uint32_t m=0; m<_stage_submodels[s]; ++m) {
-			rqrmi_submodel_info_t info;
-			if (!rqrmi_get_submodel_info(model, s, m, &info)) {
-				throw std::runtime_error("error while extracting information of a submodel");
-			}
-			// Copy info
-			_submodles[counter].compiled = info.compiled;
-			_submodles[counter].b0 = info.b0;
-			_submodles[counter].w0 = info.w0;
-			_submodles[counter].output_factor = info.output_factor;
-			_submodles[counter].error = info.error;
-			_submodles[counter].output_min = info.output_min;
-			_submodles[counter].input_mean = info.input_mean;
-			_submodles[counter].input_stddev = info.input_stddev;
-			for (uint32_t i=0; i<8; ++i) {
-				_submodles[counter].b1.scalars[i] = info.b1[i];
-				_submodles[counter].w1.scalars[i] = info.w1[i];
-				_submodles[counter].b2.scalars[i] = info.b2 / input_width(); // Menachem's tip for including this in reduce
-				_submodles[counter].w2.scalars[i] = info.w2[i];
+			if (!rqrmi_submodel_compiled(model, s, m)) continue;
+			matrix_t* trigger_inputs = rqrmi_calculate_trigger_inputs(model, s, m);
+			if (trigger_inputs == MATRIX_ERROR) continue;
+			for (uint32_t i=0; i<trigger_inputs->rows; ++i) {
+				scalar_t x = GET_SCALAR(trigger_inputs, i, 0);
+				if (isnan(x)) continue;
+				probes.push_back(SCALAR_PREV(x));
+				probes.push_back(x);
+				probes.push_back(SCALAR_NEXT(x));
 			}
-			++counter;
+			free_matrix(trigger_inputs);
 		}
 	}
+
+	return probes;
 }
 
-RQRMIFast::~RQRMIFast() {
-	delete[] _stage_submodels;
-	free(_submodles);
+/**
+ * @brief Evaluates this on all record boundaries (the first and last input of each record),
+ *        widens the error of last stage submodels in case their bounds do not hold.
+ * @param index The records indexed by the model (range start values, sorted)
+ * @param num_of_records The number of records indexed by the model
+ * @returns The maximal number of positions added to the error of a submodel
+ * @note Error bounds are only widened, never tightened
+ */
+uint32_t RQRMIFast::validate_error_bounds(const scalar_t* index, uint32_t num_of_records) {
+
+	std::vector<uint32_t> required(_total_submodels, 0);
+	wide_scalar_t inputs, status, output, error;
+	uint32_t submodel_idx[SIMD_WIDTH];
+	uint32_t records[SIMD_WIDTH];
+	uint32_t count = 0;
+
+	// Evaluate the probes of a full vector, update the required error of their submodels
+	auto flush = [&]() {
+		switch (_hidden_width) {
+		case 4: evaluate_kernel<0, 4>(inputs, status, output, error, submodel_idx); break;
+		case 8: evaluate_kernel<0, 8>(inputs, status, output, error, submodel_idx); break;
+		default: evaluate_kernel<0, 16>(inputs, status, output, error, submodel_idx); break;
+		}
+		for (uint32_t j=0; j<count; ++j) {
+			if (!status.integers[j]) continue;
+			int position = (uint32_t)(output.scalars[j] * num_of_records);
+			uint32_t deviation = abs(position - (int)records[j]);
+			required[submodel_idx[j]] = MAX(required[submodel_idx[j]], deviation);
+		}
+		count = 0;
+	};
+
+	// Probe the first and last input of each record
+	for (uint32_t r=0; r<num_of_records; ++r) {
+		scalar_t last = (r+1 < num_of_records) ? SCALAR_PREV(index[r+1]) : index[r];
+		for (scalar_t x : {index[r], last}) {
+			inputs.scalars[count] = x;
+			records[count++] = r;
+			if (count == input_width()) flush();
+		}
+	}
+	if (count > 0) {
+		for (uint32_t j=count; j<input_width(); ++j) inputs.scalars[j] = inputs.scalars[0];
+		flush();
+	}
+
+	// Widen the errors of violated submodels only
+	uint32_t max_widening = 0;
+	uint32_t widened = 0;
+	for (uint32_t i=0; i<_total_submodels; ++i) {
+		uint32_t* current;
+		switch (_hidden_width) {
+		case 4: current = &((fast_submodel_t<4>*)_submodels)[i].error; break;
+		case 8: current = &((fast_submodel_t<8>*)_submodels)[i].error; break;
+		default: current = &((fast_submodel_t<16>*)_submodels)[i].error; break;
+		}
+		if (required[i] + LOOKUP_MARGIN - ROUNDING_MARGIN > *current) {
+			uint32_t value = required[i] + LOOKUP_MARGIN;
+			max_widening = MAX(max_widening, value - *current);
+			*current = value;
+			++widened;
+		}
+	}
+	if (widened > 0) {
+		warning("RQRMIFast widened the error of " << widened << " submodels by up to "
+				<< max_widening << " positions");
+	}
+	return max_widening;
 }
 
 /**
- * @brief Evaluate fast RQRMI models using SIMD acceleration
+ * @brief Evaluates a single stage for a vector of inputs
+ * @tparam Width The hidden width of the submodels
+ * @param stage_idx The stage to evaluate
+ * @param base_idx The index of the first submodel of the stage
  * @param[in] inputs a vector of inputs
- * @param[out] status a vector of output status (1 valid, 0 error)
- * @param[out] output a vector of outputs
- * @param[out] error a vector of error values
- * @note The SIMD acceleration method should be set in compilation time (FMA, AVX512, AVX, SSE, NO_RQRMI_OPT)
+ * @param[in,out] status a vector of output status (1 valid, 0 error)
+ * @param[in,out] next_idx The output of the previous stage, updated with the output of this stage
+ * @param[out] submodels The submodels used per input
  */
-void RQRMIFast::evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const {
-	// Base index for submodel in array
-	uint32_t base_idx = 0;
-	// Next index of submodel in stage, per input
-	wide_scalar_t next_idx;
-	// A collection of submodels
-	submodel_collection_t submodels;
-
-	// Holds a vector of submodels input normalization factors
-	wide_scalar_t input_mean, input_stddev;
+template <uint32_t Width>
+__attribute__((always_inline)) inline
+void RQRMIFast::evaluate_stage(uint32_t stage_idx, uint32_t base_idx, wide_scalar_t& inputs,
+		wide_scalar_t& status, wide_scalar_t& next_idx,
+		const fast_submodel_t<Width>** submodels) const
+{
+	const fast_submodel_t<Width>* table = (const fast_submodel_t<Width>*)_submodels;
 
 	// Holds a vector of submodels output post-processing factors
 	wide_scalar_t output_factor, output_min;
@@ -132,349 +478,318 @@ void RQRMIFast::evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scal
 	// Holds a vector of layer0 variables
 	wide_scalar_t w0, b0;
 
-#ifdef NO_RQRMI_OPT
-	// Used for intermediate computations
-	float reg0;
+	// Holds the output of each layer
+	wide_scalar_t result;
 
+#ifdef NO_RQRMI_OPT
 	// Used for ReLUs operations
-	static float zeros = 0;
-	static float ones = 1-SCALAR_EPS;
-
-	// Initiate status
-	status.scalars[0] = BINARY_ONES;
-	next_idx.scalars[0] = 0;
-
+	static const float zeros = 0;
+	static const float ones = 1-SCALAR_EPS;
 #elif __AVX512F__
 	// Used for intermediate computations
-	__m512 reg0, reg1, reg2, reg3, reg4;
+	__m512 reg0, reg1, reg2;
 
 	// Used for ReLUs operations
 	static const __m512 zeros = _mm512_setzero_ps();
 	static const __m512 ones = _mm512_set1_ps(1-SCALAR_EPS);
-
-	// Used for masked load operations
-	static const __mmask16 mask = _mm512_int2mask(255);
-
-	// Initiate status
-	reg0 =_mm512_set1_ps(BINARY_ONES);
-	_mm512_store_ps(status.scalars, reg0);
-	_mm512_store_ps(next_idx.scalars, zeros);
-
 #elif __AVX__
 	// Used for intermediate computations
-	__m256 reg0, reg1, reg2, reg3, reg4;
+	__m256 reg0, reg1, reg2;
 
 	// Used for ReLUs operations
 	static const __m256 zeros = _mm256_setzero_ps();
 	static const __m256 ones = _mm256_set1_ps(1-SCALAR_EPS);
-
-	// Initiate status
-	reg0 =_mm256_set1_ps(BINARY_ONES);
-	_mm256_store_ps(status.scalars, reg0);
-	_mm256_store_ps(next_idx.scalars, zeros);
-
 #elif __SSE__
 	// Used for intermediate computations
-	__m128 reg0, reg1, reg2, reg3, reg4, reg5, reg6;
+	__m128 reg0, reg1, reg2;
 
 	// Used for ReLUs operations
 	static const __m128 zeros = _mm_setzero_ps();
 	static const __m128 ones = _mm_set1_ps(1-SCALAR_EPS);
-
-	// Initiate status
-	reg0 = _mm_set1_ps(BINARY_ONES); // 0x11111111 float32 representation
-	_mm_store_ps(status.scalars, reg0);
-	_mm_store_ps(next_idx.scalars, zeros);
-
 #endif
 
-	// For each stage
-	for (uint32_t i=0; i<_num_of_stages; ++i) {
-
-		// Get the address of each in the collection next submodels
-		for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
-			submodels[j] = &_submodles[base_idx + (uint32_t)(_stage_submodels[i] * next_idx.scalars[j]) ];
-			// Update status according to submodel compile status
-			status.integers[j] &= submodels[j]->compiled;
-			// Update input normalization factors
-			input_mean.scalars[j] = submodels[j]->input_mean;
-			input_stddev.scalars[j] = submodels[j]->input_stddev;
-			// Update layer0
-			w0.scalars[j] = submodels[j]->w0;
-			b0.scalars[j] = submodels[j]->b0;
-			// Update post-processing factors
-			output_factor.scalars[j] = submodels[j]->output_factor;
-			output_min.scalars[j] = submodels[j]->output_min;
-		}
+	// Get the address of each in the collection next submodels
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		submodels[j] = &table[base_idx + (uint32_t)(_stage_submodels[stage_idx] * next_idx.scalars[j]) ];
+		// Update status according to submodel compile status
+		status.integers[j] &= submodels[j]->compiled;
+		// Update layer0 (holds the input normalization)
+		w0.scalars[j] = submodels[j]->w0;
+		b0.scalars[j] = submodels[j]->b0;
+		// Update post-processing factors
+		output_factor.scalars[j] = submodels[j]->output_factor;
+		output_min.scalars[j] = submodels[j]->output_min;
+	}
 
+	// Compute layer0 (normalizes the input as well)
 #ifdef NO_RQRMI_OPT
-		// Preprocess input
-		reg0 = (inputs.scalars[0] - input_mean.scalars[0]) / input_stddev.scalars[0];
-
-		model_info("Input for submodel after preprocessing: %.12f", reg0);
-
-		// Compute layer0
-		FMA(reg0, w0.scalars[0], b0.scalars[0]);
-		float result = 0;
-
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		result.scalars[j] = inputs.scalars[j] * w0.scalars[j] + b0.scalars[j];
+	}
 #elif __AVX512F__
-		// Load registers
-		reg0 = _mm512_load_ps(inputs.scalars);
-		reg1 = _mm512_load_ps(input_mean.scalars);
-		reg2 = _mm512_load_ps(input_stddev.scalars);
-		reg3 = _mm512_load_ps(w0.scalars);
-		reg4 = _mm512_load_ps(b0.scalars);
-
-		// Preprocess input collection
-		reg0 = _mm512_sub_ps(reg0, reg1);
-		reg0 = _mm512_div_ps(reg0, reg2);
-
-		// Compute layer0
-		FMA(reg0, reg3, reg4);
-
-		// We wish to extract input per submodel
-		wide_scalar_t result;
-		_mm512_storeu_ps(result.scalars, reg0);
-
+	reg0 = _mm512_load_ps(inputs.scalars);
+	reg1 = _mm512_load_ps(w0.scalars);
+	reg2 = _mm512_load_ps(b0.scalars);
+	FMA(reg0, reg1, reg2);
+	_mm512_store_ps(result.scalars, reg0);
 #elif __AVX__
-		// Load registers
-		reg0 = _mm256_load_ps(inputs.scalars);
-		reg1 = _mm256_load_ps(input_mean.scalars);
-		reg2 = _mm256_load_ps(input_stddev.scalars);
-		reg3 = _mm256_load_ps(w0.scalars);
-		reg4 = _mm256_load_ps(b0.scalars);
-
-		// Preprocess input collection
-		reg0 = _mm256_sub_ps(reg0, reg1);
-		reg0 = _mm256_div_ps(reg0, reg2);
-
-		// Compute layer0
-		FMA(reg0, reg3, reg4);
-
-		// We wish to extract input per submodel
-		wide_scalar_t result;
-		_mm256_storeu_ps(result.scalars, reg0);
+	reg0 = _mm256_load_ps(inputs.scalars);
+	reg1 = _mm256_load_ps(w0.scalars);
+	reg2 = _mm256_load_ps(b0.scalars);
+	FMA(reg0, reg1, reg2);
+	_mm256_store_ps(result.scalars, reg0);
 #elif __SSE__
-		// Load registers
-		reg0 = _mm_load_ps(inputs.scalars);
-		reg1 = _mm_load_ps(input_mean.scalars);
-		reg2 = _mm_load_ps(input_stddev.scalars);
-		reg3 = _mm_load_ps(w0.scalars);
-		reg4 = _mm_load_ps(b0.scalars);
-
-		// Preprocess input collection
-		reg0 = _mm_sub_ps(reg0, reg1);
-		reg0 = _mm_div_ps(reg0, reg2);
-
-		// Compute layer0
-		FMA(reg0, reg3, reg4);
-
-		// We wish to extract input per submodel
-		wide_scalar_t result;
-		_mm_storeu_ps(result.scalars, reg0);
+	reg0 = _mm_load_ps(inputs.scalars);
+	reg1 = _mm_load_ps(w0.scalars);
+	reg2 = _mm_load_ps(b0.scalars);
+	FMA(reg0, reg1, reg2);
+	_mm_store_ps(result.scalars, reg0);
 #endif
 
-		// For each submodel
-		for (uint32_t j=0; j<input_width(); ++j) {
-#ifdef NO_RQRMI_OPT
-			// Compute layer 1
-			rqrmi_vector_t vector;
-			for (int k=0; k<8; ++k) {
-				vector.scalars[k] = (reg0 * submodels[j]->w1.scalars[k]) + submodels[j]->b1.scalars[k];
-				if (vector.scalars[k] < 0) vector.scalars[k] = 0; // ReLU
-			}
-
-			model_info("Layer1 output: [%.12f,%.12f,%.12f,%.12f,%.12f,%.12f,%.12f,%.12f]",
-					vector.scalars[0], vector.scalars[1], vector.scalars[2], vector.scalars[3],
-					vector.scalars[4], vector.scalars[5], vector.scalars[6], vector.scalars[7]);
-
-			// Compute layer2 & reduce output
-			for (int k=0; k<8; ++k) {
-				result += (vector.scalars[k] * submodels[j]->w2.scalars[k]);
-			}
-			result += submodels[j]->b2.scalars[0];
+	// Compute layer1 and layer2 for each submodel
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		result.scalars[j] = hidden_layers<Width>(result.scalars[j], submodels[j]);
+	}
 
+	// Post-process outputs, update next indices
+#ifdef NO_RQRMI_OPT
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		result.scalars[j] = result.scalars[j] * output_factor.scalars[j] + output_min.scalars[j];
+		if (result.scalars[j] < zeros) result.scalars[j] = zeros;
+		if (result.scalars[j] > ones) result.scalars[j] = ones;
+		next_idx.scalars[j] = result.scalars[j];
+	}
 #elif __AVX512F__
-			// Set current input
-			reg1 = _mm512_set1_ps(result.scalars[j]);
-
-			// Load registers
-			reg2 = _mm512_mask_load_ps(reg2, mask, submodels[j]->w1.scalars);
-			reg3 = _mm512_mask_load_ps(reg2, mask, submodels[j]->b1.scalars);
-
-			// Compute layer1
-			FMA(reg1, reg2, reg3);
-			reg1 = _mm512_max_ps(reg1, zeros); // ReLU
-
-			// Load registers
-			reg2 = _mm512_mask_load_ps(reg2, mask, submodels[j]->w2.scalars);
-			reg3 = _mm512_mask_load_ps(reg2, mask, submodels[j]->b2.scalars);
-
-			// Compute layer2
-			FMA(reg1, reg2, reg3);
-
-			// Reduce output (https://stackoverflow.com/a/13222410/4103200)
-			// reg1 = ( -, -, -, -, -, -, -, -, x7, x6, x5, x4, x3, x2, x1, x0 )
-			const __m128 hiQuad = _mm512_extractf32x4_ps(reg1, 1); 	// ( x7, x6, x5, x4 )
-			const __m128 loQuad = _mm512_castps512_ps128(reg1);	// ( x3, x2, x1, x0 )
-			const __m128 sumQuad = _mm_add_ps(loQuad, hiQuad);		// ( x3 + x7, x2 + x6, x1 + x5, x0 + x4 )
-			const __m128 loDual = sumQuad;							// ( -, -, x1 + x5, x0 + x4 )
-			const __m128 hiDual = _mm_movehl_ps(sumQuad, sumQuad);  // ( -, -, x3 + x7, x2 + x6 )
-			const __m128 sumDual = _mm_add_ps(loDual, hiDual);		// ( -, -, x1 + x3 + x5 + x7, x0 + x2 + x4 + x6 )
-			const __m128 lo = sumDual;								// ( -, -, -, x0 + x2 + x4 + x6 )
-			const __m128 hi = _mm_shuffle_ps(sumDual, sumDual, 0x1);// ( -, -, -, x1 + x3 + x5 + x7 )
-			const __m128 sum = _mm_add_ss(lo, hi);					// ( -, -, -, x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7 )
-			result.scalars[j] = _mm_cvtss_f32(sum);
+	reg0 = _mm512_load_ps(result.scalars);
+	reg1 = _mm512_load_ps(output_factor.scalars);
+	reg2 = _mm512_load_ps(output_min.scalars);
+	FMA(reg0, reg1, reg2);
+	reg0 = _mm512_max_ps(reg0, zeros);
+	reg0 = _mm512_min_ps(reg0, ones);
+	_mm512_store_ps(next_idx.scalars, reg0);
 #elif __AVX__
-			// Set current input
-			reg1 = _mm256_set1_ps(result.scalars[j]);
-
-			// Load registers
-			reg2 = _mm256_load_ps(submodels[j]->w1.scalars);
-			reg3 = _mm256_load_ps(submodels[j]->b1.scalars);
-
-			// Compute layer1
-			FMA(reg1, reg2, reg3);
-			reg1 = _mm256_max_ps(reg1, zeros); // ReLU
-
-			// Load registers
-			reg2 = _mm256_load_ps(submodels[j]->w2.scalars);
-			reg3 = _mm256_load_ps(submodels[j]->b2.scalars);
-
-			// Compute layer2
-			FMA(reg1, reg2, reg3);
-
-			// Reduce output (https://stackoverflow.com/a/13222410/4103200)
-			// reg1 = ( x7, x6, x5, x4, x3, x2, x1, x0 )
-			const __m128 hiQuad = _mm256_extractf128_ps(reg1, 1); 	// ( x7, x6, x5, x4 )
-			const __m128 loQuad = _mm256_castps256_ps128(reg1);	// ( x3, x2, x1, x0 )
-			const __m128 sumQuad = _mm_add_ps(loQuad, hiQuad);		// ( x3 + x7, x2 + x6, x1 + x5, x0 + x4 )
-			const __m128 loDual = sumQuad;							// ( -, -, x1 + x5, x0 + x4 )
-			const __m128 hiDual = _mm_movehl_ps(sumQuad, sumQuad);  // ( -, -, x3 + x7, x2 + x6 )
-			const __m128 sumDual = _mm_add_ps(loDual, hiDual);		// ( -, -, x1 + x3 + x5 + x7, x0 + x2 + x4 + x6 )
-			const __m128 lo = sumDual;								// ( -, -, -, x0 + x2 + x4 + x6 )
-			const __m128 hi = _mm_shuffle_ps(sumDual, sumDual, 0x1);// ( -, -, -, x1 + x3 + x5 + x7 )
-			const __m128 sum = _mm_add_ss(lo, hi);					// ( -, -, -, x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7 )
-			result.scalars[j] = _mm_cvtss_f32(sum);
-
+	reg0 = _mm256_load_ps(result.scalars);
+	reg1 = _mm256_load_ps(output_factor.scalars);
+	reg2 = _mm256_load_ps(output_min.scalars);
+	FMA(reg0, reg1, reg2);
+	reg0 = _mm256_max_ps(reg0, zeros);
+	reg0 = _mm256_min_ps(reg0, ones);
+	_mm256_store_ps(next_idx.scalars, reg0);
 #elif __SSE__
-			// Set current input
-			reg1 = _mm_set1_ps(result.scalars[j]);
-			reg2 = _mm_set1_ps(result.scalars[j]);
-
-			// Load registers
-			reg3 = _mm_load_ps(submodels[j]->w1.scalars);
-			reg4 = _mm_load_ps(&submodels[j]->w1.scalars[4]);
-
-			reg5 = _mm_load_ps(submodels[j]->b1.scalars);
-			reg6 = _mm_load_ps(&submodels[j]->b1.scalars[4]);
-
-			// Compute layer1
-			FMA(reg1, reg3, reg5);
-			FMA(reg2, reg4, reg6);
-
-			reg1 = _mm_max_ps(reg1, zeros); // ReLU
-			reg2 = _mm_max_ps(reg2, zeros); // ReLU
-
-			// Load registers
-			reg3 = _mm_load_ps(submodels[j]->w2.scalars);
-			reg4 = _mm_load_ps(&submodels[j]->w2.scalars[4]);
-
-			reg5 = _mm_load_ps(submodels[j]->b2.scalars);
-
-			// Compute layer2
-			FMA(reg1, reg3, reg5);
-			FMA(reg2, reg4, zeros);
-
-			// Reduce output (https://stackoverflow.com/a/13222410/4103200)
-			// reg1 = ( x3, x2, x1, x0 )
-			// reg2 = ( x7, x6, x5, x4 )
-			const __m128 sumQuad = _mm_add_ps(reg1, reg2);		// ( x3 + x7, x2 + x6, x1 + x5, x0 + x4 )
-			const __m128 loDual = sumQuad;							// ( -, -, x1 + x5, x0 + x4 )
-			const __m128 hiDual = _mm_movehl_ps(sumQuad, sumQuad);  // ( -, -, x3 + x7, x2 + x6 )
-			const __m128 sumDual = _mm_add_ps(loDual, hiDual);		// ( -, -, x1 + x3 + x5 + x7, x0 + x2 + x4 + x6 )
-			const __m128 lo = sumDual;								// ( -, -, -, x0 + x2 + x4 + x6 )
-			const __m128 hi = _mm_shuffle_ps(sumDual, sumDual, 0x1);// ( -, -, -, x1 + x3 + x5 + x7 )
-			const __m128 sum = _mm_add_ss(lo, hi);					// ( -, -, -, x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7 )
-			result.scalars[j] = _mm_cvtss_f32(sum);
+	reg0 = _mm_load_ps(result.scalars);
+	reg1 = _mm_load_ps(output_factor.scalars);
+	reg2 = _mm_load_ps(output_min.scalars);
+	FMA(reg0, reg1, reg2);
+	reg0 = _mm_max_ps(reg0, zeros);
+	reg0 = _mm_min_ps(reg0, ones);
+	_mm_store_ps(next_idx.scalars, reg0);
 #endif
-		}
-
-#ifdef NO_RQRMI_OPT
-		model_info("Submodel output before post-processing: %.12f", result);
-
-		// Post-process outputs
-		FMA(result, output_factor.scalars[0], output_min.scalars[0]);
+}
 
-		// Used for micro-debugging
-		model_info("Final result for stage %u: %.12f", i, result);
+/**
+ * @brief The evaluation kernel of all RQRMIFast variants
+ * @tparam Stages The number of stages, or 0 for reading it in runtime
+ * @tparam Width The hidden width of the submodels
+ * @param[out] submodel_idx The index of the last submodel per input. Ignored when null.
+ */
+template <uint32_t Stages, uint32_t Width>
+__attribute__((always_inline)) inline
+void RQRMIFast::evaluate_kernel(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output,
+		wide_scalar_t& error, uint32_t* submodel_idx) const
+{
+	// Base index for submodel in array
+	uint32_t base_idx = 0;
+	// Next index of submodel in stage, per input
+	wide_scalar_t next_idx;
+	// A collection of submodels
+	const fast_submodel_t<Width>* submodels[SIMD_WIDTH];
 
-		if (result < zeros) result = zeros;
-		if (result > ones) result = ones;
+	// Initiate status
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		status.scalars[j] = BINARY_ONES;
+		next_idx.scalars[j] = 0;
+	}
 
-		// Update next indices
-		next_idx.scalars[0] = result;
-#elif __AVX512F__
-		// Re-load results to register0
-		reg0 = _mm512_load_ps(result.scalars);
+	// Specialized variants know the number of stages in compile time
+	if (Stages > 0) {
+#		pragma GCC unroll 8
+		for (uint32_t i=0; i<Stages; ++i) {
+			evaluate_stage<Width>(i, base_idx, inputs, status, next_idx, submodels);
+			base_idx += _stage_submodels[i];
+		}
+	} else {
+		for (uint32_t i=0; i<_num_of_stages; ++i) {
+			evaluate_stage<Width>(i, base_idx, inputs, status, next_idx, submodels);
+			base_idx += _stage_submodels[i];
+		}
+	}
 
-		// Load registers
-		reg1 = _mm512_load_ps(output_factor.scalars);
-		reg2 = _mm512_load_ps(output_min.scalars);
+	// Load the error vector
+	for (uint32_t j=0; j<input_width(); ++j) {
+		error.integers[j] = submodels[j]->error;
+	}
 
-		// Post-process outputs
-		FMA(reg0, reg1, reg2);
+	// Used for validating the error bounds
+	if (submodel_idx != nullptr) {
+		const fast_submodel_t<Width>* table = (const fast_submodel_t<Width>*)_submodels;
+		for (uint32_t j=0; j<input_width(); ++j) {
+			submodel_idx[j] = submodels[j] - table;
+		}
+	}
 
-		reg0 = _mm512_max_ps(reg0, zeros);
-		reg0 = _mm512_min_ps(reg0, ones);
+	// Return result
+	output = next_idx;
+}
 
-		// Update next indices
-		_mm512_storeu_ps(next_idx.scalars, reg0);
+/**
+ * @brief Evaluate fast RQRMI models using SIMD acceleration
+ * @param[in] inputs a vector of inputs
+ * @param[out] status a vector of output status (1 valid, 0 error)
+ * @param[out] output a vector of outputs
+ * @param[out] error a vector of error values
+ * @note The SIMD acceleration method should be set in compilation time (FMA, AVX512, AVX, SSE, NO_RQRMI_OPT)
+ */
+void RQRMIFast::evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const {
+	switch (_hidden_width) {
+	case 4: evaluate_kernel<0, 4>(inputs, status, output, error, nullptr); break;
+	case 8: evaluate_kernel<0, 8>(inputs, status, output, error, nullptr); break;
+	default: evaluate_kernel<0, 16>(inputs, status, output, error, nullptr); break;
+	}
+}
 
-#elif __AVX__
-		// Re-load results to register0
-		reg0 = _mm256_load_ps(result.scalars);
+/**
+ * @brief Evaluate several RQRMI models, each on its own vector of inputs.
+ *        Specialized models of the same shape are evaluated together, stage by stage,
+ *        so their independent dependency chains overlap in the CPU.
+ *        Other models are evaluated on their own.
+ * @param models An array of models
+ * @param num_of_models The number of models
+ * @param[in] inputs an array of input vectors, one per model
+ * @param[out] status an array of output status vectors (1 valid, 0 error)
+ * @param[out] output an array of output vectors
+ * @param[out] error an array of error vectors
+ */
+void RQRMIFast::evaluate_interleaved(const RQRMIFast* const* models, uint32_t num_of_models,
+		wide_scalar_t* inputs, wide_scalar_t* status, wide_scalar_t* output, wide_scalar_t* error)
+{
+	bool done[num_of_models];
+	uint32_t group[num_of_models];
+
+	for (uint32_t m=0; m<num_of_models; ++m) {
+		done[m] = false;
+	}
 
-		// Load registers
-		reg1 = _mm256_load_ps(output_factor.scalars);
-		reg2 = _mm256_load_ps(output_min.scalars);
+	for (uint32_t m=0; m<num_of_models; ++m) {
+		if (done[m]) continue;
 
-		// Post-process outputs
-		FMA(reg0, reg1, reg2);
+		// Generic and derived models are evaluated on their own
+		if (!models[m]->is_specialized()) {
+			models[m]->evaluate(inputs[m], status[m], output[m], error[m]);
+			continue;
+		}
 
-		reg0 = _mm256_max_ps(reg0, zeros);
-		reg0 = _mm256_min_ps(reg0, ones);
+		// Group all models of the same shape
+		uint32_t stages = models[m]->_num_of_stages;
+		uint32_t width = models[m]->_hidden_width;
+		uint32_t group_size = 0;
+		for (uint32_t j=m; j<num_of_models; ++j) {
+			if (done[j] || !models[j]->is_specialized()) continue;
+			if (models[j]->_num_of_stages != stages || models[j]->_hidden_width != width) continue;
+			group[group_size++] = j;
+			done[j] = true;
+		}
 
-		// Update next indices
-		_mm256_storeu_ps(next_idx.scalars, reg0);
+#		define INTERLEAVE(S, W) 														\
+		if (stages == S && width == W) {												\
+			RQRMIFastT<S, W>::evaluate_interleaved(models, group, group_size,			\
+					inputs, status, output, error);										\
+			continue;																	\
+		}
 
-#elif __SSE__
-		// Re-load results to register0
-		reg0 = _mm_load_ps(result.scalars);
+		INTERLEAVE(1, 4);  INTERLEAVE(1, 8);  INTERLEAVE(1, 16);
+		INTERLEAVE(2, 4);  INTERLEAVE(2, 8);  INTERLEAVE(2, 16);
+		INTERLEAVE(3, 4);  INTERLEAVE(3, 8);  INTERLEAVE(3, 16);
+		INTERLEAVE(4, 4);  INTERLEAVE(4, 8);  INTERLEAVE(4, 16);
 
-		// Load registers
-		reg1 = _mm_load_ps(output_factor.scalars);
-		reg2 = _mm_load_ps(output_min.scalars);
+#		undef INTERLEAVE
+	}
+}
 
-		// Post-process outputs
-		FMA(reg0, reg1, reg2);
+/**
+ * @brief Create new RQRMIFastT instance from RQRMI model
+ * @throws std::runtime_error in case the model does not match the specialization
+ */
+template <uint32_t Stages, uint32_t Width>
+RQRMIFastT<Stages, Width>::RQRMIFastT(rqrmi_model_t *model) : RQRMIFast(model) {
+	if (_num_of_stages != Stages || _hidden_width != Width) {
+		throw std::runtime_error("input model does not match the RQRMIFast specialization");
+	}
+}
 
-		reg0 = _mm_max_ps(reg0, zeros);
-		reg0 = _mm_min_ps(reg0, ones);
+template <uint32_t Stages, uint32_t Width>
+void RQRMIFastT<Stages, Width>::evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const {
+	evaluate_kernel<Stages, Width>(inputs, status, output, error, nullptr);
+}
 
-		// Update next indices
-		_mm_storeu_ps(next_idx.scalars, reg0);
-#endif
-		// Update base index
-		base_idx += _stage_submodels[i];
+/**
+ * @brief Evaluate a group of models of this shape, stage by stage
+ * @param models An array of models
+ * @param group The indices of the models of this shape in the array
+ * @param group_size The number of models in the group
+ * @param[in] inputs an array of input vectors, one per model in the array
+ * @param[out] status an array of output status vectors, one per model in the array
+ * @param[out] output an array of output vectors, one per model in the array
+ * @param[out] error an array of error vectors, one per model in the array
+ */
+template <uint32_t Stages, uint32_t Width>
+void RQRMIFastT<Stages, Width>::evaluate_interleaved(const RQRMIFast* const* models,
+		const uint32_t* group, uint32_t group_size,
+		wide_scalar_t* inputs, wide_scalar_t* status, wide_scalar_t* output, wide_scalar_t* error)
+{
+	// Base index for submodel in array, per model
+	uint32_t base_idx[group_size];
+	// The last submodels used per model
+	const fast_submodel_t<Width>* submodels[group_size][SIMD_WIDTH];
+
+	// Initiate status, the output vector holds the next index of each stage
+	for (uint32_t g=0; g<group_size; ++g) {
+		uint32_t m = group[g];
+		base_idx[g] = 0;
+		for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+			status[m].scalars[j] = BINARY_ONES;
+			output[m].scalars[j] = 0;
+		}
 	}
 
-	// Load the error vector
-	for (uint32_t j=0; j<input_width(); ++j) {
-		error.integers[j] = submodels[j]->error;
+	// Evaluate the same stage of all models before moving to the next one
+#	pragma GCC unroll 8
+	for (uint32_t i=0; i<Stages; ++i) {
+		for (uint32_t g=0; g<group_size; ++g) {
+			uint32_t m = group[g];
+			const RQRMIFastT* model = static_cast<const RQRMIFastT*>(models[m]);
+			model->template evaluate_stage<Width>(i, base_idx[g], inputs[m], status[m], output[m], submodels[g]);
+			base_idx[g] += model->_stage_submodels[i];
+		}
 	}
 
-	// Return result
-	output = next_idx;
-
+	// Load the error vectors
+	for (uint32_t g=0; g<group_size; ++g) {
+		for (uint32_t j=0; j<input_width(); ++j) {
+			error[group[g]].integers[j] = submodels[g][j]->error;
+		}
+	}
 }
+
+// Explicit template Instantiation
+template class RQRMIFastT<1, 4>;
+template class RQRMIFastT<1, 8>;
+template class RQRMIFastT<1, 16>;
+template class RQRMIFastT<2, 4>;
+template class RQRMIFastT<2, 8>;
+template class RQRMIFastT<2, 16>;
+template class RQRMIFastT<3, 4>;
+template class RQRMIFastT<3, 8>;
+template class RQRMIFastT<3, 16>;
+template class RQRMIFastT<4, 4>;
+template class RQRMIFastT<4, 8>;
+template class RQRMIFastT<4, 16>;
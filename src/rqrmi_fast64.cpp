@@ -0,0 +1,370 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+#include <rqrmi_fast64.h>
+#include <logging.h>
+
+// The largest double below 1, outputs are clamped to [0, 1)
+#define ONE_MINUS_EPS64 (1 - 1.1102230246251565e-16)
+
+// The submodel errors hold a margin of two positions for the lookup procedure
+// (see rqrmi_tools_calculate_submodel_error)
+#define LOOKUP_MARGIN 2
+
+// Fast multiple add of double vectors
+#ifdef __FMA__
+#	define FMA64(a,b,c) a = _mm256_fmadd_pd(a, b, c);
+#else
+#	define FMA64(a,b,c) a = _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+
+// The AVX2 path requires 64-bit integer operations
+#if !defined NO_RQRMI_OPT && defined __AVX2__
+#	define RQRMI_FAST64_AVX2
+#endif
+
+#ifdef RQRMI_FAST64_AVX2
+/**
+ * @brief Converts unsigned 64-bit integers to doubles, correctly rounded.
+ *        The high and low 32 bits are converted separately with magic exponents,
+ *        so the only rounding is of the final add (AVX2 has no such conversion).
+ */
+static inline __m256d uint64_to_double(__m256i x) {
+	__m256i high = _mm256_srli_epi64(x, 32);
+	high = _mm256_or_si256(high, _mm256_castpd_si256(_mm256_set1_pd(19342813113834066795298816.)));	// 2^84
+	__m256i low = _mm256_blend_epi16(x, _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.)), 0xcc);	// 2^52
+	__m256d result = _mm256_sub_pd(_mm256_castsi256_pd(high), _mm256_set1_pd(19342813118337666422669312.)); // 2^84 + 2^52
+	return _mm256_add_pd(result, _mm256_castsi256_pd(low));
+}
+
+/**
+ * @brief Sums all elements of a vector of doubles
+ */
+static inline scalar64_t reduce_add(__m256d x) {
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+#endif
+
+/**
+ * @brief Computes the hidden layer and the output layer of a single submodel
+ * @tparam Width The hidden width of the submodel
+ * @param x The output of layer 0
+ * @param submodel The submodel
+ * @returns The submodel output before post-processing
+ */
+template <uint32_t Width, typename T>
+static inline scalar64_t hidden_layers64(scalar64_t x, const T* submodel) {
+#ifndef RQRMI_FAST64_AVX2
+	scalar64_t result = 0;
+	for (uint32_t k=0; k<Width; ++k) {
+		scalar64_t neuron = x * submodel->w1[k] + submodel->b1[k];
+		if (neuron < 0) neuron = 0; // ReLU
+		result += neuron * submodel->w2[k];
+	}
+	return result + submodel->b2;
+#else
+	const __m256d zeros = _mm256_setzero_pd();
+	__m256d sum = zeros;
+
+	// Compute 4 neurons at a time
+	for (uint32_t k=0; k<Width; k+=4) {
+		__m256d reg = _mm256_set1_pd(x);
+		FMA64(reg, _mm256_load_pd(&submodel->w1[k]), _mm256_load_pd(&submodel->b1[k]));
+		reg = _mm256_max_pd(reg, zeros); // ReLU
+		FMA64(reg, _mm256_load_pd(&submodel->w2[k]), sum);
+		sum = reg;
+	}
+	return reduce_add(sum) + submodel->b2;
+#endif
+}
+
+/**
+ * @brief Create new RQRMIFast64 instance from RQRMI model
+ * @throws std::runtime_error in case the model is not valid RQRMI model
+ */
+RQRMIFast64::RQRMIFast64(rqrmi_model_t *model) : _submodels(nullptr), _total_submodels(0), _hidden_width(0) {
+
+	_num_of_stages = rqrmi_get_num_of_stages(model);
+	if (_num_of_stages == 0) {
+		throw std::runtime_error("input model has no stages!");
+	}
+
+	// Get submodel information
+	std::vector<rqrmi_submodel_info_t> info;
+	uint32_t hidden_width = 0;
+	for (uint32_t s=0; s<_num_of_stages; ++s) {
+		_stage_submodels.push_back(rqrmi_get_num_of_submodels(model, s));
+		for (uint32_t m=0; m<_stage_submodels[s]; ++m) {
+			rqrmi_submodel_info_t current;
+			if (!rqrmi_get_submodel_info(model, s, m, &current)) {
+				throw std::runtime_error("error while extracting information of a submodel");
+			}
+			hidden_width = MAX(hidden_width, current.hidden_width);
+			info.push_back(current);
+		}
+	}
+	_total_submodels = info.size();
+
+	// Pad the hidden layer to the nearest supported width
+	if (hidden_width <= 4) {
+		load_submodels<4>(info);
+	} else if (hidden_width <= 8) {
+		load_submodels<8>(info);
+	} else {
+		load_submodels<16>(info);
+	}
+}
+
+RQRMIFast64::~RQRMIFast64() {
+	free(_submodels);
+}
+
+/**
+ * @brief Copies the submodels information to the array of this
+ * @tparam Width The hidden width of the array
+ * @param info The information of all submodels, ordered by stage
+ */
+template <uint32_t Width>
+void RQRMIFast64::load_submodels(const std::vector<rqrmi_submodel_info_t>& info) {
+
+	_hidden_width = Width;
+	fast_submodel64_t<Width>* submodels = (fast_submodel64_t<Width>*)aligned_alloc(64,
+			sizeof(fast_submodel64_t<Width>) * info.size());
+	if (submodels == nullptr) {
+		throw std::runtime_error("cannot allocate memory for submodels");
+	}
+	_submodels = submodels;
+
+	for (uint32_t i=0; i<info.size(); ++i) {
+		memset(&submodels[i], 0, sizeof(fast_submodel64_t<Width>));
+		submodels[i].compiled = info[i].compiled;
+		submodels[i].error = info[i].error;
+		submodels[i].output_factor = info[i].output_factor;
+		submodels[i].output_min = info[i].output_min;
+		submodels[i].b2 = info[i].b2;
+
+		// The integer center of the input normalization. Floats above 2^24 are integers,
+		// so the center is exact where the float mean has no fraction
+		scalar64_t mean = info[i].input_mean;
+		if (mean <= 0) {
+			submodels[i].center = 0;
+		} else if (mean >= 18446744073709551615.0) {
+			submodels[i].center = 0xffffffffffffffffULL;
+		} else {
+			submodels[i].center = (uint64_t)mean;
+		}
+
+		// Fold the input normalization into layer 0
+		scalar64_t w0 = info[i].w0, b0 = info[i].b0, stddev = info[i].input_stddev;
+		submodels[i].w0 = w0 / stddev;
+		submodels[i].b0 = b0 + w0 * ((scalar64_t)submodels[i].center - mean) / stddev;
+
+		for (uint32_t k=0; k<info[i].hidden_width; ++k) {
+			submodels[i].w1[k] = info[i].w1[k];
+			submodels[i].b1[k] = info[i].b1[k];
+			submodels[i].w2[k] = info[i].w2[k];
+		}
+	}
+}
+
+/**
+ * @brief Returns a pointer to the error of a submodel
+ */
+uint32_t* RQRMIFast64::error_of(uint32_t submodel_idx) {
+	switch (_hidden_width) {
+	case 4: return &((fast_submodel64_t<4>*)_submodels)[submodel_idx].error;
+	case 8: return &((fast_submodel64_t<8>*)_submodels)[submodel_idx].error;
+	default: return &((fast_submodel64_t<16>*)_submodels)[submodel_idx].error;
+	}
+}
+
+/**
+ * @brief The evaluation kernel
+ * @tparam Width The hidden width of the submodels
+ * @param[out] submodel_idx The index of the last submodel per key. Ignored when null.
+ */
+template <uint32_t Width>
+void RQRMIFast64::evaluate_kernel(const wide_double_t& keys, wide_double_t& status, wide_double_t& output,
+		wide_double_t& error, uint32_t* submodel_idx) const
+{
+	const fast_submodel64_t<Width>* table = (const fast_submodel64_t<Width>*)_submodels;
+	const fast_submodel64_t<Width>* submodels[SIMD_WIDTH64];
+
+	// Per key: submodel parameters, and the output of each layer
+	wide_double_t center, w0, b0, output_factor, output_min, result;
+	uint32_t next_idx[SIMD_WIDTH64] = {0};
+	uint32_t base_idx = 0;
+
+	for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+		status.integers[j] = 1;
+	}
+
+	for (uint32_t s=0; s<_num_of_stages; ++s) {
+
+		// Gather the submodels of all keys
+		for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+			submodels[j] = &table[base_idx + next_idx[j]];
+			status.integers[j] &= submodels[j]->compiled;
+			center.integers[j] = submodels[j]->center;
+			w0.doubles[j] = submodels[j]->w0;
+			b0.doubles[j] = submodels[j]->b0;
+			output_factor.doubles[j] = submodels[j]->output_factor;
+			output_min.doubles[j] = submodels[j]->output_min;
+		}
+
+		// Compute layer0: the offset from the center is exact, then converted to double
+#ifdef RQRMI_FAST64_AVX2
+		const __m256i sign = _mm256_set1_epi64x(0x8000000000000000LL);
+		__m256i k = _mm256_load_si256((const __m256i*)keys.integers);
+		__m256i c = _mm256_load_si256((const __m256i*)center.integers);
+		__m256i below = _mm256_cmpgt_epi64(_mm256_xor_si256(c, sign), _mm256_xor_si256(k, sign));
+		__m256i magnitude = _mm256_blendv_epi8(_mm256_sub_epi64(k, c), _mm256_sub_epi64(c, k), below);
+		__m256d offset = uint64_to_double(magnitude);
+		offset = _mm256_xor_pd(offset, _mm256_castsi256_pd(_mm256_and_si256(below, sign)));
+		__m256d reg = offset;
+		FMA64(reg, _mm256_load_pd(w0.doubles), _mm256_load_pd(b0.doubles));
+		_mm256_store_pd(result.doubles, reg);
+#else
+		for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+			uint64_t key = keys.integers[j], c = center.integers[j];
+			scalar64_t offset = (key >= c) ? (scalar64_t)(key - c) : -(scalar64_t)(c - key);
+			result.doubles[j] = offset * w0.doubles[j] + b0.doubles[j];
+		}
+#endif
+
+		// Compute layer1 and layer2 for each submodel
+		for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+			result.doubles[j] = hidden_layers64<Width>(result.doubles[j], submodels[j]);
+		}
+
+		// Post-process outputs
+#ifdef RQRMI_FAST64_AVX2
+		reg = _mm256_load_pd(result.doubles);
+		FMA64(reg, _mm256_load_pd(output_factor.doubles), _mm256_load_pd(output_min.doubles));
+		reg = _mm256_max_pd(reg, _mm256_setzero_pd());
+		reg = _mm256_min_pd(reg, _mm256_set1_pd(ONE_MINUS_EPS64));
+		_mm256_store_pd(output.doubles, reg);
+#else
+		for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+			scalar64_t value = result.doubles[j] * output_factor.doubles[j] + output_min.doubles[j];
+			output.doubles[j] = MIN(MAX(value, 0), ONE_MINUS_EPS64);
+		}
+#endif
+
+		// The next submodel of each key
+		if (s < _num_of_stages-1) {
+			for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+				next_idx[j] = output.doubles[j] * _stage_submodels[s+1];
+			}
+			base_idx += _stage_submodels[s];
+		}
+	}
+
+	for (uint32_t j=0; j<SIMD_WIDTH64; ++j) {
+		error.integers[j] = submodels[j]->error;
+		if (submodel_idx) submodel_idx[j] = base_idx + next_idx[j];
+	}
+}
+
+/**
+ * @brief Evaluate the model on a vector of keys
+ * @param[in] keys a vector of keys
+ * @param[out] status a vector of output status (non zero valid, 0 error)
+ * @param[out] output a vector of outputs, in [0, 1)
+ * @param[out] error a vector of error values
+ */
+void RQRMIFast64::evaluate(const wide_double_t& keys, wide_double_t& status, wide_double_t& output, wide_double_t& error) const {
+	switch (_hidden_width) {
+	case 4: evaluate_kernel<4>(keys, status, output, error, nullptr); break;
+	case 8: evaluate_kernel<8>(keys, status, output, error, nullptr); break;
+	default: evaluate_kernel<16>(keys, status, output, error, nullptr); break;
+	}
+}
+
+/**
+ * @brief Evaluates the model on all record boundaries (the first and last key of each record),
+ *        widens the error of last stage submodels in case their bounds do not hold.
+ * @param index The first key of each record, sorted
+ * @param num_of_records The number of records indexed by the model
+ * @returns The maximal number of positions added to the error of a submodel
+ * @note Error bounds are only widened, never tightened
+ */
+uint32_t RQRMIFast64::validate_error_bounds(const uint64_t* index, uint32_t num_of_records) {
+
+	std::vector<uint32_t> required(_total_submodels, 0);
+	wide_double_t keys, status, output, error;
+	uint32_t submodel_idx[SIMD_WIDTH64];
+	uint32_t records[SIMD_WIDTH64];
+	uint32_t count = 0;
+
+	// Evaluate the probes of a full vector, update the required error of their submodels
+	auto flush = [&]() {
+		switch (_hidden_width) {
+		case 4: evaluate_kernel<4>(keys, status, output, error, submodel_idx); break;
+		case 8: evaluate_kernel<8>(keys, status, output, error, submodel_idx); break;
+		default: evaluate_kernel<16>(keys, status, output, error, submodel_idx); break;
+		}
+		for (uint32_t j=0; j<count; ++j) {
+			if (!status.integers[j]) continue;
+			int64_t position = (uint32_t)(output.doubles[j] * num_of_records);
+			uint32_t deviation = llabs(position - (int64_t)records[j]) + LOOKUP_MARGIN;
+			required[submodel_idx[j]] = MAX(required[submodel_idx[j]], deviation);
+		}
+		count = 0;
+	};
+
+	// Probe the first and last key of each record
+	for (uint32_t r=0; r<num_of_records; ++r) {
+		uint64_t last = (r+1 < num_of_records) ? index[r+1]-1 : index[r];
+		for (uint64_t key : {index[r], last}) {
+			keys.integers[count] = key;
+			records[count++] = r;
+			if (count == SIMD_WIDTH64) flush();
+		}
+	}
+	if (count > 0) {
+		for (uint32_t j=count; j<SIMD_WIDTH64; ++j) keys.integers[j] = keys.integers[0];
+		flush();
+	}
+
+	// Widen the errors
+	uint32_t max_widening = 0;
+	for (uint32_t i=0; i<_total_submodels; ++i) {
+		uint32_t* current = error_of(i);
+		if (required[i] > *current) {
+			max_widening = MAX(max_widening, required[i] - *current);
+			*current = required[i];
+		}
+	}
+	if (max_widening > 0) {
+		info("RQRMIFast64 widened submodel errors by up to " << max_widening << " positions");
+	}
+	return max_widening;
+}
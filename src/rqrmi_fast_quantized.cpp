@@ -0,0 +1,574 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <rqrmi_fast_quantized.h>
+#include <logging.h>
+
+// 0x11111111 float32 representation
+#define BINARY_ONES 1.14437421e-28
+
+// Maximum absolute value of the quantized input of layer 1
+#define QUANTIZED_INPUT_MAX 32767
+
+// Headroom for inputs of layer 1 beyond the measured range
+#define QUANTIZED_INPUT_HEADROOM 1.125
+
+// Upper bound for the accumulated output of layer 2 (kept well below 2^31)
+#define QUANTIZED_OUTPUT_MAX 1.9e9
+
+// Margin (in positions) added to the re-probed error bounds,
+// same as the margin of rqrmi_tools_calculate_submodel_error
+#define QUANTIZED_ERROR_MARGIN 2
+
+// Vectorized kernels require AVX2 integer operations
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+#	define QUANTIZED_SIMD
+#	ifdef __FMA__
+#		define FMA256(a,b,c) a = _mm256_fmadd_ps(a, b, c);
+#	else
+#		define FMA256(a,b,c) a = _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#	endif
+#endif
+
+/**
+ * @brief Returns the position of a hidden neuron in the layer 2 weights vector,
+ *        as the hidden layer is arranged after packing it to int16
+ * @tparam Width The hidden width of the submodel
+ */
+template <uint32_t Width>
+static inline uint32_t packed_position(uint32_t k) {
+#ifdef QUANTIZED_SIMD
+	// _mm256_packs_epi32 interleaves the 128bit lanes of its two inputs:
+	// neurons [0-3, 8-11, 4-7, 12-15]
+	if (Width == 16) {
+		if (k >= 4 && k < 8) return k + 4;
+		if (k >= 8 && k < 12) return k - 4;
+	}
+#endif
+	return k;
+}
+
+/**
+ * @brief Create new quantized instance from RQRMI model
+ * @throws std::runtime_error in case the model is not valid RQRMI model
+ */
+RQRMIFastQuantized::RQRMIFastQuantized(rqrmi_model_t *model) : RQRMIFast() {
+
+	std::vector<rqrmi_submodel_info_t> info;
+	uint32_t hidden_width = load_stages(model, info);
+	_probes = generate_probes(model);
+
+	// The range of layer 0 outputs sets the scale of each submodel
+	std::vector<scalar64_t> input_range = measure_input_range(info);
+
+	if (hidden_width <= 8) {
+		quantize_submodels<8>(info, input_range);
+	} else {
+		quantize_submodels<16>(info, input_range);
+	}
+}
+
+/**
+ * @brief Measures the maximum absolute output of layer 0 per submodel,
+ *        over the inputs the submodel is responsible for.
+ * @param info The information of all submodels, ordered by stage
+ * @returns A vector with the range of each submodel
+ * @note Layer 0 is linear, hence its extremes are at the boundaries of the submodel
+ *       responsibility. These are the trigger inputs of the previous stage.
+ */
+std::vector<scalar64_t> RQRMIFastQuantized::measure_input_range(const std::vector<rqrmi_submodel_info_t>& info) const {
+
+	std::vector<scalar64_t> output(info.size(), 0);
+
+	for (scalar_t x : _probes) {
+		uint32_t base_idx = 0;
+		scalar_t next_idx = 0;
+
+		// Evaluate the original model, track the route of the input
+		for (uint32_t i=0; i<_num_of_stages; ++i) {
+			uint32_t idx = base_idx + (uint32_t)(_stage_submodels[i] * next_idx);
+			const rqrmi_submodel_info_t& current = info[idx];
+			if (!current.compiled) break;
+
+			scalar64_t a = ((x - current.input_mean) / current.input_stddev) * current.w0 + current.b0;
+			output[idx] = MAX(output[idx], fabs(a));
+
+			scalar64_t y = current.b2;
+			for (uint32_t k=0; k<current.hidden_width; ++k) {
+				y += MAX(0.0, a * current.w1[k] + current.b1[k]) * current.w2[k];
+			}
+			y = y * current.output_factor + current.output_min;
+			next_idx = MIN(MAX(y, 0.0), 1-SCALAR_EPS);
+			base_idx += _stage_submodels[i];
+		}
+	}
+
+	return output;
+}
+
+/**
+ * @brief Quantizes the submodels to the array of this
+ * @tparam Width The hidden width of the array
+ * @param info The information of all submodels, ordered by stage
+ * @param input_range The maximum absolute output of layer 0 per submodel
+ */
+template <uint32_t Width>
+void RQRMIFastQuantized::quantize_submodels(const std::vector<rqrmi_submodel_info_t>& info,
+		const std::vector<scalar64_t>& input_range)
+{
+	_hidden_width = Width;
+	_submodels_bytes = sizeof(quantized_submodel_t<Width>) * info.size();
+	quantized_submodel_t<Width>* submodels = (quantized_submodel_t<Width>*)aligned_alloc(64, _submodels_bytes);
+	_submodels = submodels;
+
+	for (uint32_t i=0; i<info.size(); ++i) {
+		const rqrmi_submodel_info_t& current = info[i];
+		quantized_submodel_t<Width>& q = submodels[i];
+
+		memset(&q, 0, sizeof(q));
+		q.compiled = current.compiled;
+		q.error = current.error;
+		if (!current.compiled) continue;
+
+		// Layer 0 outputs the input of layer 1 in units of 1/input_scale
+		scalar64_t range = input_range[i] * QUANTIZED_INPUT_HEADROOM;
+		scalar64_t input_scale = QUANTIZED_INPUT_MAX / (range > 0 ? range : 1.0);
+		q.w0 = current.w0 / current.input_stddev * input_scale;
+		q.b0 = (current.b0 - current.w0 * current.input_mean / current.input_stddev) * input_scale;
+
+		// Layer 1: the largest weight takes the full int16 range, biases are int32
+		scalar64_t max_w1 = 0, max_b1 = 0;
+		for (uint32_t k=0; k<current.hidden_width; ++k) {
+			max_w1 = MAX(max_w1, fabs(current.w1[k]) / input_scale);
+			max_b1 = MAX(max_b1, fabs(current.b1[k]));
+		}
+		scalar64_t hidden_scale = (max_w1 > 0) ? QUANTIZED_INPUT_MAX / max_w1 : 1.0;
+		if (max_b1 * hidden_scale > (1<<30)) {
+			hidden_scale = (1<<30) / max_b1;
+		}
+
+		// Find the shift that fits the largest possible value of each neuron in int16
+		int64_t max_hidden[Width];
+		scalar64_t unit[Width];
+		for (uint32_t k=0; k<Width; ++k) {
+			scalar64_t w1 = k < current.hidden_width ? current.w1[k] : 0;
+			scalar64_t b1 = k < current.hidden_width ? current.b1[k] : 0;
+			q.w1[k] = lrint(w1 / input_scale * hidden_scale);
+			q.b1[k] = lrint(b1 * hidden_scale);
+			max_hidden[k] = MAX((int64_t)0, (int64_t)QUANTIZED_INPUT_MAX * abs(q.w1[k]) + q.b1[k]);
+			q.shift[k] = 0;
+			while ((max_hidden[k] >> q.shift[k]) > QUANTIZED_INPUT_MAX - 1) {
+				q.shift[k]++;
+			}
+			// Round to nearest rather than truncating (folded into the bias)
+			if (q.shift[k] > 0) {
+				q.b1[k] += 1 << (q.shift[k]-1);
+			}
+			max_hidden[k] >>= q.shift[k];
+			// The value of a single int16 unit of the neuron
+			unit[k] = (scalar64_t)(1<<q.shift[k]) / hidden_scale;
+		}
+
+		// Layer 2: the largest weight takes the full int16 range, unless the sum may overflow
+		scalar64_t max_w2 = 0, sum_w2 = 0;
+		for (uint32_t k=0; k<current.hidden_width; ++k) {
+			max_w2 = MAX(max_w2, fabs(current.w2[k] * unit[k]));
+			sum_w2 += fabs(current.w2[k] * unit[k]) * max_hidden[k];
+		}
+		scalar64_t output_scale = (max_w2 > 0) ? QUANTIZED_INPUT_MAX / max_w2 : 1.0;
+		if (sum_w2 * output_scale > QUANTIZED_OUTPUT_MAX) {
+			output_scale = QUANTIZED_OUTPUT_MAX / sum_w2;
+		}
+		for (uint32_t k=0; k<Width; ++k) {
+			scalar64_t w2 = k < current.hidden_width ? current.w2[k] : 0;
+			q.w2[packed_position<Width>(k)] = lrint(w2 * unit[k] * output_scale);
+		}
+
+		// Post-processing holds the output scale and the bias of layer 2
+		q.output_factor = current.output_factor / output_scale;
+		q.output_min = current.b2 * current.output_factor + current.output_min;
+	}
+}
+
+#ifdef QUANTIZED_SIMD
+/**
+ * @brief Computes the int16 hidden layer of 8 neurons as int32 values
+ * @param x The quantized input of layer 1
+ * @param w1 Layer 1 weights
+ * @param b1 Layer 1 biases
+ * @param shift Right shift to int16, per neuron
+ */
+static inline __m256i hidden_neurons(int32_t x, const int32_t* w1, const int32_t* b1, const uint8_t* shift) {
+	// Pairs of {x, 0} multiplied by pairs of {w1, sign(w1)}
+	__m256i reg = _mm256_madd_epi16(_mm256_set1_epi32(x & 0xFFFF), _mm256_load_si256((const __m256i*)w1));
+	reg = _mm256_add_epi32(reg, _mm256_load_si256((const __m256i*)b1));
+	reg = _mm256_max_epi32(reg, _mm256_setzero_si256()); // ReLU
+	return _mm256_srav_epi32(reg, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)shift)));
+}
+
+/**
+ * @brief Sums each of 8 vectors and places the results in a single vector
+ */
+static inline __m256i reduce_add_8x8(__m256i* x) {
+	__m256i x01 = _mm256_hadd_epi32(x[0], x[1]);
+	__m256i x23 = _mm256_hadd_epi32(x[2], x[3]);
+	__m256i x45 = _mm256_hadd_epi32(x[4], x[5]);
+	__m256i x67 = _mm256_hadd_epi32(x[6], x[7]);
+	__m256i x0123 = _mm256_hadd_epi32(x01, x23);
+	__m256i x4567 = _mm256_hadd_epi32(x45, x67);
+	// Each 128bit lane holds the partial sums of the same lane in all inputs
+	return _mm256_add_epi32(_mm256_permute2x128_si256(x0123, x4567, 0x20),
+							_mm256_permute2x128_si256(x0123, x4567, 0x31));
+}
+
+/**
+ * @brief Computes layer 1 and layer 2 of 8 submodels
+ * @tparam Width The hidden width of the submodels
+ * @param x The quantized inputs of layer 1
+ * @param submodels The submodels per input
+ * @returns The int32 outputs of layer 2 (without bias)
+ */
+template <uint32_t Width, typename T>
+static inline __m256i hidden_layers(const uint32_t* x, const T* const* submodels) {
+	__m256i products[8];
+
+	if (Width == 8) {
+		// Two submodels in each int16 vector
+		__m256i partial[4];
+		for (uint32_t j=0; j<8; j+=2) {
+			const T* a = submodels[j];
+			const T* b = submodels[j+1];
+			__m256i hidden = _mm256_packs_epi32(hidden_neurons(x[j], a->w1, a->b1, a->shift),
+												hidden_neurons(x[j+1], b->w1, b->b1, b->shift));
+			// Order the weights as the packed hidden layer: [a0-3, b0-3, a4-7, b4-7]
+			__m256i w2 = _mm256_set_m128i(_mm_load_si128((const __m128i*)b->w2),
+										  _mm_load_si128((const __m128i*)a->w2));
+			w2 = _mm256_permute4x64_epi64(w2, 0xD8);
+			partial[j/2] = _mm256_madd_epi16(hidden, w2);
+		}
+		// Each partial holds [a01, a23, b01, b23, a45, a67, b45, b67]
+		__m256i x01 = _mm256_hadd_epi32(partial[0], partial[1]);
+		__m256i x23 = _mm256_hadd_epi32(partial[2], partial[3]);
+		return _mm256_add_epi32(_mm256_permute2x128_si256(x01, x23, 0x20),
+								_mm256_permute2x128_si256(x01, x23, 0x31));
+	}
+
+	// A single submodel in each int16 vector
+	for (uint32_t j=0; j<8; ++j) {
+		const T* a = submodels[j];
+		__m256i hidden = _mm256_packs_epi32(hidden_neurons(x[j], a->w1, a->b1, a->shift),
+											hidden_neurons(x[j], a->w1+8, a->b1+8, a->shift+8));
+		products[j] = _mm256_madd_epi16(hidden, _mm256_load_si256((const __m256i*)a->w2));
+	}
+	return reduce_add_8x8(products);
+}
+#endif
+
+/**
+ * @brief The evaluation kernel of the quantized model
+ * @tparam Width The hidden width of the submodels
+ * @param[out] submodel_idx The index of the last submodel per input. Ignored when null.
+ */
+template <uint32_t Width>
+void RQRMIFastQuantized::evaluate_kernel(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output,
+		wide_scalar_t& error, uint32_t* submodel_idx) const
+{
+	const quantized_submodel_t<Width>* table = (const quantized_submodel_t<Width>*)_submodels;
+
+	// Base index for submodel in array
+	uint32_t base_idx = 0;
+	// Next index of submodel in stage, per input
+	wide_scalar_t next_idx;
+	// A collection of submodels
+	const quantized_submodel_t<Width>* submodels[SIMD_WIDTH];
+
+	// Holds a vector of submodels output post-processing factors
+	wide_scalar_t output_factor, output_min;
+
+	// Holds a vector of layer0 variables
+	wide_scalar_t w0, b0;
+
+	// Holds the quantized input of layer 1
+	wide_scalar_t hidden_input;
+
+	// Initiate status
+	for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+		status.scalars[j] = BINARY_ONES;
+		next_idx.scalars[j] = 0;
+	}
+
+	for (uint32_t i=0; i<_num_of_stages; ++i) {
+
+		// Get the address of each in the collection next submodels
+		for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+			submodels[j] = &table[base_idx + (uint32_t)(_stage_submodels[i] * next_idx.scalars[j]) ];
+			// Update status according to submodel compile status
+			status.integers[j] &= submodels[j]->compiled;
+			// Update layer0 (holds the input normalization and scale)
+			w0.scalars[j] = submodels[j]->w0;
+			b0.scalars[j] = submodels[j]->b0;
+			// Update post-processing factors
+			output_factor.scalars[j] = submodels[j]->output_factor;
+			output_min.scalars[j] = submodels[j]->output_min;
+		}
+
+#ifdef QUANTIZED_SIMD
+		static const __m256 input_min = _mm256_set1_ps(-QUANTIZED_INPUT_MAX);
+		static const __m256 input_max = _mm256_set1_ps(QUANTIZED_INPUT_MAX);
+		static const __m256 zeros = _mm256_setzero_ps();
+		static const __m256 ones = _mm256_set1_ps(1-SCALAR_EPS);
+
+		// Work on 8 inputs at a time
+		for (uint32_t g=0; g<SIMD_WIDTH; g+=8) {
+			// Compute layer0, quantize its output
+			__m256 reg0 = _mm256_load_ps(&inputs.scalars[g]);
+			FMA256(reg0, _mm256_load_ps(&w0.scalars[g]), _mm256_load_ps(&b0.scalars[g]));
+			reg0 = _mm256_min_ps(_mm256_max_ps(reg0, input_min), input_max);
+			_mm256_store_si256((__m256i*)&hidden_input.integers[g], _mm256_cvtps_epi32(reg0));
+
+			// Compute layer1 and layer2
+			__m256i reg1 = hidden_layers<Width>(&hidden_input.integers[g], &submodels[g]);
+
+			// Post-process outputs, update next indices
+			reg0 = _mm256_cvtepi32_ps(reg1);
+			FMA256(reg0, _mm256_load_ps(&output_factor.scalars[g]), _mm256_load_ps(&output_min.scalars[g]));
+			reg0 = _mm256_max_ps(reg0, zeros);
+			reg0 = _mm256_min_ps(reg0, ones);
+			_mm256_store_ps(&next_idx.scalars[g], reg0);
+		}
+#else
+		for (uint32_t j=0; j<SIMD_WIDTH; ++j) {
+			const quantized_submodel_t<Width>* current = submodels[j];
+
+			// Compute layer0, quantize its output
+			scalar_t x = inputs.scalars[j] * w0.scalars[j] + b0.scalars[j];
+			x = MIN(MAX(x, -QUANTIZED_INPUT_MAX), QUANTIZED_INPUT_MAX);
+			hidden_input.integers[j] = lrintf(x);
+
+			// Compute layer1 and layer2
+			int32_t result = 0;
+			for (uint32_t k=0; k<Width; ++k) {
+				int32_t neuron = (int32_t)hidden_input.integers[j] * current->w1[k] + current->b1[k];
+				neuron = MAX(neuron, 0) >> current->shift[k]; // ReLU
+				result += neuron * current->w2[packed_position<Width>(k)];
+			}
+
+			// Post-process outputs, update next indices
+			scalar_t y = (scalar_t)result * output_factor.scalars[j] + output_min.scalars[j];
+			next_idx.scalars[j] = MIN(MAX(y, 0), 1-SCALAR_EPS);
+		}
+#endif
+
+		base_idx += _stage_submodels[i];
+	}
+
+	// Load the error vector
+	for (uint32_t j=0; j<input_width(); ++j) {
+		error.integers[j] = submodels[j]->error;
+	}
+
+	// Used for re-probing the error bounds
+	if (submodel_idx != nullptr) {
+		for (uint32_t j=0; j<input_width(); ++j) {
+			submodel_idx[j] = submodels[j] - table;
+		}
+	}
+
+	// Return result
+	output = next_idx;
+}
+
+/**
+ * @brief Evaluate RQRMI models using fixed-point arithmetic
+ * @param[in] inputs a vector of inputs
+ * @param[out] status a vector of output status (1 valid, 0 error)
+ * @param[out] output a vector of outputs
+ * @param[out] error a vector of error values
+ */
+void RQRMIFastQuantized::evaluate(wide_scalar_t& inputs, wide_scalar_t& status, wide_scalar_t& output, wide_scalar_t& error) const {
+	if (_hidden_width == 8) {
+		evaluate_kernel<8>(inputs, status, output, error, nullptr);
+	} else {
+		evaluate_kernel<16>(inputs, status, output, error, nullptr);
+	}
+}
+
+/**
+ * @brief Sets the error of a submodel
+ */
+void RQRMIFastQuantized::set_error(uint32_t submodel_idx, uint32_t value) {
+	if (_hidden_width == 8) {
+		((quantized_submodel_t<8>*)_submodels)[submodel_idx].error = value;
+	} else {
+		((quantized_submodel_t<16>*)_submodels)[submodel_idx].error = value;
+	}
+}
+
+/**
+ * @brief Returns the error of a submodel
+ */
+uint32_t RQRMIFastQuantized::get_error(uint32_t submodel_idx) const {
+	if (_hidden_width == 8) {
+		return ((const quantized_submodel_t<8>*)_submodels)[submodel_idx].error;
+	} else {
+		return ((const quantized_submodel_t<16>*)_submodels)[submodel_idx].error;
+	}
+}
+
+/**
+ * @brief Evaluates the quantized model on probes, updates the required error per submodel
+ * @param probes The inputs to probe
+ * @param num_of_probes The number of inputs
+ * @param index The records indexed by the model (range start values, sorted)
+ * @param num_of_records The number of records indexed by the model
+ * @param[in,out] required The required error per submodel
+ * @param[out] route The last submodel per probe (RQRMI_INVALID_ROUTE for invalid outputs)
+ */
+void RQRMIFastQuantized::probe_errors(const scalar_t* probes, uint32_t num_of_probes,
+		const scalar_t* index, uint32_t num_of_records,
+		std::vector<int32_t>& required, uint32_t* route) const
+{
+	wide_scalar_t inputs, status, outputs, error;
+	uint32_t submodel_idx[SIMD_WIDTH];
+
+	for (uint32_t i=0; i<num_of_probes; i+=input_width()) {
+		uint32_t count = MIN(input_width(), num_of_probes-i);
+		for (uint32_t k=0; k<input_width(); ++k) {
+			inputs.scalars[k] = probes[i + (k<count ? k : 0)];
+		}
+
+		if (_hidden_width == 8) {
+			evaluate_kernel<8>(inputs, status, outputs, error, submodel_idx);
+		} else {
+			evaluate_kernel<16>(inputs, status, outputs, error, submodel_idx);
+		}
+
+		for (uint32_t k=0; k<count; ++k) {
+			route[i+k] = status.integers[k] ? submodel_idx[k] : RQRMI_INVALID_ROUTE;
+			if (!status.integers[k]) continue;
+			// Inputs smaller than the first record are not in database
+			scalar_t x = inputs.scalars[k];
+			if (x < index[0]) continue;
+			int record = std::upper_bound(index, index+num_of_records, x) - index - 1;
+			int position = outputs.scalars[k] * num_of_records;
+			required[submodel_idx[k]] = MAX(required[submodel_idx[k]], abs(position - record));
+		}
+	}
+}
+
+/**
+ * @brief Re-probes the error bounds of all last-stage submodels using the quantized model.
+ *        Probes the records boundaries, the trigger inputs of the original model,
+ *        and the inputs in which the quantized model switches between submodels.
+ *        Error bounds are only widened, never tightened.
+ * @param index The records indexed by the model (range start values, sorted)
+ * @param num_of_records The number of records indexed by the model
+ * @returns The maximal number of positions added to the error of a submodel
+ */
+uint32_t RQRMIFastQuantized::validate_error_bounds(const scalar_t* index, uint32_t num_of_records) {
+
+	if (num_of_records == 0) return 0;
+
+	// Probe the first and last input of each record
+	std::vector<scalar_t> probes = _probes;
+	for (uint32_t i=0; i<num_of_records; ++i) {
+		probes.push_back(index[i]);
+		if (i+1 < num_of_records) {
+			probes.push_back(SCALAR_PREV(index[i+1]));
+		}
+	}
+	std::sort(probes.begin(), probes.end());
+	probes.erase(std::unique(probes.begin(), probes.end()), probes.end());
+
+	// The required error per submodel (-1 for submodels that were not probed)
+	std::vector<int32_t> required(_total_submodels, -1);
+	std::vector<uint32_t> route(probes.size());
+	probe_errors(probes.data(), probes.size(), index, num_of_records, required, route.data());
+
+	// The quantized model switches between submodels at slightly different inputs
+	// than the original model. Find these inputs using bisection (a vector at a time).
+	std::vector<scalar_t> low, high;
+	for (uint32_t i=0; i+1<probes.size(); ++i) {
+		if (route[i] != route[i+1]) {
+			low.push_back(probes[i]);
+			high.push_back(probes[i+1]);
+		}
+	}
+
+	std::vector<scalar_t> mid(input_width());
+	std::vector<uint32_t> mid_route(input_width()), low_route(input_width());
+	for (uint32_t i=0; i<low.size(); i+=input_width()) {
+		uint32_t count = MIN(input_width(), low.size()-i);
+		probe_errors(&low[i], count, index, num_of_records, required, low_route.data());
+		bool done = false;
+		while (!done) {
+			done = true;
+			for (uint32_t k=0; k<count; ++k) {
+				mid[k] = low[i+k] + (high[i+k] - low[i+k]) / 2;
+				// Converged, the probes are adjacent floats
+				if (mid[k] <= low[i+k] || mid[k] >= high[i+k]) {
+					mid[k] = low[i+k];
+				} else {
+					done = false;
+				}
+			}
+			probe_errors(mid.data(), count, index, num_of_records, required, mid_route.data());
+			for (uint32_t k=0; k<count; ++k) {
+				if (mid_route[k] == low_route[k]) {
+					low[i+k] = mid[k];
+				} else {
+					high[i+k] = mid[k];
+				}
+			}
+		}
+		probe_errors(&high[i], count, index, num_of_records, required, mid_route.data());
+	}
+
+	// Widen the error of the submodels
+	uint32_t output = 0;
+	uint32_t widened = 0;
+	for (uint32_t i=0; i<_total_submodels; ++i) {
+		if (required[i] < 0) continue;
+		uint32_t original = get_error(i);
+		uint32_t value = required[i] + QUANTIZED_ERROR_MARGIN;
+		if (value > original) {
+			set_error(i, value);
+			output = MAX(output, value - original);
+			++widened;
+		}
+	}
+
+	info("RQRMIFastQuantized: widened the error of " << widened << " submodels by up to "
+			<< output << " positions (" << probes.size() << " probes, "
+			<< low.size() << " transitions)");
+
+	// Probes are no longer required
+	std::vector<scalar_t>().swap(_probes);
+	return output;
+}
@@ -459,13 +459,15 @@ class RQRMI:
         N = len(bucket_indices)
         output_buckets = [None for _ in range(N)]
 
+        # Generate samples for all models in parallel.
+        # Note: max_record parameter in create_dataset is exclusive
+        # Random: false, Shuffle: true
+        datasets = rqrmilib.create_datasets(self.probe, False, True, stage_idx, list(bucket_indices), num_of_samples)
+
         for i, submodel_idx in enumerate(bucket_indices):
 
-            # Generate samples for the current model.
-            # Note: max_record parameter in create_dataset is exclusive
-            # Random: false, Shuffle: true
-            bucket = rqrmilib.create_dataset(self.probe, False, True, stage_idx, submodel_idx, num_of_samples)
-            bucket = _native_matrix_2_numpy(bucket)
+            bucket = _native_matrix_2_numpy(datasets[i])
+            datasets[i] = None
 
             if bucket.shape[0] == 0:
                 output_buckets[i] = np.empty([0,2])
@@ -533,6 +535,65 @@ class RQRMI:
         self[stage_idx] = net_list
 
 
+    def train_stage_native(self, stage_idx, structure, submodel_indices, num_of_samples, epochs, batch_size,
+                           learning_rate=1e-3, num_of_threads=0, verbose=0):
+        """ Trains a single stage of an RQRMI model using the native trainer (Adam, on worker threads).
+            Generates the datasets of the submodels natively, without Python buckets.
+
+        Args:
+            stage_idx: The index of the stage to train
+            structure: A list of integers, the stage's NN layer structure. Must be [1, W, 1].
+            submodel_indices: Which submodels to train within stage
+            num_of_samples: The number of samples per submodel
+            epochs: Number of epochs to train.
+            batch_size: Batch-size for training.
+            learning_rate: The learning rate of the optimizer
+            num_of_threads: The number of training threads (0 for all available cores)
+            verbose: Verbosity
+
+        Throws:
+            ValueError in case the structure is not supported
+            RuntimeError in case of library error
+        """
+
+        if len(structure) != 3 or structure[0] != 1 or structure[-1] != 1:
+            raise ValueError('Native trainer supports [1, W, 1] structures only. Got %s' % structure)
+
+        _log(verbose, 'Training RQRMI stage %d with structure %s (native) \n' % (stage_idx, structure))
+
+        # In case of new stage, create a placeholder for nets
+        if stage_idx == len(self):
+            self.append([None for _ in range(self.stage_width_list[stage_idx])])
+
+        net_list = self[stage_idx]
+        submodel_indices = [int(x) for x in submodel_indices]
+
+        time_start = datetime.datetime.now()
+        trained = rqrmilib.train_stage(self.probe, stage_idx, submodel_indices, num_of_samples, epochs,
+                                       batch_size, learning_rate, structure[1], num_of_threads)
+        time_diff = (datetime.datetime.now() - time_start).total_seconds()
+
+        for submodel_idx, submodel in zip(submodel_indices, trained):
+            # Skip submodels with no input data
+            if submodel is None:
+                _log(verbose, 'Skipping submodel <%d,%d>, no inputs\n' % (stage_idx, submodel_idx))
+                continue
+
+            # Convert to the format of _nn_train_net
+            mu, sig, fac, omin, (b0, b1, w1, b2, w2) = submodel
+            net = [np.array([b0], dtype=np.float32),
+                   np.array(b1, dtype=np.float32),
+                   np.array(w1, dtype=np.float32).reshape([1, -1]),
+                   np.array([b2], dtype=np.float32),
+                   np.array(w2, dtype=np.float32).reshape([-1, 1])]
+            net_list[submodel_idx] = (mu, sig, fac, omin, net)
+
+        _log(verbose, 'Trained %d submodels (training time: %.3f sec) \n' % (len(submodel_indices), time_diff))
+
+        # Update this
+        self[stage_idx] = net_list
+
+
     def calculate_transition_set(self, stage_idx, verbose=0):
         """ Calculates the transition set U_i for a given stage s_i
 
@@ -22,8 +22,10 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <assert.h>
+#include <x86intrin.h>
 
 #include <rqrmi_model.h>
 
@@ -75,6 +77,28 @@ struct rqrmi_stage {
 	rqrmi_submodel_t* models;
 };
 
+/**
+ * @brief Flat parameters of an RQRMI submodel, used for batched evaluation.
+ *        Hidden layers narrower than RQRMI_MAX_HIDDEN_WIDTH are zero padded.
+ */
+typedef struct {
+	scalar_t w1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t b1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t w2[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t w0;
+	scalar_t b0;
+	scalar_t b2;
+	scalar_t input_mean;
+	scalar_t input_stddev;
+	scalar_t output_factor;
+	scalar_t output_min;
+	uint32_t compiled;
+} rqrmi_batch_submodel_t;
+
+// Offsets of fields in rqrmi_batch_submodel_t (in scalars), used for gathers
+#define BATCH_SUBMODEL_STRIDE (sizeof(rqrmi_batch_submodel_t)/sizeof(scalar_t))
+#define BATCH_FIELD(field) (offsetof(rqrmi_batch_submodel_t, field)/sizeof(scalar_t))
+
 struct rqrmi_model {
 	uint32_t num_of_stages;
 	scalar_t input_domain_min;
@@ -88,9 +112,15 @@ struct rqrmi_model {
 	// Scratchpads for matrix evaluation
 	void* scratchpads;
 	uint32_t scratchpad_size;
+
+	// Flat submodels for batched evaluation (all stages), NULL when not RQRMI
+	rqrmi_batch_submodel_t* batch_submodels;
+	uint32_t* batch_stage_offset;
+	uint32_t batch_hidden_width;
 };
 
 // Local Methods
+void build_batch_submodels(rqrmi_model_t* rqrmi_model);
 int load_submodel(rqrmi_model_t* rqrmi_model, uint32_t stage_index, uint32_t model_index, void** ptr, int* size);
 void free_model(rqrmi_model_t* rqrmi_model, uint32_t stage_index, uint32_t model_index);
 scalar_t rqrmi_submodel_preprocess_input(rqrmi_submodel_t* submodel, scalar_t input);
@@ -170,7 +200,6 @@ matrix_t* rqrmi_evaluate_sub_model(rqrmi_model_t* rqrmi_model, rqrmi_submodel_t*
 	// References to scratchpads
 	matrix_t* sp_0 = (matrix_t*)((char*)rqrmi_model->scratchpads);
 	matrix_t* sp_1 = (matrix_t*)((char*)rqrmi_model->scratchpads + rqrmi_model->scratchpad_size);
-	matrix_t* sp_2 = (matrix_t*)((char*)rqrmi_model->scratchpads + 2*rqrmi_model->scratchpad_size);
 
 	matrix_t* current = rqrmi_model->input_placeholder;
 
@@ -183,21 +212,10 @@ matrix_t* rqrmi_evaluate_sub_model(rqrmi_model_t* rqrmi_model, rqrmi_submodel_t*
 	model_info("Input for submodel after preprocessing: " << GET_SCALAR(current, 0, 0));
 
 	for (uint32_t i=0; i<submodel->num_of_layers; ++i) {
-		// Multiply with weights
-		mat_mul(current, submodel->weights[i], sp_0);
-
-		// Add bias
-		mat_op(sp_0, submodel->biases[i], op_add, sp_1);
-
-		// In case of no activation
-		if (submodel->activations[i] == OPERATION_BYPASS) {
-			current = sp_1;
-			continue;
-		}
-
-		// Enable activation
-		mat_unary_op(sp_1, submodel->activations[i], sp_2);
-		current = sp_2;
+		// Multiply with weights, add bias, and enable activation (if any)
+		matrix_t* next = (current == sp_0) ? sp_1 : sp_0;
+		mat_mul_bias_op(current, submodel->weights[i], submodel->biases[i], submodel->activations[i], next);
+		current = next;
 	}
 
 	// Return the original input value
@@ -249,6 +267,223 @@ scalar_t rqrmi_evaluate_model(rqrmi_model_t* rqrmi_model, scalar_t input) {
 	return out_scalar;
 }
 
+/**
+ * @brief Copies the submodels of an RQRMI model to a flat array for batched evaluation.
+ *        Models with submodels that are not RQRMI (1 x W x 1) are left without one.
+ * @param rqrmi_model The RQRMI model
+ */
+void build_batch_submodels(rqrmi_model_t* rqrmi_model) {
+
+	uint32_t num_of_stages = rqrmi_model->num_of_stages;
+	uint32_t total_submodels = 0;
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		total_submodels += rqrmi_model->stages[s].num_of_models;
+	}
+
+	rqrmi_batch_submodel_t* submodels = (rqrmi_batch_submodel_t*)malloc(sizeof(rqrmi_batch_submodel_t) * total_submodels);
+	uint32_t* stage_offset = (uint32_t*)malloc(sizeof(uint32_t) * num_of_stages);
+	if (submodels == NULL || stage_offset == NULL) {
+		free(submodels);
+		free(stage_offset);
+		throw error("cannot allocate memory for batched evaluation");
+	}
+
+	uint32_t idx = 0, hidden_width = 0;
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		stage_offset[s] = idx;
+		for (uint32_t m=0; m<rqrmi_model->stages[s].num_of_models; ++m, ++idx) {
+			rqrmi_submodel_info_t info;
+			if (!rqrmi_get_submodel_info(rqrmi_model, s, m, &info)) {
+				model_info("Submodel <" << s << "," << m << "> is not RQRMI, batched evaluation is disabled");
+				free(submodels);
+				free(stage_offset);
+				return;
+			}
+			rqrmi_batch_submodel_t* current = &submodels[idx];
+			for (uint32_t k=0; k<RQRMI_MAX_HIDDEN_WIDTH; ++k) {
+				current->w1[k] = info.w1[k];
+				current->b1[k] = info.b1[k];
+				current->w2[k] = info.w2[k];
+			}
+			current->w0 = info.w0;
+			current->b0 = info.b0;
+			current->b2 = info.b2;
+			current->input_mean = info.input_mean;
+			current->input_stddev = info.input_stddev;
+			current->output_factor = info.output_factor;
+			current->output_min = info.output_min;
+			current->compiled = info.compiled;
+			hidden_width = MAX(hidden_width, info.hidden_width);
+		}
+	}
+
+	rqrmi_model->batch_submodels = submodels;
+	rqrmi_model->batch_stage_offset = stage_offset;
+	rqrmi_model->batch_hidden_width = hidden_width;
+}
+
+// The batched evaluation reproduces the rounding of the generic evaluation: with FMA, mat_mul
+// fuses its dot product, the compiler fuses the output post-processing, and nothing else.
+// Contraction is disabled here, and the fused operations are explicit.
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+
+#ifdef __FMA__
+#  define GENERIC_MUL_ADD(a, b, c) fmaf(a, b, c)
+#  define GENERIC_MUL_ADD256(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#  define GENERIC_MUL_ADD(a, b, c) ((a)*(b)+(c))
+#  define GENERIC_MUL_ADD256(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+/**
+ * @brief Evaluates a single input using the flat submodels.
+ *        Performs the same operations in the same order as rqrmi_evaluate_model.
+ * @returns The output of the model, sets the last stage submodel index
+ * @note Might throw exceptions
+ */
+static scalar_t evaluate_batch_scalar(rqrmi_model_t* rqrmi_model, scalar_t input, uint32_t* submodel_idx) {
+	scalar_t out_scalar = 0;
+	uint32_t next_submodel = 0;
+	for(uint32_t i=0; i<rqrmi_model->num_of_stages; ++i) {
+		next_submodel = (out_scalar < 0 ? 0 : out_scalar >= 1 ? 1-SCALAR_EPS : out_scalar) * rqrmi_model->stages[i].num_of_models;
+		const rqrmi_batch_submodel_t* submodel = &rqrmi_model->batch_submodels[rqrmi_model->batch_stage_offset[i] + next_submodel];
+		if (!submodel->compiled) {
+			throw error("requested to run submodel <" << i << "," << next_submodel << "> which is not compiled. "
+					"input: " << input);
+		}
+
+		scalar_t x = (input-submodel->input_mean)/submodel->input_stddev;
+		x = x * submodel->w0 + submodel->b0;
+		scalar_t sum = 0;
+		for (uint32_t k=0; k<rqrmi_model->batch_hidden_width; ++k) {
+			scalar_t hidden = x * submodel->w1[k] + submodel->b1[k];
+			hidden = hidden > 0 ? hidden : 0;
+			sum = GENERIC_MUL_ADD(hidden, submodel->w2[k], sum);
+		}
+		sum = sum + submodel->b2;
+		out_scalar = GENERIC_MUL_ADD(sum, submodel->output_factor, submodel->output_min);
+	}
+	*submodel_idx = next_submodel;
+	return out_scalar<0 ? 0 : out_scalar>=1 ? 1 - SCALAR_EPS : out_scalar;
+}
+
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+/**
+ * @brief Evaluates 8 inputs using the flat submodels. Each lane gathers the parameters
+ *        of its own submodel. Performs the same operations in the same order as
+ *        rqrmi_evaluate_model, so the outputs are identical.
+ * @note Might throw exceptions
+ */
+static void evaluate_batch_avx2(rqrmi_model_t* rqrmi_model, const scalar_t* input,
+		scalar_t* output, uint32_t* submodel_idx)
+{
+	const float* base = (const float*)rqrmi_model->batch_submodels;
+	const __m256i stride = _mm256_set1_epi32(BATCH_SUBMODEL_STRIDE);
+	const __m256 zeros = _mm256_setzero_ps();
+	const __m256 ones = _mm256_set1_ps(1);
+	const __m256 max_output = _mm256_set1_ps(1-SCALAR_EPS);
+
+	__m256 inputs = _mm256_loadu_ps(input);
+	__m256 out = zeros;
+	__m256i next_submodel = _mm256_setzero_si256();
+
+	for(uint32_t i=0; i<rqrmi_model->num_of_stages; ++i) {
+
+		// Route each lane by the output of the previous stage
+		__m256 clamped = _mm256_blendv_ps(out, max_output, _mm256_cmp_ps(out, ones, _CMP_GE_OQ));
+		clamped = _mm256_blendv_ps(clamped, zeros, _mm256_cmp_ps(out, zeros, _CMP_LT_OQ));
+		next_submodel = _mm256_cvttps_epi32(_mm256_mul_ps(clamped,
+				_mm256_set1_ps((scalar_t)rqrmi_model->stages[i].num_of_models)));
+
+		// Offsets (in scalars) of the submodels of all lanes
+		__m256i offset = _mm256_mullo_epi32(_mm256_add_epi32(next_submodel,
+				_mm256_set1_epi32(rqrmi_model->batch_stage_offset[i])), stride);
+
+		// Check that all submodels are compiled
+		__m256i compiled = _mm256_i32gather_epi32((const int*)base,
+				_mm256_add_epi32(offset, _mm256_set1_epi32(BATCH_FIELD(compiled))), 4);
+		if (!_mm256_testz_si256(_mm256_cmpeq_epi32(compiled, _mm256_setzero_si256()), _mm256_set1_epi32(-1))) {
+			uint32_t lane_compiled[8], lane_submodel[8];
+			_mm256_storeu_si256((__m256i*)lane_compiled, compiled);
+			_mm256_storeu_si256((__m256i*)lane_submodel, next_submodel);
+			for (uint32_t k=0; k<8; ++k) {
+				if (lane_compiled[k]) continue;
+				throw error("requested to run submodel <" << i << "," << lane_submodel[k] << "> which is not compiled. "
+						"input: " << input[k]);
+			}
+		}
+
+		#define GATHER(field) _mm256_i32gather_ps(base, \
+				_mm256_add_epi32(offset, _mm256_set1_epi32(BATCH_FIELD(field))), 4)
+
+		__m256 x = _mm256_div_ps(_mm256_sub_ps(inputs, GATHER(input_mean)), GATHER(input_stddev));
+		x = _mm256_add_ps(_mm256_mul_ps(x, GATHER(w0)), GATHER(b0));
+		__m256 sum = zeros;
+		for (uint32_t k=0; k<rqrmi_model->batch_hidden_width; ++k) {
+			__m256i offset_k = _mm256_add_epi32(offset, _mm256_set1_epi32(k));
+			__m256 w1 = _mm256_i32gather_ps(base, _mm256_add_epi32(offset_k, _mm256_set1_epi32(BATCH_FIELD(w1))), 4);
+			__m256 b1 = _mm256_i32gather_ps(base, _mm256_add_epi32(offset_k, _mm256_set1_epi32(BATCH_FIELD(b1))), 4);
+			__m256 w2 = _mm256_i32gather_ps(base, _mm256_add_epi32(offset_k, _mm256_set1_epi32(BATCH_FIELD(w2))), 4);
+			__m256 hidden = _mm256_add_ps(_mm256_mul_ps(x, w1), b1);
+			hidden = _mm256_blendv_ps(zeros, hidden, _mm256_cmp_ps(hidden, zeros, _CMP_GT_OQ)); // ReLU
+			sum = GENERIC_MUL_ADD256(hidden, w2, sum);
+		}
+		sum = _mm256_add_ps(sum, GATHER(b2));
+		out = GENERIC_MUL_ADD256(sum, GATHER(output_factor), GATHER(output_min));
+
+		#undef GATHER
+	}
+
+	__m256 clamped = _mm256_blendv_ps(out, max_output, _mm256_cmp_ps(out, ones, _CMP_GE_OQ));
+	clamped = _mm256_blendv_ps(clamped, zeros, _mm256_cmp_ps(out, zeros, _CMP_LT_OQ));
+	_mm256_storeu_ps(output, clamped);
+	if (submodel_idx) {
+		_mm256_storeu_si256((__m256i*)submodel_idx, next_submodel);
+	}
+}
+#endif
+
+#pragma GCC pop_options
+
+/**
+ * @brief Feed the RQRMI model with a batch of inputs
+ * @param rqrmi_model The RQRMI model
+ * @param inputs The inputs to feed to the model
+ * @param[out] outputs The outputs of the model
+ * @param[out] submodel_idx The submodel of the last stage used per input, may be NULL
+ * @param num_of_inputs The number of inputs
+ * @note Might throw exceptions
+ * @note The outputs are identical to those of rqrmi_evaluate_model
+ */
+void rqrmi_evaluate_model_batch(rqrmi_model_t* rqrmi_model, const scalar_t* inputs, scalar_t* outputs,
+		uint32_t* submodel_idx, size_t num_of_inputs)
+{
+	size_t i = 0;
+
+	// Models with general submodels (RMI) are evaluated one input at a time
+	if (rqrmi_model->batch_submodels == NULL) {
+		for (; i<num_of_inputs; ++i) {
+			outputs[i] = rqrmi_evaluate_model(rqrmi_model, inputs[i]);
+			if (submodel_idx) submodel_idx[i] = rqrmi_model->last_model;
+		}
+		return;
+	}
+
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+	for (; i+8<=num_of_inputs; i+=8) {
+		evaluate_batch_avx2(rqrmi_model, &inputs[i], &outputs[i], submodel_idx ? &submodel_idx[i] : NULL);
+	}
+#endif
+
+	// Handle the remainder
+	for (; i<num_of_inputs; ++i) {
+		uint32_t idx;
+		outputs[i] = evaluate_batch_scalar(rqrmi_model, inputs[i], &idx);
+		if (submodel_idx) submodel_idx[i] = idx;
+	}
+}
+
 /**
  * @brief Loads a RQRMI model
  * @param ptr A cursor for reading the data
@@ -279,6 +514,9 @@ rqrmi_model_t* rqrmi_load_model(void* ptr, int size) {
 		rqrmi_model->scratchpads = NULL;
 		rqrmi_model->error_list = NULL;
 		rqrmi_model->stages = MATRIX_ERROR;
+		rqrmi_model->batch_submodels = NULL;
+		rqrmi_model->batch_stage_offset = NULL;
+		rqrmi_model->batch_hidden_width = 0;
 
 		// Read the input domain
 		rqrmi_model->input_domain_min = safe_buffer_read(scalar_t, ptr, size);
@@ -320,7 +558,7 @@ rqrmi_model_t* rqrmi_load_model(void* ptr, int size) {
 
 			// Build the model array
 			rqrmi_model->stages[i].num_of_models = num_of_models;
-			rqrmi_model->stages[i].models = (rqrmi_submodel_t*)malloc(sizeof(rqrmi_submodel_t) * num_of_models);
+			rqrmi_model->stages[i].models = (rqrmi_submodel_t*)calloc(num_of_models, sizeof(rqrmi_submodel_t));
 
 			// Try to load each submodel
 			for (uint32_t j=0; j<num_of_models; ++j) {
@@ -368,6 +606,9 @@ rqrmi_model_t* rqrmi_load_model(void* ptr, int size) {
 			sp->elements = (void*)( (char*)sp + sizeof(matrix_t) );
 		}
 
+		// Prepare the submodels for batched evaluation
+		build_batch_submodels(rqrmi_model);
+
 		// Log total bytes read
 		info("Finished loading RQRMI model from memory. Total bytes read: " << ((uint64_t)ptr - (uint64_t)orig_ptr));
 
@@ -418,6 +659,7 @@ int load_submodel(rqrmi_model_t* rqrmi_model, uint32_t stage_index, uint32_t mod
 		case 0:
 			submodel->biases = MATRIX_ERROR;
 			submodel->weights = MATRIX_ERROR;
+			submodel->activations = NULL;
 			submodel->num_of_layers = 0;
 			info("Submodel <" << stage_index << "," << model_index << "> is not compiled, skipping read");
 
@@ -478,6 +720,11 @@ int load_submodel(rqrmi_model_t* rqrmi_model, uint32_t stage_index, uint32_t mod
 		warning("Cannot allocate memory for model <" << stage_index << "," << model_index << ">");
 		free(submodel->biases);
 		free(submodel->weights);
+		free(submodel->activations);
+		submodel->biases = MATRIX_ERROR;
+		submodel->weights = MATRIX_ERROR;
+		submodel->activations = NULL;
+		submodel->num_of_layers = 0;
 		return MODEL_OP_ERROR;
 	}
 
@@ -758,6 +1005,7 @@ vector_list_t* rqrmi_calculate_transition_inputs(rqrmi_model_t* rqrmi_model, uin
 		transition_inputs = VECTOR_LIST_ERROR;
 	}
 
+	free_matrix(trigger_inputs);
 	return transition_inputs;
 }
 
@@ -784,9 +1032,56 @@ void rqrmi_free_model(rqrmi_model_t* rqrmi_model) {
 	free(rqrmi_model->stages);
 	free(rqrmi_model->scratchpads);
 	free(rqrmi_model->error_list);
+	free(rqrmi_model->batch_submodels);
+	free(rqrmi_model->batch_stage_offset);
 	free(rqrmi_model);
 }
 
+/**
+ * @brief Creates a model that shares the submodels of another model, with its own
+ *        input placeholder and scratchpads. Forks of a model can be evaluated concurrently.
+ * @param rqrmi_model The RQRMI model
+ * @returns The fork, or RQRMI_MODEL_ERROR in case of an error
+ * @note The fork is valid as long as the original model is. Free with rqrmi_free_fork.
+ */
+rqrmi_model_t* rqrmi_fork_model(rqrmi_model_t* rqrmi_model) {
+
+	rqrmi_model_t* fork = (rqrmi_model_t*)malloc(sizeof(rqrmi_model_t));
+	if (fork == NULL) {
+		warning("Cannot allocate memory for RQRMI model fork");
+		return RQRMI_MODEL_ERROR;
+	}
+
+	// Share the stages and error list, allocate private evaluation memory
+	*fork = *rqrmi_model;
+	fork->input_placeholder = new_matrix(1,1);
+	fork->scratchpads = malloc(NUM_OF_SCRATCPADS*fork->scratchpad_size);
+	if (fork->input_placeholder == MATRIX_ERROR || fork->scratchpads == NULL) {
+		warning("Cannot allocate memory for RQRMI model fork");
+		rqrmi_free_fork(fork);
+		return RQRMI_MODEL_ERROR;
+	}
+
+	// Set scratchpads elements reference
+	for (int i=0; i<NUM_OF_SCRATCPADS;++i) {
+		matrix_t* sp = (matrix_t*)( (char*)fork->scratchpads + i*fork->scratchpad_size);
+		sp->elements = (void*)( (char*)sp + sizeof(matrix_t) );
+	}
+
+	return fork;
+}
+
+/**
+ * @brief Frees the memory allocated for a fork of an RQRMI model
+ * @param fork A fork created by rqrmi_fork_model
+ */
+void rqrmi_free_fork(rqrmi_model_t* fork) {
+	if (fork == NULL) return;
+	free_matrix(fork->input_placeholder);
+	free(fork->scratchpads);
+	free(fork);
+}
+
 /**
  * @brief Frees the memory allocated for a model
  * @param rqrmi_model The RQRMI model
@@ -809,6 +1104,9 @@ void free_model(rqrmi_model_t* rqrmi_model, uint32_t stage_index, uint32_t model
 		free_matrix(model->biases[k]);
 		free_matrix(model->weights[k]);
 	}
+	free(model->biases);
+	free(model->weights);
+	free(model->activations);
 
 	model_info("Free submodel <" << stage_index << "," << model_index << ">: Done");
 }
@@ -941,6 +1239,7 @@ uint32_t rqrmi_get_submodel_info(rqrmi_model_t* rqrmi_model, uint32_t stage_idx,
 		output->output_min = 1;
 		output->input_mean = 1;
 		output->input_stddev = 1;
+		output->hidden_width = 0;
 		output->error = 0;
 		// Submodel is not compiled
 		output->compiled = 0;
@@ -950,7 +1249,7 @@ uint32_t rqrmi_get_submodel_info(rqrmi_model_t* rqrmi_model, uint32_t stage_idx,
 	// Validate RQRMI size
 	if ( submodel->num_of_layers != 3 ||
 		 submodel->biases[0]->cols != 1 ||
-		 submodel->biases[1]->cols != 8 ||
+		 submodel->biases[1]->cols > RQRMI_MAX_HIDDEN_WIDTH ||
 		 submodel->biases[2]->cols != 1 )
 	{
 		info("input is not valid RQRMI model (maybe RMI?)");
@@ -959,13 +1258,16 @@ uint32_t rqrmi_get_submodel_info(rqrmi_model_t* rqrmi_model, uint32_t stage_idx,
 
 	// Copy info
 	output->compiled = 1;
+	output->hidden_width = submodel->biases[1]->cols;
 	output->b0 = GET_SCALAR(submodel->biases[0], 0, 0);
 	output->w0 = GET_SCALAR(submodel->weights[0], 0, 0);
 
-	for (uint32_t k=0; k<8; ++k) {
-		output->b1[k] = GET_SCALAR(submodel->biases[1], 0 ,k);
-		output->w1[k] = GET_SCALAR(submodel->weights[1], 0 ,k);
-		output->w2[k] = GET_SCALAR(submodel->weights[2], k ,0);
+	// Neurons with zero weights do not affect the output
+	for (uint32_t k=0; k<RQRMI_MAX_HIDDEN_WIDTH; ++k) {
+		bool valid = k < output->hidden_width;
+		output->b1[k] = valid ? GET_SCALAR(submodel->biases[1], 0 ,k) : 0;
+		output->w1[k] = valid ? GET_SCALAR(submodel->weights[1], 0 ,k) : 0;
+		output->w2[k] = valid ? GET_SCALAR(submodel->weights[2], k ,0) : 0;
 	}
 	output->b2 = GET_SCALAR(submodel->biases[2], 0 ,0);
 	output->output_factor = submodel->output_factor;
@@ -26,6 +26,13 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <random>
+#include <thread>
+#include <vector>
+
 #include <basic_types.h>
 #include <matrix_operations.h>
 #include <rqrmi_tools.h>
@@ -53,11 +60,104 @@ struct rqrmi_probing {
 	matrix_t*			records;
 	vector_list_t***	responsibilities;
 	vector_list_t**		transition_sets;
+	vector_arena_t*		arena;				// Memory of all lists of the probe
+};
+
+// A record sampled by a dataset, and the input range it is sampled from
+typedef struct {
+	scalar_t start;
+	scalar_t end;
+	uint32_t record_idx;
+	uint32_t num_of_samples;
+} dataset_marker_t;
+
+// Generates the samples of a bucket on demand from its sampling plan
+struct rqrmi_dataset_stream {
+	std::vector<dataset_marker_t> markers;
+	std::vector<uint32_t> offsets;				// The first sample of each marker
+	std::vector<uint32_t> sample_markers;		// The marker of each sample
+	std::vector<uint32_t> permutation;			// The order of the samples, empty when not shuffled
+	uint32_t num_of_samples;
+	uint32_t cursor;
+	bool random;
+	uint32_t seed;
 };
 
 // Private methods
 void print_responsibility(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_index);
-vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx);
+vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		vector_arena_t* arena);
+
+// The number of threads used for probing the model, 0 for all available cores
+static uint32_t tools_num_of_threads = 0;
+
+/**
+ * @brief Sets the number of threads used for calculating transition sets and responsibilities
+ * @param num_of_threads The number of threads, 0 for all available cores
+ */
+void rqrmi_tools_set_num_of_threads(uint32_t num_of_threads) {
+	tools_num_of_threads = num_of_threads;
+}
+
+/**
+ * @brief Runs a method over disjoint ranges of [0, num_of_items) using a pool of threads.
+ *        Threads take ranges of grain items dynamically, so uneven work is balanced.
+ *        Each thread evaluates its own fork of the model, as model evaluation is not reentrant.
+ * @param model An RQRMI model, RQRMI_MODEL_ERROR in case the method does not evaluate a model
+ * @param num_of_items The number of items to process
+ * @param grain The number of items in each range
+ * @param method Invoked with (model, start, end) per range
+ * @throws The first exception thrown by any of the threads
+ */
+template <typename F>
+static void parallel_for_ranges(rqrmi_model_t* model, uint32_t num_of_items, uint32_t grain, F method) {
+
+	uint32_t num_of_ranges = (num_of_items + grain - 1) / grain;
+	uint32_t num_of_threads = tools_num_of_threads ? tools_num_of_threads : std::thread::hardware_concurrency();
+
+	// Debug builds print submodel information without locking the logger
+#ifndef NDEBUG
+	num_of_threads = 1;
+#endif
+
+	num_of_threads = MIN(num_of_threads, num_of_ranges);
+	if (num_of_threads <= 1) {
+		if (num_of_items > 0) method(model, 0, num_of_items);
+		return;
+	}
+
+	std::atomic<uint32_t> next_range(0);
+	std::vector<std::exception_ptr> errors(num_of_threads);
+	std::vector<std::thread> threads;
+
+	for (uint32_t t=0; t<num_of_threads; ++t) {
+		threads.push_back(std::thread([&, t]() {
+			rqrmi_model_t* fork = RQRMI_MODEL_ERROR;
+			try {
+				if (model != RQRMI_MODEL_ERROR) {
+					fork = rqrmi_fork_model(model);
+					if (fork == RQRMI_MODEL_ERROR) {
+						throw error("cannot fork RQRMI model");
+					}
+				}
+				for (uint32_t r = next_range++; r < num_of_ranges; r = next_range++) {
+					method(fork, r*grain, MIN((r+1)*grain, num_of_items));
+				}
+			} catch (...) {
+				errors[t] = std::current_exception();
+				next_range = num_of_ranges;
+			}
+			rqrmi_free_fork(fork);
+		}));
+	}
+
+	for (uint32_t t=0; t<num_of_threads; ++t) {
+		threads[t].join();
+	}
+	for (uint32_t t=0; t<num_of_threads; ++t) {
+		if (errors[t]) std::rethrow_exception(errors[t]);
+	}
+}
 
 /**
  * @brief Generates an RQRMI probing data structure.
@@ -89,8 +189,11 @@ rqrmi_probing_t* rqrmi_tools_probe_new(matrix_t* records, uint32_t stage_num, ui
 		output->responsibilities=(vector_list_t***)malloc(sizeof(vector_list_t**)*stage_num);
 		output->transition_sets=(vector_list_t**)malloc(sizeof(vector_list_t*)*stage_num);
 		output->stage_width=(uint32_t*)malloc(sizeof(uint32_t)*stage_num);
+		output->arena=vector_arena_create();
 
-		if (output->responsibilities == NULL || output->transition_sets == NULL || output->stage_width == NULL) {
+		if (output->responsibilities == NULL || output->transition_sets == NULL ||
+			output->stage_width == NULL || output->arena == VECTOR_ARENA_ERROR)
+		{
 			throw error("Cannot allocate memory for probe caches");
 		}
 
@@ -113,7 +216,7 @@ rqrmi_probing_t* rqrmi_tools_probe_new(matrix_t* records, uint32_t stage_num, ui
 		}
 
 		// Create responsibility of stage 0 (always true by definition)
-		output->responsibilities[0][0] = vector_list_create(2);
+		output->responsibilities[0][0] = vector_list_create_in_arena(2, output->arena);
 		if (output->responsibilities[0][0] == VECTOR_LIST_ERROR) {
 			throw error("Cannot allocate memory for responsibility of stage 0");
 		}
@@ -132,6 +235,7 @@ rqrmi_probing_t* rqrmi_tools_probe_new(matrix_t* records, uint32_t stage_num, ui
 		free(output->responsibilities);
 		free(output->transition_sets);
 		free(output->stage_width);
+		vector_arena_free(output->arena);
 		free(output);
 		output = RQRMI_PROBING_ERROR;
 	}
@@ -144,14 +248,11 @@ rqrmi_probing_t* rqrmi_tools_probe_new(matrix_t* records, uint32_t stage_num, ui
  */
 void rqrmi_tools_probe_free(rqrmi_probing_t* probe) {
 	if (probe == RQRMI_PROBING_ERROR) return;
-	// Free responsibilities caches
+	// Free responsibilities caches, the lists are freed with the arena
 	for (uint32_t i=0; i<probe->num_of_stages; ++i) {
-		for (uint32_t j=0; j<probe->stage_width[i]; ++j) {
-			vector_list_free(probe->responsibilities[i][j]);
-		}
 		free(probe->responsibilities[i]);
-		vector_list_free(probe->transition_sets[i]);
 	}
+	vector_arena_free(probe->arena);
 	// Free  pointers
 	free(probe->stage_width);
 	free(probe->responsibilities);
@@ -169,11 +270,10 @@ void rqrmi_tools_probe_free(rqrmi_probing_t* probe) {
  * @note  The responsibility of stage stage_idx must be defined prior to this method
  * @note  The transition set is an ordered vector list and stored at the probe data structure
  * 		  Vector format: [ x,  B_i( M_i(x-epsilon) ),  B_i( M_i(x+epsilon) ) ]
+ * @note  The transition inputs of the submodels are calculated in parallel
  */
 vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_probing_t* probe, uint32_t stage_idx) {
 
-	vector_list_t* transition_inputs = VECTOR_LIST_ERROR;
-
 	info("Calculating U_" << stage_idx << "...");
 
 	try {
@@ -185,7 +285,7 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
 
 		// Create the transition set vector list
 		// Format: [ x,  B(M(x-eps)),  B(M(x+eps)) ]
-		probe->transition_sets[stage_idx] = vector_list_create(3);
+		probe->transition_sets[stage_idx] = vector_list_create_in_arena(3, probe->arena);
 		if (probe->transition_sets[stage_idx] == VECTOR_LIST_ERROR) {
 			throw error("Cannot create memory for transition set of stage " << stage_idx);
 		}
@@ -205,22 +305,27 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
 		// Store last bucket value for stage output discontinuity inputs
 		uint32_t last_bucket = B;
 
-		// Calculate transition inputs for each submodel
-		for (uint32_t i=0; i<probe->stage_width[stage_idx]; ++i) {
-
-			// Skip non compiled submodels
-			if (!rqrmi_submodel_compiled(model, stage_idx, i)) {
-				info("Skipping T<" << stage_idx << "," << i << "> since has empty responsibility");
-				continue;
-			}
+		// Calculate the transition inputs of all submodels in parallel, keep only those within
+		// the responsibility of each submodel. Format: [ x, B(M(x-eps)), B(M(x+eps)) ].
+		// The responsibility end points are stored with unknown buckets (-1).
+		uint32_t stage_width = probe->stage_width[stage_idx];
+		std::vector<std::vector<scalar_t>> submodel_points(stage_width);
+		parallel_for_ranges(model, stage_width, 1, [&](rqrmi_model_t* fork, uint32_t start, uint32_t end) {
+			for (uint32_t i=start; i<end; ++i) {
+
+				// Skip non compiled submodels
+				if (!rqrmi_submodel_compiled(fork, stage_idx, i)) {
+					info("Skipping T<" << stage_idx << "," << i << "> since has empty responsibility");
+					continue;
+				}
 
-			// Calculate the transition inputs of the current submodel
-			transition_inputs = rqrmi_calculate_transition_inputs(model, stage_idx, i, next_width);
-			if (transition_inputs == MATRIX_ERROR) {
-				throw error("Cannot calculate transition inputs");
-			}
+				// Calculate the transition inputs of the current submodel
+				vector_list_t* transition_inputs = rqrmi_calculate_transition_inputs(fork, stage_idx, i, next_width);
+				if (transition_inputs == VECTOR_LIST_ERROR) {
+					throw error("Cannot calculate transition inputs");
+				}
 
-		    // Debug Print
+				// Debug Print
 #ifndef NDEBUG
 				// Print only T_i,j of internal stages
 				if (stage_idx < probe->num_of_stages-1) {
@@ -235,51 +340,59 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
 				}
 #endif
 
-			// Go over the responsibility intervals
-			vector_list_t* responsibility = probe->responsibilities[stage_idx][i];
-			scalar_t* responsibility_interval = (scalar_t*)vector_list_begin(responsibility);
-			for (; responsibility_interval; responsibility_interval = (scalar_t*)vector_list_iterate(responsibility)) {
-
-				// Add interval edges to points
-				scalar_t*  transition_input;
-
-				// Go over all transition inputs
-				transition_input = (scalar_t*)vector_list_begin(transition_inputs);
-				for (; transition_input; transition_input = (scalar_t*)vector_list_iterate(transition_inputs)) {
-
-					bool condition_left  = transition_input[0] >= responsibility_interval[0];
-					bool condition_right = transition_input[0] <= responsibility_interval[1];
-
-					// In both conditions are met, copy value to transition set
-					if (condition_left && condition_right) {
-
-						// Debug information
-						/*info("Transition set U_%u contains x=%f (x in T<%u,%u>) as x in S=[%f, %f] subsetof R<%u,%u>. f(x-eps)=%u, f(x+eps)=%u",
-								stage_idx, transition_input[0], stage_idx, i,
-								responsibility_interval[0], responsibility_interval[1],
-								stage_idx, i, transition_input[1], transition_input[2]);*/
-
-						new_pt = (scalar_t*)vector_list_push_back_and_get(probe->transition_sets[stage_idx]);
-						new_pt[0] = transition_input[0]; // x
-						new_pt[1] = transition_input[1];
-						new_pt[2] = transition_input[2];
-
-						// Update last bucket value for discontinuity inputs
-						last_bucket = transition_input[2];
+				// Go over the responsibility intervals
+				std::vector<scalar_t>& points = submodel_points[i];
+				vector_list_t* responsibility = probe->responsibilities[stage_idx][i];
+				scalar_t* responsibility_interval = (scalar_t*)vector_list_begin(responsibility);
+				for (; responsibility_interval; responsibility_interval = (scalar_t*)vector_list_iterate(responsibility)) {
+
+					// Go over all transition inputs
+					scalar_t* transition_input = (scalar_t*)vector_list_begin(transition_inputs);
+					for (; transition_input; transition_input = (scalar_t*)vector_list_iterate(transition_inputs)) {
+
+						bool condition_left  = transition_input[0] >= responsibility_interval[0];
+						bool condition_right = transition_input[0] <= responsibility_interval[1];
+
+						// In both conditions are met, copy value to transition set
+						if (condition_left && condition_right) {
+							points.push_back(transition_input[0]); // x
+							points.push_back(transition_input[1]);
+							points.push_back(transition_input[2]);
+						}
 					}
+
+					// Add the responsibility end point to the transition set, as the stage output
+					// has discontinuity point. Both buckets are set while merging.
+					points.push_back(responsibility_interval[1]); // x
+					points.push_back((scalar_t)(-1));
+					points.push_back((scalar_t)(-1));
 				}
 
-				// Add the responsibility end point to the transition set, as the stage output
-				// has discontinuity point
-				new_pt = (scalar_t*)vector_list_push_back_and_get(probe->transition_sets[stage_idx]);
-				new_pt[0] = responsibility_interval[1]; // x
-				new_pt[1] = last_bucket;
-				// The right bucket value is still unknown.
-				new_pt[2] = (scalar_t)(-1);
+				// Free used memory
+				vector_list_free(transition_inputs);
 			}
+		});
 
+		// Merge the points of all submodels by order, as the left bucket of
+		// responsibility end points is the last bucket seen so far
+		for (uint32_t i=0; i<stage_width; ++i) {
+			std::vector<scalar_t>& points = submodel_points[i];
+			for (uint32_t k=0; k<points.size(); k+=3) {
+				new_pt = (scalar_t*)vector_list_push_back_and_get(probe->transition_sets[stage_idx]);
+				new_pt[0] = points[k]; // x
+				if (points[k+1] < 0) {
+					new_pt[1] = last_bucket;
+					// The right bucket value is still unknown.
+					new_pt[2] = (scalar_t)(-1);
+				} else {
+					new_pt[1] = points[k+1];
+					new_pt[2] = points[k+2];
+					// Update last bucket value for discontinuity inputs
+					last_bucket = points[k+2];
+				}
+			}
 			// Free used memory
-			vector_list_free(transition_inputs);
+			std::vector<scalar_t>().swap(points);
 		}
 
 		// Sort the transition set by value
@@ -313,8 +426,8 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
 
 	} catch (const std::exception& e) {
 		warning(e.what());
-		vector_list_free(transition_inputs);
 		vector_list_free(probe->transition_sets[stage_idx]);
+		probe->transition_sets[stage_idx] = VECTOR_LIST_ERROR;
 	}
 	return probe->transition_sets[stage_idx];
 }
@@ -328,6 +441,7 @@ vector_list_t* rqrmi_tools_calculate_transition_set(rqrmi_model_t* model, rqrmi_
  * @note  User should not free the returned pointer
  * @note  First stage has width of 1
  * @note  The responsibilities of stages {0,1,...,x-1} must be calculated before that of stage x
+ * @note  The transition points of the previous stage are evaluated in parallel
  */
 vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi_probing_t* probe, uint32_t stage_idx) {
 
@@ -343,6 +457,7 @@ vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi
 	if (probe->responsibilities[stage_idx] != VECTOR_LIST_ERROR) {
 		for (uint32_t i=0; i<probe->stage_width[stage_idx]; ++i) {
 			vector_list_free(probe->responsibilities[stage_idx][i]);
+			probe->responsibilities[stage_idx][i] = VECTOR_LIST_ERROR;
 		}
 	}
 
@@ -371,18 +486,38 @@ vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi
 	try {
 		// Allocate memory for all responsibilities in stage
 		for (uint32_t i=0; i<stage_width; ++i) {
-			probe->responsibilities[stage_idx][i] = vector_list_create(2);
+			probe->responsibilities[stage_idx][i] = vector_list_create_in_arena(2, probe->arena);
 			if (probe->responsibilities[stage_idx][i] == VECTOR_LIST_ERROR) {
 				throw error("Cannot allocate memory for responsibility <" << stage_idx << "," << i << ">");
 			}
 		}
 
-		scalar_t last_value = rqrmi_get_input_domain(model).first;
-
-		// Go over all values in the transition set
+		// Gather the transition points of the previous stage
 		vector_list_t* U_i = probe->transition_sets[stage_idx-1];
+		std::vector<scalar_t> points;
+		points.reserve(vector_list_get_size(U_i));
 		scalar_t* vec = (scalar_t*)vector_list_begin(U_i);
 		for (; vec; vec = (scalar_t*)vector_list_iterate(U_i)) {
+			points.push_back(vec[0]);
+		}
+
+		// Evaluate the buckets of all transition points in parallel
+		std::vector<scalar_t> outputs(points.size());
+		std::vector<uint32_t> buckets(points.size());
+		parallel_for_ranges(model, points.size(), 1024, [&](rqrmi_model_t* fork, uint32_t start, uint32_t end) {
+			rqrmi_evaluate_model_batch(fork, &points[start], &outputs[start], NULL, end-start);
+			for (uint32_t k=start; k<end; ++k) {
+				scalar_t M = outputs[k];
+				buckets[k] = stage_width * (M < 0 ? 0 : M >= 1 ? 1 - SCALAR_EPS : M);
+			}
+		});
+
+		scalar_t last_value = rqrmi_get_input_domain(model).first;
+
+		// Go over all values in the transition set
+		uint32_t k = 0;
+		vec = (scalar_t*)vector_list_begin(U_i);
+		for (; vec; vec = (scalar_t*)vector_list_iterate(U_i), ++k) {
 
 			// Get next transition point
 			scalar_t pt = vec[0];
@@ -390,48 +525,38 @@ vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi
 			// Get the bucket just before current point B(S(pt-epsilon))
 			uint32_t bucket = vec[1];
 
-			// Add new responsibility interval to the submodel corresponds to the last bucket
-			scalar_t* new_interval = (scalar_t*)vector_list_push_back_and_get(probe->responsibilities[stage_idx][bucket]);
-
 			// Check whether the current value is relevant to the bucket as well
-			scalar_t M = rqrmi_evaluate_model(model, pt);
-			uint32_t B = probe->stage_width[stage_idx] * (M < 0 ? 0 : M >= 1 ? 1 - SCALAR_EPS : M);
+			uint32_t B = buckets[k];
+
+			// The new responsibility interval of the submodel corresponds to the last bucket
+			scalar_t interval_start = last_value, interval_end;
 
 			// In case the input is not part of the bucket
 			if (B != bucket) {
-				new_interval[0] = last_value;
-				new_interval[1] = SCALAR_PREV(pt);
+				interval_end = SCALAR_PREV(pt);
 				last_value = pt;
 			}
 			// In case the input as a part of the bucket
 			else {
-				new_interval[0] = last_value;
-				new_interval[1] = pt;
+				interval_end = pt;
 				last_value = SCALAR_NEXT(pt);
 			}
-		}
 
-		// Compress intersecting intervals
-		for (uint32_t i=0; i<stage_width; ++i) {
-			vector_list_t* responsibility = probe->responsibilities[stage_idx][i];
-			// On each iteration, work on two intervals. Fix current with next and delete next if necessary.
-			scalar_t* cursor = (scalar_t*)vector_list_begin(responsibility);
-			scalar_t* next = (scalar_t*)vector_list_iterate(responsibility);
-			uint32_t position = 1;
-			while (next) {
-				// Check whether the responsibility in cursor_next intersects cursor
-				if (SCALAR_PREV(next[0]) <= cursor[1]) {
-					// Merge cursor with cursor next
-					cursor[1] = next[1];
-					// Delete cursor_next
-					vector_list_remove_at(responsibility, position);
-				} else {
-					// Continue to next cursor
-					cursor = next;
+			// Compress intersecting intervals: intervals are added by order,
+			// so the new interval may only intersect the last interval of the bucket
+			vector_list_t* responsibility = probe->responsibilities[stage_idx][bucket];
+			if (vector_list_get_size(responsibility) > 0) {
+				scalar_t* last_interval = (scalar_t*)vector_list_get_last(responsibility);
+				if (SCALAR_PREV(interval_start) <= last_interval[1]) {
+					last_interval[1] = interval_end;
+					continue;
 				}
-				next = (scalar_t*)vector_list_iterate(responsibility);
-				++position;
 			}
+
+			// Add new responsibility interval
+			scalar_t* new_interval = (scalar_t*)vector_list_push_back_and_get(responsibility);
+			new_interval[0] = interval_start;
+			new_interval[1] = interval_end;
 		}
 
 		// Print debug information
@@ -457,10 +582,13 @@ vector_list_t** rqrmi_tools_calculate_responsibility(rqrmi_model_t* model, rqrmi
  * @param probe An RQRMI probing data structure
  * @param stage_idx The required stage
  * @param bucket_idx The required bucket in stage
+ * @param arena The arena of the record list, NULL for a heap list
  * @returns A vector list. Format: [start_input, end_input, record_idx, interval_idx]. On error returns VECTOR_LIST_ERROR.
  * @note The user should free the record list
  */
-vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx) {
+vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		vector_arena_t* arena)
+{
 
 	vector_list_t* responsibility;
 	vector_list_t* record_list = VECTOR_LIST_ERROR;
@@ -477,7 +605,7 @@ vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe,
 		}
 
 		// Allocate list
-		record_list = vector_list_create(4);
+		record_list = vector_list_create_in_arena(4, arena);
 		if (record_list == VECTOR_LIST_ERROR) {
 			throw error("cannot allocate record list");
 		}
@@ -493,8 +621,17 @@ vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe,
 			scalar_t interval_srt = interval[0]; // inclusive
 			scalar_t interval_end = interval[1]; // inclusive
 
+			// Skip the records that end before the interval: find the first record r with
+			// records[r+1] >= interval_srt
+			uint32_t first = 0, last = probe->num_of_records-1;
+			while (first < last) {
+				uint32_t middle = (first + last) / 2;
+				if (GET_SCALAR(probe->records, middle+1, 0) < interval_srt) first = middle+1;
+				else last = middle;
+			}
+
 			// Go over all records, match
-			for (uint32_t r=0; r<probe->num_of_records-1; ++r) {
+			for (uint32_t r=first; r<probe->num_of_records-1; ++r) {
 
 				scalar_t record_start = GET_SCALAR(probe->records, r, 0);
 				scalar_t record_end   = GET_SCALAR(probe->records, r+1, 0);
@@ -527,48 +664,42 @@ vector_list_t* rqrmi_tools_get_records_in_responsibility(rqrmi_probing_t* probe,
 }
 
 /**
- * @brief Generate dataset from stage bucket
+ * @brief Calculates the sampling plan of a stage bucket: how many samples to take from each matching record
  * @param probe An RQRMI probing data structure
  * @param stage_idx The required stage
  * @param bucket_idx The required bucket in stage
  * @param num_of_samples Dataset maximum size
- * @param random Smart random sampling
- * @param shuffle Shuffle dataset
- * @returns A matrix. Each row is a sample with format [input, expected_output], both are scalars not normalized!
- * 		    On error returns MATRIX_ERROR.
+ * @param arena The arena of the temporary lists, NULL for heap lists (thread safe)
+ * @param[out] plan The markers with at least one sample, sorted by record
+ * @throws In case of an error
  */
-matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe,
-		uint32_t stage_idx, uint32_t bucket_idx, uint32_t num_of_samples, bool random, bool shuffle)
+static void plan_dataset(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		uint32_t num_of_samples, vector_arena_t* arena, std::vector<dataset_marker_t>& plan)
 {
 	// Check bucket is valid
 	if (bucket_idx >= probe->stage_width[stage_idx]) {
-		error("bucket " << bucket_idx << " is not valid for stage " << stage_idx);
-		return MATRIX_ERROR;
+		throw error("bucket " << bucket_idx << " is not valid for stage " << stage_idx);
 	}
 
 	// Check responsibility was calculated
 	if (probe->responsibilities[stage_idx][bucket_idx] == VECTOR_LIST_ERROR) {
-		error("responsibility <" << stage_idx << "," << bucket_idx << "> is not available");
-		return MATRIX_ERROR;
+		throw error("responsibility <" << stage_idx << "," << bucket_idx << "> is not available");
 	}
 
 	// Get the records that match the responsibility
-	vector_list_t* matching_records = rqrmi_tools_get_records_in_responsibility(probe, stage_idx, bucket_idx);
+	vector_list_t* matching_records = rqrmi_tools_get_records_in_responsibility(probe, stage_idx, bucket_idx, arena);
 	if (matching_records == VECTOR_LIST_ERROR) {
-		error("cannot calculate matching records");
-		return MATRIX_ERROR;
+		throw error("cannot calculate matching records");
 	}
 
 	// Allocate markers
 	// Format: [ start_input, end_input, record_idx, responsibility_idx, num_of_samples ] (scalars)
-	vector_list_t* markers = vector_list_create(5);
+	vector_list_t* markers = vector_list_create_in_arena(5, arena);
 	if (markers == VECTOR_LIST_ERROR) {
-		error("cannot allocate marker list");
-		return MATRIX_ERROR;
+		vector_list_free(matching_records);
+		throw error("cannot allocate marker list");
 	}
 
-	matrix_t* output = MATRIX_ERROR;
-
 	try {
 
 		vector_list_t* responsibility = probe->responsibilities[stage_idx][bucket_idx];
@@ -627,7 +758,6 @@ matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe,
 				". Total space: " << total_space);
 
 		scalar_t* marker = (scalar_t*)vector_list_begin(markers);
-		uint32_t actual_samples = 0;
 
 		// Sample from each responsibility according to its size
 		for (uint32_t j=0; j<vector_list_get_size(responsibility); ++j) {
@@ -653,7 +783,6 @@ matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe,
 				uint32_t samples_per_marker = SCALAR_NEXT(samples_for_responsibility) / responsibility_markers[j];
 				while (marker && marker[3] == j) {
 					marker[4] = samples_per_marker;
-					actual_samples += samples_per_marker;
 					marker = (scalar_t*)vector_list_iterate(markers);
 				}
 			}
@@ -669,85 +798,306 @@ matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe,
 					if (!marker || marker[3] > j) break;
 					// Sample the current marker
 					marker[4] = 1;
-					++actual_samples;
 					current += step;
 				}
 			}
 		}
 
-		// Allocate output
-		info("Generating dataset of size: " << actual_samples);
-		output = new_matrix(actual_samples, 2);
+		// Keep only the sampled markers
+		plan.clear();
+		marker = (scalar_t*)vector_list_begin(markers);
+		for(; marker; marker = (scalar_t*)vector_list_iterate(markers)) {
+			if (marker[4] == 0) continue;
+			dataset_marker_t sampled = { marker[0], marker[1], (uint32_t)marker[2], (uint32_t)marker[4] };
+			plan.push_back(sampled);
+		}
+
+	} catch (...) {
+		vector_list_free(markers);
+		vector_list_free(matching_records);
+		throw;
+	}
+
+	// Free resources
+	vector_list_free(markers);
+	vector_list_free(matching_records);
+}
+
+/**
+ * @brief Generates samples of a stream
+ * @param stream A dataset stream
+ * @param samples The indices of the samples to generate
+ * @param num_of_samples The number of samples to generate
+ * @param[out] inputs The input of each sample
+ * @param[out] record_indices The record index of each sample
+ * @note  All datasets are generated by this method, so materialized and streamed samples are identical
+ */
+static void generate_samples(const rqrmi_dataset_stream_t* stream, const uint32_t* samples, uint32_t num_of_samples,
+		scalar_t* inputs, uint32_t* record_indices)
+{
+	for (uint32_t i=0; i<num_of_samples; ++i) {
+		uint32_t sample = samples[i];
+		uint32_t marker_idx = stream->sample_markers[sample];
+		const dataset_marker_t& marker = stream->markers[marker_idx];
+		uint32_t k = sample - stream->offsets[marker_idx];
+
+		record_indices[i] = marker.record_idx;
+
+		// Random sample, uniform within the marker by a hash of the sample index
+		if (stream->random) {
+			uint64_t hash = (uint64_t)stream->seed << 32 | sample;
+			hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+			hash ^= hash >> 31;
+			scalar_t offset = (scalar_t)(hash >> 40) / (1 << 24) * (marker.end - marker.start);
+			inputs[i] = MIN(marker.start + offset, marker.end);
+		}
+		// Special case of only one sample, sample the marker mid point
+		else if (marker.num_of_samples == 1) {
+			inputs[i] = (marker.start + marker.end) / 2;
+		}
+		// Linspace sample
+		else {
+			scalar_t offset = (marker.end - marker.start) / marker.num_of_samples * k;
+			inputs[i] = marker.start + offset;
+		}
+	}
+}
+
+/**
+ * @brief Creates a dataset stream of a stage bucket
+ * @param arena The arena of the temporary lists, NULL for heap lists (thread safe)
+ * @throws In case of an error
+ */
+static rqrmi_dataset_stream_t* create_dataset_stream(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		uint32_t num_of_samples, bool random, uint32_t seed, vector_arena_t* arena)
+{
+	rqrmi_dataset_stream_t* stream = new rqrmi_dataset_stream_t;
+	try {
+		plan_dataset(probe, stage_idx, bucket_idx, num_of_samples, arena, stream->markers);
+	} catch (...) {
+		delete stream;
+		throw;
+	}
+
+	// Index the first sample of each marker, and the marker of each sample
+	uint32_t total = 0;
+	stream->offsets.resize(stream->markers.size());
+	for (uint32_t m=0; m<stream->markers.size(); ++m) {
+		stream->offsets[m] = total;
+		total += stream->markers[m].num_of_samples;
+	}
+	stream->sample_markers.resize(total);
+	for (uint32_t m=0; m<stream->markers.size(); ++m) {
+		std::fill_n(stream->sample_markers.begin() + stream->offsets[m], stream->markers[m].num_of_samples, m);
+	}
+
+	stream->num_of_samples = total;
+	stream->cursor = 0;
+	stream->random = random;
+	stream->seed = seed;
+
+	info("Generating dataset of size: " << total);
+	return stream;
+}
+
+/**
+ * @brief Materializes all samples of a stream to a matrix, in the order of the stream
+ * @returns A matrix with format [input, expected_output], or MATRIX_ERROR
+ */
+static matrix_t* materialize_dataset_stream(rqrmi_dataset_stream_t* stream) {
+	matrix_t* output = new_matrix(stream->num_of_samples, 2);
+	if (output == MATRIX_ERROR) {
+		return MATRIX_ERROR;
+	}
+
+	const uint32_t batch_size = 1024;
+	scalar_t inputs[batch_size];
+	uint32_t record_indices[batch_size];
+	uint32_t cursor = 0;
+
+	rqrmi_tools_dataset_stream_rewind(stream);
+	for (uint32_t count; (count = rqrmi_tools_dataset_stream_next(stream, batch_size, inputs, record_indices)) > 0; ) {
+		for (uint32_t i=0; i<count; ++i, ++cursor) {
+			GET_SCALAR(output, cursor, 0) = inputs[i];
+			GET_SCALAR(output, cursor, 1) = record_indices[i];
+		}
+	}
+	return output;
+}
+
+/**
+ * @brief Generate dataset from stage bucket
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The required stage
+ * @param bucket_idx The required bucket in stage
+ * @param num_of_samples Dataset maximum size
+ * @param random Smart random sampling
+ * @param shuffle Shuffle dataset
+ * @returns A matrix. Each row is a sample with format [input, expected_output], both are scalars not normalized!
+ * 		    On error returns MATRIX_ERROR.
+ */
+matrix_t* rqrmi_tools_generate_dataset(rqrmi_probing_t* probe,
+		uint32_t stage_idx, uint32_t bucket_idx, uint32_t num_of_samples, bool random, bool shuffle)
+{
+	rqrmi_dataset_stream_t* stream = RQRMI_DATASET_STREAM_ERROR;
+	matrix_t* output = MATRIX_ERROR;
+
+	try {
+		uint32_t seed = gen_uniform_random_uint32(0, MAX_UINT);
+		stream = create_dataset_stream(probe, stage_idx, bucket_idx, num_of_samples, random, seed, probe->arena);
+		if (shuffle) {
+			rqrmi_tools_dataset_stream_shuffle(stream, gen_uniform_random_uint32(0, MAX_UINT));
+		}
+		output = materialize_dataset_stream(stream);
 		if (output == MATRIX_ERROR) {
 			throw error("cannot allocate memory for output");
 		}
+	} catch (const std::exception& e) {
+		warning(e.what());
+	}
 
-		// Populate output
-		uint32_t cursor=0;
-		marker = (scalar_t*)vector_list_begin(markers);
-		for(; marker; marker = (scalar_t*)vector_list_iterate(markers)) {
-			// Sample according to demand
-			// Random sample
-			if (random) {
-				for (uint32_t i=0; i<marker[4]; ++i) {
-					GET_SCALAR(output, cursor, 0) = gen_uniform_random_scalar(marker[0], marker[1]);
-					GET_SCALAR(output, cursor, 1) = marker[2];
-					++cursor;
-				}
-			}
-			// Linspace sample
-			else {
-				// Special case of only one sample, sample the mraker mid point
-				if (marker[4] == 1) {
-					GET_SCALAR(output, cursor, 0) = (marker[0] + marker[1])/2;
-					GET_SCALAR(output, cursor, 1) = marker[2];
-					++cursor;
+	rqrmi_tools_dataset_stream_free(stream);
+	return output;
+}
+
+/**
+ * @brief Generate the datasets of multiple buckets of a stage in parallel
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The required stage
+ * @param bucket_indices The required buckets in stage
+ * @param num_of_buckets The number of buckets to generate
+ * @param num_of_samples Dataset maximum size per bucket
+ * @param random Smart random sampling
+ * @param shuffle Shuffle datasets
+ * @param[out] output The datasets, indexed by bucket_indices, in the format of rqrmi_tools_generate_dataset
+ * @returns True on success. On error, no dataset is allocated.
+ * @note  The probe is only read, so it must not be modified concurrently
+ */
+bool rqrmi_tools_generate_datasets(rqrmi_probing_t* probe, uint32_t stage_idx, const uint32_t* bucket_indices,
+		uint32_t num_of_buckets, uint32_t num_of_samples, bool random, bool shuffle, matrix_t** output)
+{
+	for (uint32_t i=0; i<num_of_buckets; ++i) {
+		output[i] = MATRIX_ERROR;
+	}
+
+	// The random generator is not thread safe, draw the seeds in advance
+	std::vector<uint32_t> seeds(2*num_of_buckets);
+	for (uint32_t i=0; i<seeds.size(); ++i) {
+		seeds[i] = gen_uniform_random_uint32(0, MAX_UINT);
+	}
+
+	try {
+		// Each bucket uses heap lists, as the probe arena is not thread safe
+		parallel_for_ranges(RQRMI_MODEL_ERROR, num_of_buckets, 1, [&](rqrmi_model_t*, uint32_t start, uint32_t end) {
+			for (uint32_t i=start; i<end; ++i) {
+				rqrmi_dataset_stream_t* stream = create_dataset_stream(probe, stage_idx, bucket_indices[i],
+						num_of_samples, random, seeds[2*i], NULL);
+				if (shuffle) {
+					rqrmi_tools_dataset_stream_shuffle(stream, seeds[2*i+1]);
 				}
-				// All other cases
-				else {
-					scalar_t current = marker[0];
-					scalar_t step = (marker[1] - marker[0]) / marker[4];
-					for (uint32_t i=0; i<marker[4]; ++i) {
-						GET_SCALAR(output, cursor, 0) = current;
-						GET_SCALAR(output, cursor, 1) = marker[2];
-						current += step;
-						++cursor;
-					}
+				output[i] = materialize_dataset_stream(stream);
+				rqrmi_tools_dataset_stream_free(stream);
+				if (output[i] == MATRIX_ERROR) {
+					throw error("cannot allocate memory for the dataset of bucket " << bucket_indices[i]);
 				}
 			}
+		});
+	} catch (const std::exception& e) {
+		warning(e.what());
+		for (uint32_t i=0; i<num_of_buckets; ++i) {
+			free_matrix(output[i]);
+			output[i] = MATRIX_ERROR;
 		}
+		return false;
+	}
 
-		// Shuffle dataset if necessary
-		if (shuffle) {
-			// Create random permutation
-			uint32_t *permutation = (uint32_t*)malloc(sizeof(uint32_t)*actual_samples);
-			random_permutation(permutation, actual_samples);
+	return true;
+}
 
-			// Create new output
-			matrix_t* new_output = new_matrix(actual_samples, 2);
+/**
+ * @brief Creates a stream over the dataset of a stage bucket.
+ *        Only the sampling plan is stored; samples are generated on demand by rqrmi_tools_dataset_stream_next.
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The required stage
+ * @param bucket_idx The required bucket in stage
+ * @param num_of_samples Dataset maximum size
+ * @param random Smart random sampling
+ * @param seed Seed for random sampling
+ * @returns A stream, or RQRMI_DATASET_STREAM_ERROR on error
+ */
+rqrmi_dataset_stream_t* rqrmi_tools_dataset_stream_new(rqrmi_probing_t* probe, uint32_t stage_idx, uint32_t bucket_idx,
+		uint32_t num_of_samples, bool random, uint32_t seed)
+{
+	try {
+		return create_dataset_stream(probe, stage_idx, bucket_idx, num_of_samples, random, seed, NULL);
+	} catch (const std::exception& e) {
+		warning(e.what());
+		return RQRMI_DATASET_STREAM_ERROR;
+	}
+}
 
-			// Populate new output
-			for (uint32_t i=0; i<actual_samples; ++i) {
-				*(uint32_t*)get_element(new_output, i, 0) = *(uint32_t*)get_element(output, permutation[i], 0);
-				*(uint32_t*)get_element(new_output, i, 1) = *(uint32_t*)get_element(output, permutation[i], 1);
-			}
+/**
+ * @brief Frees a dataset stream
+ */
+void rqrmi_tools_dataset_stream_free(rqrmi_dataset_stream_t* stream) {
+	delete stream;
+}
 
-			// Free previous dataset
-			free_matrix(output);
-			free(permutation);
-			output=new_output;
-		}
+/**
+ * @brief Returns the number of samples of a dataset stream
+ */
+uint32_t rqrmi_tools_dataset_stream_get_size(rqrmi_dataset_stream_t* stream) {
+	return stream->num_of_samples;
+}
 
-	} catch (const std::exception& e) {
-		warning(e.what());
-		free_matrix(output);
-		output = MATRIX_ERROR;
+/**
+ * @brief Shuffles the order of the samples and rewinds the stream
+ * @param stream A dataset stream
+ * @param seed Seed of the permutation
+ */
+void rqrmi_tools_dataset_stream_shuffle(rqrmi_dataset_stream_t* stream, uint32_t seed) {
+	if (stream->permutation.empty()) {
+		stream->permutation.resize(stream->num_of_samples);
+		for (uint32_t i=0; i<stream->num_of_samples; ++i) stream->permutation[i] = i;
 	}
+	std::mt19937 generator(seed);
+	std::shuffle(stream->permutation.begin(), stream->permutation.end(), generator);
+	stream->cursor = 0;
+}
 
-	// Free resources
-	vector_list_free(markers);
-	vector_list_free(matching_records);
-	return output;
+/**
+ * @brief Rewinds the stream, keeps the current order of the samples
+ */
+void rqrmi_tools_dataset_stream_rewind(rqrmi_dataset_stream_t* stream) {
+	stream->cursor = 0;
+}
+
+/**
+ * @brief Generates the next mini-batch of the stream
+ * @param stream A dataset stream
+ * @param batch_size The maximum number of samples to generate
+ * @param[out] inputs The input of each sample, not normalized
+ * @param[out] record_indices The expected record index of each sample
+ * @returns The number of generated samples, 0 once all samples were generated
+ */
+uint32_t rqrmi_tools_dataset_stream_next(rqrmi_dataset_stream_t* stream, uint32_t batch_size,
+		scalar_t* inputs, uint32_t* record_indices)
+{
+	uint32_t count = MIN(batch_size, stream->num_of_samples - stream->cursor);
+	if (count == 0) return 0;
+
+	// Not shuffled, samples are in order
+	if (stream->permutation.empty()) {
+		uint32_t samples[count];
+		for (uint32_t i=0; i<count; ++i) samples[i] = stream->cursor + i;
+		generate_samples(stream, samples, count, inputs, record_indices);
+	} else {
+		generate_samples(stream, &stream->permutation[stream->cursor], count, inputs, record_indices);
+	}
+
+	stream->cursor += count;
+	return count;
 }
 
 /**
@@ -772,7 +1122,7 @@ scalar_pair_t rqrmi_tools_calculate_submodel_error(rqrmi_model_t* model, rqrmi_p
 
 	// Get the records in the submodel responsibility
 	// Format: [start_input, end_input, record_idx, interval_idx]
-	vector_list_t* matching_records = rqrmi_tools_get_records_in_responsibility(probe, stage_idx, submodel_idx);
+	vector_list_t* matching_records = rqrmi_tools_get_records_in_responsibility(probe, stage_idx, submodel_idx, probe->arena);
 	if (matching_records == VECTOR_LIST_ERROR) {
 		throw error("cannot calculate submodel <" << stage_idx << "," << submodel_idx << "> matching records");
 	}
@@ -869,6 +1219,199 @@ scalar_pair_t rqrmi_tools_calculate_submodel_error(rqrmi_model_t* model, rqrmi_p
 	return (scalar_pair_t){ (scalar_t)max_error, coverage };
 }
 
+/**
+ * @brief Evaluates the model on candidate inputs, updates the maximum deviation per submodel
+ * @param model An RQRMI model
+ * @param inputs The candidate inputs
+ * @param records The record index of each candidate input
+ * @param num_of_records The number of records indexed by the model
+ * @param[out] submodels The submodel of the last stage used per candidate input
+ * @param[out] max_deviation Updated with the deviation of each input, per submodel
+ */
+static void update_exact_deviation(rqrmi_model_t* model, const std::vector<scalar_t>& inputs,
+		const std::vector<uint32_t>& records, uint32_t num_of_records,
+		std::vector<uint32_t>& submodels, std::vector<int>& max_deviation)
+{
+	std::vector<scalar_t> outputs(inputs.size());
+	submodels.resize(inputs.size());
+	rqrmi_evaluate_model_batch(model, inputs.data(), outputs.data(), submodels.data(), inputs.size());
+
+	for (uint32_t i=0; i<inputs.size(); ++i) {
+		// The position calculated by the lookup procedure
+		int position = outputs[i] * num_of_records;
+		int deviation = abs(position - (int)records[i]);
+		max_deviation[submodels[i]] = MAX(max_deviation[submodels[i]], deviation);
+	}
+}
+
+/**
+ * @brief Calculates the exact error of all submodels in the last stage.
+ *        The model is piecewise linear between its breakpoints: trigger inputs of the last stage,
+ *        and transition inputs of the internal stages (where the last stage submodel changes).
+ *        Hence, the maximum deviation within each record is reached on a breakpoint or on the record
+ *        edges, and evaluating the model only on these inputs gives the exact error.
+ * @param model An RQRMI model
+ * @param starts The start values of the records, sorted
+ * @param ends The end values of the records (inclusive), NULL in case the records are contiguous
+ * @param num_of_records The number of records indexed by the model
+ * @param[out] error_list The error of each submodel of the last stage
+ * @note Inputs between records are not considered, as the validation phase rejects them anyway
+ * @note May throw exceptions
+ */
+void rqrmi_tools_calculate_exact_errors(rqrmi_model_t* model, const scalar_t* starts, const scalar_t* ends,
+		uint32_t num_of_records, uint32_t* error_list)
+{
+	uint32_t num_of_stages = rqrmi_get_num_of_stages(model);
+	uint32_t last_width = rqrmi_get_num_of_submodels(model, num_of_stages-1);
+	if (num_of_records == 0) {
+		throw error("cannot calculate exact errors with no records");
+	}
+
+	// Collect the breakpoints of the model
+	std::vector<scalar_t> candidates;
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		uint32_t stage_width = rqrmi_get_num_of_submodels(model, s);
+		for (uint32_t i=0; i<stage_width; ++i) {
+			if (!rqrmi_submodel_compiled(model, s, i)) continue;
+
+			// Last stage: the output of submodel is linear between its trigger inputs
+			if (s == num_of_stages-1) {
+				matrix_t* trigger_inputs = rqrmi_calculate_trigger_inputs(model, s, i);
+				if (trigger_inputs == MATRIX_ERROR) {
+					throw error("cannot calculate trigger inputs of submodel <" << s << "," << i << ">");
+				}
+				for (uint32_t k=0; k<trigger_inputs->rows; ++k) {
+					candidates.push_back(GET_SCALAR(trigger_inputs, k, 0));
+				}
+				free_matrix(trigger_inputs);
+				continue;
+			}
+
+			// Internal stages: the submodel of the next stage changes on transition inputs.
+			// Add both sides of each transition input.
+			uint32_t next_width = rqrmi_get_num_of_submodels(model, s+1);
+			vector_list_t* transition_inputs = rqrmi_calculate_transition_inputs(model, s, i, next_width);
+			if (transition_inputs == VECTOR_LIST_ERROR) {
+				throw error("cannot calculate transition inputs of submodel <" << s << "," << i << ">");
+			}
+			scalar_t* cursor = (scalar_t*)vector_list_begin(transition_inputs);
+			for(; cursor; cursor = (scalar_t*)vector_list_iterate(transition_inputs)) {
+				candidates.push_back(nextafterf(cursor[0], -INFINITY));
+				candidates.push_back(cursor[0]);
+				candidates.push_back(nextafterf(cursor[0], INFINITY));
+			}
+			vector_list_free(transition_inputs);
+		}
+	}
+
+	// Sort the breakpoints, remove duplicates
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	// Merge the breakpoints with the record edges by order, keep only those inside records
+	std::vector<scalar_t> inputs;
+	std::vector<uint32_t> records;
+	uint32_t cursor = 0;
+	for (uint32_t r=0; r<num_of_records; ++r) {
+		scalar_t record_end = ends ? ends[r] :
+				(r+1 < num_of_records ? nextafterf(starts[r+1], -INFINITY) : rqrmi_get_input_domain(model).second);
+		record_end = MAX(record_end, starts[r]);
+
+		inputs.push_back(starts[r]);
+		records.push_back(r);
+		for (; cursor < candidates.size() && candidates[cursor] <= starts[r]; ++cursor);
+		for (; cursor < candidates.size() && candidates[cursor] < record_end; ++cursor) {
+			inputs.push_back(candidates[cursor]);
+			records.push_back(r);
+		}
+		if (record_end > starts[r]) {
+			inputs.push_back(record_end);
+			records.push_back(r);
+		}
+	}
+
+	// Evaluate the model on all inputs
+	std::vector<int> max_deviation(last_width, -1);
+	std::vector<uint32_t> submodels;
+	update_exact_deviation(model, inputs, records, num_of_records, submodels, max_deviation);
+
+	// The transition inputs are calculated analytically, and might differ from the evaluation
+	// in a few ULPs. In case the last stage submodel changes between two consecutive inputs
+	// of the same record, bisect to find the exact input in which it changes.
+	std::vector<scalar_t> segment_inputs;
+	std::vector<uint32_t> segment_records, segment_submodels;
+	std::vector<scalar_t> left, right;
+	std::vector<uint32_t> left_submodel, right_submodel, segment_record;
+	for (uint32_t k=1; k<inputs.size(); ++k) {
+		if (records[k] != records[k-1] || submodels[k] == submodels[k-1]) continue;
+		left.push_back(inputs[k-1]);
+		right.push_back(inputs[k]);
+		left_submodel.push_back(submodels[k-1]);
+		right_submodel.push_back(submodels[k]);
+		segment_record.push_back(records[k]);
+	}
+
+	uint32_t num_of_bisections = 0;
+	while (!left.empty()) {
+
+		// Bisect all pending segments at once
+		segment_inputs.clear();
+		segment_records.clear();
+		for (uint32_t k=0; k<left.size(); ++k) {
+			segment_inputs.push_back(left[k] + (right[k] - left[k]) / 2);
+			segment_records.push_back(segment_record[k]);
+		}
+		update_exact_deviation(model, segment_inputs, segment_records, num_of_records, segment_submodels, max_deviation);
+		num_of_bisections += left.size();
+
+		// Keep the halves in which the submodel still changes
+		uint32_t num_of_segments = left.size();
+		for (uint32_t k=0; k<num_of_segments; ++k) {
+			scalar_t mid = segment_inputs[k];
+			uint32_t mid_submodel = segment_submodels[k];
+			bool done = (mid <= left[k]) || (mid >= right[k]);
+			if (!done && mid_submodel != right_submodel[k]) {
+				left.push_back(mid);
+				right.push_back(right[k]);
+				left_submodel.push_back(mid_submodel);
+				right_submodel.push_back(right_submodel[k]);
+				segment_record.push_back(segment_record[k]);
+			}
+			if (!done && mid_submodel != left_submodel[k]) {
+				right[k] = mid;
+				right_submodel[k] = mid_submodel;
+			} else {
+				// Mark segment as done
+				right[k] = left[k];
+			}
+		}
+
+		// Remove done segments
+		uint32_t size = 0;
+		for (uint32_t k=0; k<left.size(); ++k) {
+			if (right[k] <= left[k]) continue;
+			left[size] = left[k];
+			right[size] = right[k];
+			left_submodel[size] = left_submodel[k];
+			right_submodel[size] = right_submodel[k];
+			segment_record[size] = segment_record[k];
+			++size;
+		}
+		left.resize(size);
+		right.resize(size);
+		left_submodel.resize(size);
+		right_submodel.resize(size);
+		segment_record.resize(size);
+	}
+
+	info("Exact errors: evaluated " << inputs.size() << " breakpoints and " << num_of_bisections << " bisection inputs");
+
+	// Lookup procedure requires error margin of 2
+	for (uint32_t i=0; i<last_width; ++i) {
+		error_list[i] = max_deviation[i] + 2;
+	}
+}
+
 /**
  * @brief Returns the width of a stage
  */
@@ -876,6 +1419,13 @@ uint32_t rqrmi_tools_get_stage_width(rqrmi_probing_t* probe, uint32_t stage_idx)
 	return probe->stage_width[stage_idx];
 }
 
+/**
+ * @brief Returns the number of records indexed by the probe
+ */
+uint32_t rqrmi_tools_get_num_of_records(rqrmi_probing_t* probe) {
+	return probe->num_of_records;
+}
+
 /**
  * @brief Prints a responsibility to the screen (debug only)
  * @param probe An RQRMI probing data structure
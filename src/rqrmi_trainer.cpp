@@ -0,0 +1,863 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <logging.h>
+#include <object_io.h>
+#include <rqrmi_trainer.h>
+
+// Adam hyper parameters (as in TensorFlow's defaults)
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPSILON 1e-8f
+
+// The number of samples processed at once by the SIMD path
+#define TRAINER_LANES 8
+
+/**
+ * @brief The trainable values of a 1 x W x 1 submodel.
+ *        Layer 0 has a constant weight of 1, as in the Python library.
+ * @note  Hidden layers narrower than RQRMI_MAX_HIDDEN_WIDTH are zero padded.
+ *        Padded neurons have zero gradients, so they remain zero.
+ */
+typedef struct {
+	scalar_t w1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t b1[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t w2[RQRMI_MAX_HIDDEN_WIDTH];
+	scalar_t b0;
+	scalar_t b2;
+} net_values_t;
+
+#define NET_VALUES_SIZE (sizeof(net_values_t)/sizeof(scalar_t))
+
+/**
+ * @brief Sets the default hyper parameters, as used by LookupCpu
+ * @param[out] params The parameters to initialize
+ */
+void rqrmi_trainer_default_params(rqrmi_trainer_params_t* params) {
+	params->hidden_width = 8;
+	params->batch_size = 32;
+	params->learning_rate = 1e-3;
+	params->samples_per_bucket = 1500;
+	params->threshold_submodel_error = 64;
+	params->threshold_bucket_coverage = 0.5;
+	params->retraining_multiplier = 3;
+	params->retraining_times = 3;
+	params->num_of_threads = 0;
+	params->seed = 0;
+}
+
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+/**
+ * @brief Returns the sum of all lanes of a vector
+ */
+static inline scalar_t horizontal_sum(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+#endif
+
+/**
+ * @brief Accumulates the gradients of the MSE loss over a mini-batch
+ * @param net The values of the submodel
+ * @param hidden_width The number of hidden neurons, a multiple of TRAINER_LANES in the SIMD path
+ * @param inputs The normalized inputs of the batch
+ * @param targets The normalized expected outputs of the batch
+ * @param batch_size The number of samples in the batch
+ * @param[out] grad The gradients of the loss by the values of the submodel
+ * @returns The loss over the batch
+ */
+static scalar_t accumulate_gradients(const net_values_t* net, uint32_t hidden_width,
+		const scalar_t* inputs, const scalar_t* targets, uint32_t batch_size, net_values_t* grad)
+{
+	memset(grad, 0, sizeof(net_values_t));
+	scalar_t scale = 2.0 / batch_size;
+	scalar_t loss = 0;
+	uint32_t i = 0;
+
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+	// Each lane holds a different sample
+	__m256 grad_w1[RQRMI_MAX_HIDDEN_WIDTH], grad_b1[RQRMI_MAX_HIDDEN_WIDTH], grad_w2[RQRMI_MAX_HIDDEN_WIDTH];
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		grad_w1[k] = grad_b1[k] = grad_w2[k] = _mm256_setzero_ps();
+	}
+	__m256 grad_b2 = _mm256_setzero_ps();
+	__m256 loss_vec = _mm256_setzero_ps();
+	__m256 zeros = _mm256_setzero_ps();
+
+	for (; i+TRAINER_LANES<=batch_size; i+=TRAINER_LANES) {
+		__m256 a = _mm256_add_ps(_mm256_loadu_ps(&inputs[i]), _mm256_set1_ps(net->b0));
+
+		// Forward
+		__m256 out = _mm256_set1_ps(net->b2);
+		for (uint32_t k=0; k<hidden_width; ++k) {
+			__m256 hidden = _mm256_fmadd_ps(_mm256_set1_ps(net->w1[k]), a, _mm256_set1_ps(net->b1[k]));
+			out = _mm256_fmadd_ps(_mm256_set1_ps(net->w2[k]), _mm256_max_ps(hidden, zeros), out);
+		}
+		__m256 diff = _mm256_sub_ps(out, _mm256_loadu_ps(&targets[i]));
+		loss_vec = _mm256_fmadd_ps(diff, diff, loss_vec);
+
+		// Backward, the hidden layer is recalculated rather than stored
+		__m256 d_out = _mm256_mul_ps(diff, _mm256_set1_ps(scale));
+		grad_b2 = _mm256_add_ps(grad_b2, d_out);
+		for (uint32_t k=0; k<hidden_width; ++k) {
+			__m256 hidden = _mm256_fmadd_ps(_mm256_set1_ps(net->w1[k]), a, _mm256_set1_ps(net->b1[k]));
+			__m256 active = _mm256_cmp_ps(hidden, zeros, _CMP_GT_OQ);
+			grad_w2[k] = _mm256_fmadd_ps(d_out, _mm256_max_ps(hidden, zeros), grad_w2[k]);
+			__m256 d_hidden = _mm256_and_ps(_mm256_mul_ps(d_out, _mm256_set1_ps(net->w2[k])), active);
+			grad_b1[k] = _mm256_add_ps(grad_b1[k], d_hidden);
+			grad_w1[k] = _mm256_fmadd_ps(d_hidden, a, grad_w1[k]);
+		}
+	}
+
+	// Reduce lanes
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		grad->w1[k] = horizontal_sum(grad_w1[k]);
+		grad->b1[k] = horizontal_sum(grad_b1[k]);
+		grad->w2[k] = horizontal_sum(grad_w2[k]);
+	}
+	grad->b2 = horizontal_sum(grad_b2);
+	loss = horizontal_sum(loss_vec);
+#endif
+
+	// Remaining samples
+	for (; i<batch_size; ++i) {
+		scalar_t a = inputs[i] + net->b0;
+		scalar_t hidden[RQRMI_MAX_HIDDEN_WIDTH];
+		scalar_t out = net->b2;
+		for (uint32_t k=0; k<hidden_width; ++k) {
+			hidden[k] = net->w1[k] * a + net->b1[k];
+			out += net->w2[k] * (hidden[k] > 0 ? hidden[k] : 0);
+		}
+		scalar_t diff = out - targets[i];
+		loss += diff * diff;
+
+		scalar_t d_out = diff * scale;
+		grad->b2 += d_out;
+		for (uint32_t k=0; k<hidden_width; ++k) {
+			if (hidden[k] <= 0) continue;
+			scalar_t d_hidden = d_out * net->w2[k];
+			grad->w2[k] += d_out * hidden[k];
+			grad->b1[k] += d_hidden;
+			grad->w1[k] += d_hidden * a;
+		}
+	}
+
+	// Layer 0 bias shifts the input of all hidden neurons
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		grad->b0 += grad->b1[k] * net->w1[k];
+	}
+
+	return loss / batch_size;
+}
+
+/**
+ * @brief Mini-batches of a materialized dataset, in the same order as a dataset stream
+ */
+class matrix_batches {
+	matrix_t* _dataset;
+	std::vector<uint32_t> _permutation;
+	uint32_t _cursor;
+public:
+	matrix_batches(matrix_t* dataset) : _dataset(dataset), _cursor(0) {}
+	uint32_t size() const { return _dataset->rows; }
+	void rewind() { _cursor = 0; }
+	void shuffle(uint32_t seed) {
+		if (_permutation.empty()) {
+			_permutation.resize(_dataset->rows);
+			for (uint32_t i=0; i<_dataset->rows; ++i) _permutation[i] = i;
+		}
+		std::mt19937 generator(seed);
+		std::shuffle(_permutation.begin(), _permutation.end(), generator);
+		_cursor = 0;
+	}
+	uint32_t next(uint32_t batch_size, scalar_t* inputs, uint32_t* record_indices) {
+		uint32_t count = MIN(batch_size, _dataset->rows - _cursor);
+		for (uint32_t i=0; i<count; ++i) {
+			uint32_t row = _permutation.empty() ? _cursor + i : _permutation[_cursor + i];
+			inputs[i] = GET_SCALAR(_dataset, row, 0);
+			record_indices[i] = GET_SCALAR(_dataset, row, 1);
+		}
+		_cursor += count;
+		return count;
+	}
+};
+
+/**
+ * @brief Mini-batches of a dataset stream
+ */
+class stream_batches {
+	rqrmi_dataset_stream_t* _stream;
+public:
+	stream_batches(rqrmi_dataset_stream_t* stream) : _stream(stream) {}
+	uint32_t size() const { return rqrmi_tools_dataset_stream_get_size(_stream); }
+	void rewind() { rqrmi_tools_dataset_stream_rewind(_stream); }
+	void shuffle(uint32_t seed) { rqrmi_tools_dataset_stream_shuffle(_stream, seed); }
+	uint32_t next(uint32_t batch_size, scalar_t* inputs, uint32_t* record_indices) {
+		return rqrmi_tools_dataset_stream_next(_stream, batch_size, inputs, record_indices);
+	}
+};
+
+/**
+ * @brief Trains a single 1 x W x 1 submodel on mini-batches of a dataset using Adam
+ * @tparam B The type of the mini-batch source, matrix_batches or stream_batches
+ * @param batches The dataset, read once for the input and output statistics and once per epoch
+ * @note Might throw exceptions
+ */
+template <typename B>
+static scalar_t train_submodel(B& batches, uint32_t num_of_records, uint32_t epochs,
+		const rqrmi_trainer_params_t* params, uint32_t seed, rqrmi_submodel_info_t* output)
+{
+	uint32_t num_of_samples = batches.size();
+	uint32_t hidden_width = params->hidden_width;
+	uint32_t batch_size = params->batch_size;
+	if (num_of_samples == 0) {
+		throw error("cannot train submodel on an empty dataset");
+	}
+	if (hidden_width == 0 || hidden_width > RQRMI_MAX_HIDDEN_WIDTH || batch_size == 0) {
+		throw error("invalid trainer parameters: hidden width " << hidden_width << ", batch size " << batch_size);
+	}
+
+	// The SIMD path evaluates all neurons of a padded width
+	uint32_t padded_width = hidden_width;
+#if defined __AVX2__ && !defined NO_RQRMI_OPT
+	padded_width = MIN(RQRMI_MAX_HIDDEN_WIDTH, (hidden_width + TRAINER_LANES - 1) / TRAINER_LANES * TRAINER_LANES);
+#endif
+
+	std::vector<scalar_t> batch_inputs(batch_size), batch_targets(batch_size);
+	std::vector<uint32_t> batch_records(batch_size);
+
+	// Calculate the input and output statistics (as in the Python library)
+	double sum = 0, sum_of_squares = 0;
+	scalar_t min_out = 1, max_out = 0;
+	batches.rewind();
+	for (uint32_t count; (count = batches.next(batch_size, batch_inputs.data(), batch_records.data())) > 0; ) {
+		for (uint32_t i=0; i<count; ++i) {
+			scalar_t target = (double)batch_records[i] / num_of_records;
+			sum += batch_inputs[i];
+			sum_of_squares += (double)batch_inputs[i] * batch_inputs[i];
+			min_out = MIN(min_out, target);
+			max_out = MAX(max_out, target);
+		}
+	}
+	scalar_t mean = sum / num_of_samples;
+	double variance = sum_of_squares / num_of_samples - (double)mean * mean;
+	scalar_t stddev = variance > 0 ? sqrt(variance) : 0;
+	if (stddev == 0) stddev = 1;
+	scalar_t output_factor = max_out - min_out;
+	if (output_factor == 0) output_factor = 1;
+
+	// Xavier uniform initialization of the weights, zero biases
+	net_values_t net, grad, moment1, moment2;
+	memset(&net, 0, sizeof(net));
+	memset(&moment1, 0, sizeof(moment1));
+	memset(&moment2, 0, sizeof(moment2));
+	std::mt19937 generator(seed);
+	scalar_t limit = sqrt(6.0 / (1 + hidden_width));
+	std::uniform_real_distribution<scalar_t> initializer(-limit, limit);
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		net.w1[k] = initializer(generator);
+	}
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		net.w2[k] = initializer(generator);
+	}
+
+	scalar_t* values = (scalar_t*)&net;
+	scalar_t* gradients = (scalar_t*)&grad;
+	scalar_t* m = (scalar_t*)&moment1;
+	scalar_t* v = (scalar_t*)&moment2;
+	double beta1_power = 1, beta2_power = 1;
+	scalar_t epoch_loss = 0;
+	uint32_t num_of_batches = (num_of_samples + batch_size - 1) / batch_size;
+
+	for (uint32_t epoch=0; epoch<epochs; ++epoch) {
+		batches.shuffle(generator());
+		epoch_loss = 0;
+
+		for (uint32_t b=0; b<num_of_batches; ++b) {
+			uint32_t current_size = batches.next(batch_size, batch_inputs.data(), batch_records.data());
+
+			// Normalize the inputs, and the outputs to be in [0, 1]
+			for (uint32_t i=0; i<current_size; ++i) {
+				scalar_t target = (double)batch_records[i] / num_of_records;
+				batch_inputs[i] = (batch_inputs[i] - mean) / stddev;
+				batch_targets[i] = (target - min_out) / output_factor;
+			}
+
+			epoch_loss += accumulate_gradients(&net, padded_width, batch_inputs.data(),
+					batch_targets.data(), current_size, &grad) / num_of_batches;
+
+			// Adam update
+			beta1_power *= ADAM_BETA1;
+			beta2_power *= ADAM_BETA2;
+			scalar_t step = params->learning_rate * sqrt(1 - beta2_power) / (1 - beta1_power);
+			for (uint32_t p=0; p<NET_VALUES_SIZE; ++p) {
+				m[p] = ADAM_BETA1 * m[p] + (1 - ADAM_BETA1) * gradients[p];
+				v[p] = ADAM_BETA2 * v[p] + (1 - ADAM_BETA2) * gradients[p] * gradients[p];
+				values[p] -= step * m[p] / (sqrt(v[p]) + ADAM_EPSILON);
+			}
+		}
+	}
+
+	// Set output
+	memset(output, 0, sizeof(rqrmi_submodel_info_t));
+	output->w0 = 1;
+	output->b0 = net.b0;
+	for (uint32_t k=0; k<hidden_width; ++k) {
+		output->w1[k] = net.w1[k];
+		output->b1[k] = net.b1[k];
+		output->w2[k] = net.w2[k];
+	}
+	output->b2 = net.b2;
+	output->hidden_width = hidden_width;
+	output->output_factor = output_factor;
+	output->output_min = min_out;
+	output->input_mean = mean;
+	output->input_stddev = stddev;
+	output->error = 0;
+	output->compiled = 1;
+
+	return epoch_loss;
+}
+
+/**
+ * @brief Trains a single 1 x W x 1 submodel on a dataset using Adam on mini-batches
+ * @param dataset A matrix. Each row is a sample with format [input, record_index], as generated by rqrmi_tools_generate_dataset
+ * @param num_of_records The number of records indexed by the model, used to normalize the expected outputs
+ * @param epochs Number of epochs to train
+ * @param params The hyper parameters
+ * @param seed Seed for weight initialization and shuffling
+ * @param[out] output The trained submodel
+ * @returns The average loss of the last epoch
+ * @note Might throw exceptions
+ */
+scalar_t rqrmi_trainer_train_submodel(matrix_t* dataset, uint32_t num_of_records, uint32_t epochs,
+		const rqrmi_trainer_params_t* params, uint32_t seed, rqrmi_submodel_info_t* output)
+{
+	matrix_batches batches(dataset);
+	return train_submodel(batches, num_of_records, epochs, params, seed, output);
+}
+
+/**
+ * @brief Trains submodels of a stage in parallel, each on its own worker thread.
+ *        Each worker streams the dataset of its current submodel.
+ * @param probe An RQRMI probing data structure
+ * @param stage_idx The stage to train
+ * @param submodel_indices The submodels to train within the stage
+ * @param num_of_submodels The number of submodels to train
+ * @param num_of_samples The dataset size per submodel
+ * @param epochs Number of epochs to train
+ * @param params The hyper parameters
+ * @param[out] output The trained submodels, indexed by submodel_indices.
+ *             Submodels with no inputs are marked as not compiled.
+ * @note  The responsibility of the stage must be calculated prior to this method
+ * @note  The probe must not be modified concurrently
+ * @note  Might throw exceptions
+ */
+void rqrmi_trainer_train_stage(rqrmi_probing_t* probe, uint32_t stage_idx, const uint32_t* submodel_indices,
+		uint32_t num_of_submodels, uint32_t num_of_samples, uint32_t epochs,
+		const rqrmi_trainer_params_t* params, rqrmi_submodel_info_t* output)
+{
+	uint32_t num_of_records = rqrmi_tools_get_num_of_records(probe);
+
+	// Train a single submodel. Its dataset is streamed in mini-batches, so only the datasets
+	// of the submodels currently trained are held in memory
+	auto train = [&](uint32_t i) {
+		rqrmi_dataset_stream_t* stream = rqrmi_tools_dataset_stream_new(probe, stage_idx, submodel_indices[i],
+				num_of_samples, false, 0);
+		if (stream == RQRMI_DATASET_STREAM_ERROR) {
+			throw error("cannot generate dataset for submodel <" << stage_idx << "," << submodel_indices[i] << ">");
+		}
+		uint32_t dataset_size = rqrmi_tools_dataset_stream_get_size(stream);
+		if (dataset_size == 0) {
+			rqrmi_tools_dataset_stream_free(stream);
+			memset(&output[i], 0, sizeof(rqrmi_submodel_info_t));
+			info("Skipping submodel <" << stage_idx << "," << submodel_indices[i] << ">, no inputs");
+			return;
+		}
+		// The seed depends only on the submodel, so the output does not depend on the number of threads
+		uint32_t seed = params->seed + stage_idx * 0x9E3779B9 + submodel_indices[i];
+		stream_batches batches(stream);
+		scalar_t loss;
+		try {
+			loss = train_submodel(batches, num_of_records, epochs, params, seed, &output[i]);
+		} catch (...) {
+			rqrmi_tools_dataset_stream_free(stream);
+			throw;
+		}
+		rqrmi_tools_dataset_stream_free(stream);
+		info("Trained submodel <" << stage_idx << "," << submodel_indices[i] << "> (dataset size: " <<
+				dataset_size << "), loss: " << loss);
+		(void)loss;
+	};
+
+	uint32_t num_of_threads = params->num_of_threads ? params->num_of_threads : std::thread::hardware_concurrency();
+
+	// Debug builds print submodel information without locking the logger
+#ifndef NDEBUG
+	num_of_threads = 1;
+#endif
+
+	num_of_threads = MIN(num_of_threads, num_of_submodels);
+	std::vector<std::exception_ptr> errors(MAX(num_of_threads, 1));
+
+	if (num_of_threads <= 1) {
+		try {
+			for (uint32_t i=0; i<num_of_submodels; ++i) train(i);
+		} catch (...) {
+			errors[0] = std::current_exception();
+		}
+	} else {
+		std::atomic<uint32_t> next_submodel(0);
+		std::vector<std::thread> threads;
+		for (uint32_t t=0; t<num_of_threads; ++t) {
+			threads.push_back(std::thread([&, t]() {
+				try {
+					for (uint32_t i = next_submodel++; i < num_of_submodels; i = next_submodel++) {
+						train(i);
+					}
+				} catch (...) {
+					errors[t] = std::current_exception();
+					next_submodel = num_of_submodels;
+				}
+			}));
+		}
+		for (uint32_t t=0; t<num_of_threads; ++t) {
+			threads[t].join();
+		}
+	}
+
+	for (uint32_t t=0; t<errors.size(); ++t) {
+		if (errors[t]) std::rethrow_exception(errors[t]);
+	}
+}
+
+/**
+ * @brief Packs RQRMI stages to a byte array, in the format read by rqrmi_load_model
+ * @param input_domain_min The minimum input of the model
+ * @param input_domain_max The maximum input of the model
+ * @param num_of_stages The number of stages to pack
+ * @param stage_widths The width of each stage
+ * @param submodels Per stage, the information of its submodels
+ * @param error_list The error of each submodel of the last stage, NULL for all zeros
+ * @param[out] size The size of the output in bytes
+ * @returns A buffer the user should free, RQRMI_TRAINER_ERROR on error
+ */
+void* rqrmi_trainer_pack_model(scalar_t input_domain_min, scalar_t input_domain_max, uint32_t num_of_stages,
+		const uint32_t* stage_widths, rqrmi_submodel_info_t** submodels, const uint32_t* error_list, uint32_t* size)
+{
+	ObjectPacker packer;
+	packer << input_domain_min << input_domain_max << num_of_stages;
+
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		packer << stage_widths[s];
+		for (uint32_t m=0; m<stage_widths[s]; ++m) {
+			const rqrmi_submodel_info_t* submodel = &submodels[s][m];
+
+			// Version 0: the submodel is not compiled
+			if (!submodel->compiled) {
+				packer << (uint8_t)0;
+				continue;
+			}
+
+			// Version 1: 3 layers with widths [1, W, 1]
+			uint32_t hidden_width = submodel->hidden_width;
+			packer << (uint8_t)1 << submodel->input_mean << submodel->input_stddev
+				   << submodel->output_factor << submodel->output_min;
+			packer << (uint32_t)3 << (uint32_t)1 << hidden_width << (uint32_t)1;
+			packer << submodel->b0 << submodel->w0;
+			for (uint32_t k=0; k<hidden_width; ++k) packer << submodel->b1[k];
+			for (uint32_t k=0; k<hidden_width; ++k) packer << submodel->w1[k];
+			packer << submodel->b2;
+			for (uint32_t k=0; k<hidden_width; ++k) packer << submodel->w2[k];
+		}
+	}
+
+	// Error list of the last stage
+	for (uint32_t m=0; m<stage_widths[num_of_stages-1]; ++m) {
+		packer << (error_list ? error_list[m] : (uint32_t)0);
+	}
+
+	unsigned char* data;
+	unsigned int data_size;
+	packer.pack(&data, &data_size);
+
+	// The output is freed by the user with free()
+	void* output = malloc(data_size);
+	if (output == NULL) {
+		warning("cannot allocate memory for packed RQRMI model");
+		delete[] data;
+		return RQRMI_TRAINER_ERROR;
+	}
+	memcpy(output, data, data_size);
+	delete[] data;
+	*size = data_size;
+	return output;
+}
+
+/**
+ * @brief Loads the trained stages of a model
+ * @throws In case the model cannot be loaded
+ */
+static rqrmi_model_t* load_trained_model(scalar_t input_domain_min, scalar_t input_domain_max, uint32_t num_of_stages,
+		const uint32_t* stage_widths, rqrmi_submodel_info_t** submodels, const uint32_t* error_list)
+{
+	uint32_t size;
+	void* buffer = rqrmi_trainer_pack_model(input_domain_min, input_domain_max, num_of_stages,
+			stage_widths, submodels, error_list, &size);
+	if (buffer == RQRMI_TRAINER_ERROR) {
+		throw error("cannot pack RQRMI model");
+	}
+	rqrmi_model_t* model = rqrmi_load_model(buffer, size);
+	free(buffer);
+	if (model == RQRMI_MODEL_ERROR) {
+		throw error("cannot load trained RQRMI model");
+	}
+	return model;
+}
+
+/**
+ * @brief Trains a complete RQRMI model over records: calculates the responsibilities,
+ *        trains each stage, and retrains submodels that do not meet the thresholds.
+ * @param records The records to index. Nx1 matrix. The key values / range start values. Should be sorted.
+ * @param num_of_stages The number of stages
+ * @param stage_widths The width of each stage
+ * @param epochs The number of epochs per stage
+ * @param params The hyper parameters
+ * @param[out] size The size of the output in bytes
+ * @returns The packed model, the user should free it. RQRMI_TRAINER_ERROR on error.
+ */
+void* rqrmi_trainer_train_model(matrix_t* records, uint32_t num_of_stages, const uint32_t* stage_widths,
+		const uint32_t* epochs, const rqrmi_trainer_params_t* params, uint32_t* size)
+{
+	if (num_of_stages == 0 || records->rows == 0) {
+		warning("cannot train RQRMI model with no stages or no records");
+		return RQRMI_TRAINER_ERROR;
+	}
+
+	rqrmi_probing_t* probe = rqrmi_tools_probe_new(records, num_of_stages, (uint32_t*)stage_widths);
+	if (probe == RQRMI_PROBING_ERROR) {
+		warning("cannot create RQRMI probe");
+		return RQRMI_TRAINER_ERROR;
+	}
+
+	// The input domain of the model
+	scalar_t input_domain_min = GET_SCALAR(records, 0, 0);
+	scalar_t input_domain_max = GET_SCALAR(records, 0, 0);
+	for (uint32_t i=1; i<records->rows; ++i) {
+		input_domain_min = MIN(input_domain_min, GET_SCALAR(records, i, 0));
+		input_domain_max = MAX(input_domain_max, GET_SCALAR(records, i, 0));
+	}
+
+	// All submodels are initially not compiled
+	std::vector<std::vector<rqrmi_submodel_info_t>> stages(num_of_stages);
+	std::vector<rqrmi_submodel_info_t*> stage_pointers(num_of_stages);
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		rqrmi_submodel_info_t empty;
+		memset(&empty, 0, sizeof(empty));
+		stages[s].resize(stage_widths[s], empty);
+		stage_pointers[s] = stages[s].data();
+	}
+
+	rqrmi_model_t* model = RQRMI_MODEL_ERROR;
+	void* output = RQRMI_TRAINER_ERROR;
+
+	try {
+		for (uint32_t s=0; s<num_of_stages; ++s) {
+
+			// The responsibility of stage 0 is the input domain
+			if (s > 0 && rqrmi_tools_calculate_responsibility(model, probe, s) == VECTOR_LIST_ERROR) {
+				throw error("cannot calculate responsibility of stage " << s);
+			}
+
+			std::vector<uint32_t> submodels_to_train(stage_widths[s]);
+			for (uint32_t m=0; m<stage_widths[s]; ++m) submodels_to_train[m] = m;
+			uint32_t num_of_samples = params->samples_per_bucket;
+
+			// Repeat the training process
+			for (uint32_t t=0; t<params->retraining_times; ++t) {
+
+				info("Training stage " << s << " iteration " << t << " with " << submodels_to_train.size() <<
+						" submodels and " << num_of_samples << " samples per submodel");
+
+				std::vector<rqrmi_submodel_info_t> trained(submodels_to_train.size());
+				rqrmi_trainer_train_stage(probe, s, submodels_to_train.data(), submodels_to_train.size(),
+						num_of_samples, epochs[s], params, trained.data());
+				for (uint32_t i=0; i<submodels_to_train.size(); ++i) {
+					stages[s][submodels_to_train[i]] = trained[i];
+				}
+
+				// Load the trained stages
+				rqrmi_free_model(model);
+				model = RQRMI_MODEL_ERROR;
+				model = load_trained_model(input_domain_min, input_domain_max, s+1, stage_widths, stage_pointers.data(), NULL);
+				if (rqrmi_tools_calculate_transition_set(model, probe, s) == VECTOR_LIST_ERROR) {
+					throw error("cannot calculate transition set of stage " << s);
+				}
+
+				// Retrain shallow submodels based on their bucket coverage,
+				// and deep submodels based on their maximum error
+				submodels_to_train.clear();
+				for (uint32_t m=0; m<stage_widths[s]; ++m) {
+					scalar_pair_t error_coverage = rqrmi_tools_calculate_submodel_error(model, probe, s, m);
+					if (s < num_of_stages-1 && error_coverage.second < params->threshold_bucket_coverage) {
+						submodels_to_train.push_back(m);
+					}
+					if (s == num_of_stages-1 && error_coverage.first > params->threshold_submodel_error) {
+						submodels_to_train.push_back(m);
+					}
+				}
+
+				// In case no need to retrain
+				if (submodels_to_train.empty()) break;
+
+				// More samples = less error = more training time
+				num_of_samples *= params->retraining_multiplier;
+			}
+		}
+
+		// Pin the error values of the last stage
+		uint32_t last_stage = num_of_stages-1;
+		std::vector<uint32_t> error_list(stage_widths[last_stage]);
+		for (uint32_t m=0; m<stage_widths[last_stage]; ++m) {
+			scalar_t max_error = rqrmi_tools_calculate_submodel_error(model, probe, last_stage, m).first;
+			error_list[m] = max_error < 0 ? 0 : (uint32_t)max_error;
+		}
+
+		output = rqrmi_trainer_pack_model(input_domain_min, input_domain_max, num_of_stages,
+				stage_widths, stage_pointers.data(), error_list.data(), size);
+
+	} catch (const std::exception& e) {
+		warning(e.what());
+		output = RQRMI_TRAINER_ERROR;
+	}
+
+	rqrmi_free_model(model);
+	rqrmi_tools_probe_free(probe);
+	return output;
+}
+
+/**
+ * @brief Returns the number of sorted values smaller than or equal to x
+ */
+static uint32_t count_less_equal(const std::vector<scalar_t>& values, scalar_t x) {
+	return std::upper_bound(values.begin(), values.end(), x) - values.begin();
+}
+
+/**
+ * @brief Retrains an existing RQRMI model after some of its records changed.
+ *        The internal stages are kept, hence the responsibilities of the last stage do not change.
+ *        Only last stage submodels whose responsibility contains changed records are retrained;
+ *        the output of other submodels is shifted to the new record indices.
+ * @param packed_model The packed model to retrain, as read by rqrmi_load_model
+ * @param packed_size The size of the packed model in bytes
+ * @param old_records The records indexed by the model. Nx1 matrix. Should be sorted.
+ * @param new_records The records to index. Mx1 matrix. Should be sorted.
+ * @param epochs The number of epochs for the last stage
+ * @param params The hyper parameters
+ * @param[out] size The size of the output in bytes
+ * @param[out] num_of_retrained The number of retrained submodels, may be NULL
+ * @returns The packed model, the user should free it. RQRMI_TRAINER_ERROR on error.
+ */
+void* rqrmi_trainer_retrain_model(void* packed_model, uint32_t packed_size, matrix_t* old_records, matrix_t* new_records,
+		uint32_t epochs, const rqrmi_trainer_params_t* params, uint32_t* size, uint32_t* num_of_retrained)
+{
+	if (old_records->rows == 0 || new_records->rows == 0) {
+		warning("cannot retrain RQRMI model with no records");
+		return RQRMI_TRAINER_ERROR;
+	}
+
+	rqrmi_model_t* model = rqrmi_load_model(packed_model, packed_size);
+	if (model == RQRMI_MODEL_ERROR) {
+		warning("cannot load RQRMI model");
+		return RQRMI_TRAINER_ERROR;
+	}
+
+	uint32_t num_of_stages = rqrmi_get_num_of_stages(model);
+	uint32_t last_stage = num_of_stages-1;
+	if (num_of_stages < 2) {
+		warning("cannot retrain a single stage model incrementally");
+		rqrmi_free_model(model);
+		return RQRMI_TRAINER_ERROR;
+	}
+	std::vector<uint32_t> stage_widths(num_of_stages);
+	for (uint32_t s=0; s<num_of_stages; ++s) {
+		stage_widths[s] = rqrmi_get_num_of_submodels(model, s);
+	}
+
+	// The input domain must cover the new records
+	scalar_pair_t input_domain = rqrmi_get_input_domain(model);
+	for (uint32_t i=0; i<new_records->rows; ++i) {
+		input_domain.first = MIN(input_domain.first, GET_SCALAR(new_records, i, 0));
+		input_domain.second = MAX(input_domain.second, GET_SCALAR(new_records, i, 0));
+	}
+
+	rqrmi_probing_t* probe = rqrmi_tools_probe_new(new_records, num_of_stages, stage_widths.data());
+	if (probe == RQRMI_PROBING_ERROR) {
+		warning("cannot create RQRMI probe");
+		rqrmi_free_model(model);
+		return RQRMI_TRAINER_ERROR;
+	}
+
+	void* output = RQRMI_TRAINER_ERROR;
+	rqrmi_model_t* trained_model = RQRMI_MODEL_ERROR;
+
+	try {
+
+		// Copy the current submodels
+		std::vector<std::vector<rqrmi_submodel_info_t>> stages(num_of_stages);
+		std::vector<rqrmi_submodel_info_t*> stage_pointers(num_of_stages);
+		for (uint32_t s=0; s<num_of_stages; ++s) {
+			stages[s].resize(stage_widths[s]);
+			for (uint32_t m=0; m<stage_widths[s]; ++m) {
+				if (!rqrmi_get_submodel_info(model, s, m, &stages[s][m])) {
+					throw error("cannot read submodel <" << s << "," << m << "> (not an RQRMI model?)");
+				}
+			}
+			stage_pointers[s] = stages[s].data();
+		}
+
+		// Calculate the responsibilities of the last stage
+		for (uint32_t s=0; s<last_stage; ++s) {
+			if (rqrmi_tools_calculate_transition_set(model, probe, s) == VECTOR_LIST_ERROR) {
+				throw error("cannot calculate transition set of stage " << s);
+			}
+			if (rqrmi_tools_calculate_responsibility(model, probe, s+1) == VECTOR_LIST_ERROR) {
+				throw error("cannot calculate responsibility of stage " << s+1);
+			}
+		}
+		vector_list_t** responsibilities = rqrmi_tools_calculate_responsibility(model, probe, last_stage);
+
+		// The records that were either added or removed
+		std::vector<scalar_t> old_values(old_records->rows), new_values(new_records->rows), changed_values;
+		for (uint32_t i=0; i<old_records->rows; ++i) old_values[i] = GET_SCALAR(old_records, i, 0);
+		for (uint32_t i=0; i<new_records->rows; ++i) new_values[i] = GET_SCALAR(new_records, i, 0);
+		std::set_symmetric_difference(old_values.begin(), old_values.end(), new_values.begin(), new_values.end(),
+				std::back_inserter(changed_values));
+
+		// Find the submodels that should be retrained. Other submodels are shifted:
+		// their outputs are normalized by the number of records, and all record indices within
+		// their responsibility moved by the same shift.
+		scalar_t old_size = old_values.size();
+		scalar_t new_size = new_values.size();
+		std::vector<uint32_t> submodels_to_train;
+		for (uint32_t m=0; m<stage_widths[last_stage]; ++m) {
+			bool affected = !stages[last_stage][m].compiled;
+			bool first_interval = true;
+			int shift = 0;
+
+			scalar_t* interval = (scalar_t*)vector_list_begin(responsibilities[m]);
+			for (; interval && !affected; interval = (scalar_t*)vector_list_iterate(responsibilities[m])) {
+				// Changed records within the interval
+				auto it = std::lower_bound(changed_values.begin(), changed_values.end(), interval[0]);
+				affected = (it != changed_values.end()) && (*it <= interval[1]);
+				// All intervals must have the same shift
+				int current_shift = (int)count_less_equal(new_values, interval[0]) - (int)count_less_equal(old_values, interval[0]);
+				affected |= !first_interval && (current_shift != shift);
+				shift = current_shift;
+				first_interval = false;
+			}
+
+			// Skip submodels with empty responsibility
+			if (first_interval) continue;
+
+			if (affected) {
+				submodels_to_train.push_back(m);
+			} else {
+				rqrmi_submodel_info_t& submodel = stages[last_stage][m];
+				submodel.output_min = (submodel.output_min * old_size + shift) / new_size;
+				submodel.output_factor = submodel.output_factor * old_size / new_size;
+			}
+		}
+
+		info("Retraining " << submodels_to_train.size() << " out of " << stage_widths[last_stage] <<
+				" submodels (" << changed_values.size() << " changed records)");
+		if (num_of_retrained) {
+			*num_of_retrained = 0;
+		}
+
+		// Retrain the affected submodels, and those that do not meet the error threshold
+		std::vector<uint32_t> error_list(stage_widths[last_stage]);
+		uint32_t num_of_samples = params->samples_per_bucket;
+		for (uint32_t t=0; t<params->retraining_times; ++t) {
+
+			if (!submodels_to_train.empty()) {
+				if (num_of_retrained) {
+					*num_of_retrained += submodels_to_train.size();
+				}
+				std::vector<rqrmi_submodel_info_t> trained(submodels_to_train.size());
+				rqrmi_trainer_train_stage(probe, last_stage, submodels_to_train.data(), submodels_to_train.size(),
+						num_of_samples, epochs, params, trained.data());
+				for (uint32_t i=0; i<submodels_to_train.size(); ++i) {
+					stages[last_stage][submodels_to_train[i]] = trained[i];
+				}
+			}
+
+			// The transition set of the last stage is expensive to calculate, use the exact errors instead
+			rqrmi_free_model(trained_model);
+			trained_model = RQRMI_MODEL_ERROR;
+			trained_model = load_trained_model(input_domain.first, input_domain.second, num_of_stages,
+					stage_widths.data(), stage_pointers.data(), NULL);
+			rqrmi_tools_calculate_exact_errors(trained_model, new_values.data(), NULL, new_values.size(), error_list.data());
+
+			submodels_to_train.clear();
+			for (uint32_t m=0; m<stage_widths[last_stage]; ++m) {
+				if (error_list[m] > params->threshold_submodel_error) {
+					submodels_to_train.push_back(m);
+				}
+			}
+
+			// In case no need to retrain
+			if (submodels_to_train.empty()) break;
+
+			// More samples = less error = more training time
+			num_of_samples *= params->retraining_multiplier;
+		}
+
+		output = rqrmi_trainer_pack_model(input_domain.first, input_domain.second, num_of_stages,
+				stage_widths.data(), stage_pointers.data(), error_list.data(), size);
+
+	} catch (const std::exception& e) {
+		warning(e.what());
+		output = RQRMI_TRAINER_ERROR;
+	}
+
+	rqrmi_free_model(trained_model);
+	rqrmi_free_model(model);
+	rqrmi_tools_probe_free(probe);
+	return output;
+}
@@ -29,51 +29,169 @@
 #include <logging.h>
 #include <matrix_operations.h>
 
-typedef struct vector_list_node {
-	struct vector_list_node* prev;
-	struct vector_list_node* next;
-	void* elements;
-} vector_list_node_t;
+// Arena allocations are rounded up to powers of two, starting from this size (bytes)
+#define ARENA_MIN_CLASS_SIZE 32
+#define ARENA_NUM_OF_CLASSES 32
+// Arena memory is allocated from the system in slabs of (at least) this size (bytes)
+#define ARENA_SLAB_SIZE (1<<20)
+// The initial capacity of a list (vectors)
+#define LIST_INITIAL_CAPACITY 4
+
+// Used to mark an invalid iterator
+#define INVALID_CURSOR 0xffffffff
+
+/**
+ * @brief An arena of memory blocks, recycled by their size class and freed in bulk
+ */
+struct vector_arena {
+	void* free_blocks[ARENA_NUM_OF_CLASSES];
+	void** slabs;
+	uint32_t num_of_slabs;
+	uint32_t slab_capacity;
+	char* slab_cursor;
+	size_t slab_remaining;
+};
 
 struct vector_list {
 	uint32_t size;
 	uint32_t width;
-	vector_list_node_t* head;
-	vector_list_node_t* tail;
-	vector_list_node_t* cursor;
+	uint32_t capacity;
+	uint32_t cursor;
+	scalar_t* elements;
+	vector_arena_t* arena;
 };
 
 /**
- * @brief Creates a new instance of vector list of width @a width
+ * @brief Returns the size class of an arena block with at least size bytes
+ */
+static uint32_t arena_class(size_t size) {
+	uint32_t size_class = 0;
+	while (((size_t)ARENA_MIN_CLASS_SIZE << size_class) < size) ++size_class;
+	return size_class;
+}
+
+/**
+ * @brief Allocates a block from an arena, or from the heap in case the arena is NULL
+ * @returns The block, or NULL on error
+ */
+static void* arena_allocate(vector_arena_t* arena, size_t size) {
+	if (arena == NULL) {
+		return malloc(size);
+	}
+
+	uint32_t size_class = arena_class(size);
+	if (size_class >= ARENA_NUM_OF_CLASSES) return NULL;
+	size_t block_size = (size_t)ARENA_MIN_CLASS_SIZE << size_class;
+
+	// Recycle a freed block
+	if (arena->free_blocks[size_class] != NULL) {
+		void* block = arena->free_blocks[size_class];
+		arena->free_blocks[size_class] = *(void**)block;
+		return block;
+	}
+
+	// Allocate a new slab
+	if (arena->slab_remaining < block_size) {
+		if (arena->num_of_slabs == arena->slab_capacity) {
+			uint32_t new_capacity = arena->slab_capacity ? 2*arena->slab_capacity : 16;
+			void** slabs = (void**)realloc(arena->slabs, sizeof(void*)*new_capacity);
+			if (slabs == NULL) return NULL;
+			arena->slabs = slabs;
+			arena->slab_capacity = new_capacity;
+		}
+		size_t slab_size = block_size > ARENA_SLAB_SIZE ? block_size : ARENA_SLAB_SIZE;
+		char* slab = (char*)malloc(slab_size);
+		if (slab == NULL) return NULL;
+		arena->slabs[arena->num_of_slabs++] = slab;
+		arena->slab_cursor = slab;
+		arena->slab_remaining = slab_size;
+	}
+
+	void* block = arena->slab_cursor;
+	arena->slab_cursor += block_size;
+	arena->slab_remaining -= block_size;
+	return block;
+}
+
+/**
+ * @brief Returns a block to the arena for recycling, or to the heap in case the arena is NULL
+ */
+static void arena_release(vector_arena_t* arena, void* block, size_t size) {
+	if (block == NULL) return;
+	if (arena == NULL) {
+		free(block);
+		return;
+	}
+	uint32_t size_class = arena_class(size);
+	*(void**)block = arena->free_blocks[size_class];
+	arena->free_blocks[size_class] = block;
+}
+
+/**
+ * @brief Creates a new memory arena for vector lists
+ * @returns The arena or VECTOR_ARENA_ERROR in case of an error
+ */
+vector_arena_t* vector_arena_create() {
+	vector_arena_t* arena = (vector_arena_t*)malloc(sizeof(vector_arena_t));
+	if (arena == NULL) {
+		return VECTOR_ARENA_ERROR;
+	}
+	memset(arena, 0, sizeof(vector_arena_t));
+	return arena;
+}
+
+/**
+ * @brief Frees an arena with all the lists that were created in it
+ * @param arena A vector list arena
+ */
+void vector_arena_free(vector_arena_t* arena) {
+	if (arena == VECTOR_ARENA_ERROR) return;
+	for (uint32_t i=0; i<arena->num_of_slabs; ++i) {
+		free(arena->slabs[i]);
+	}
+	free(arena->slabs);
+	free(arena);
+}
+
+/**
+ * @brief Creates a new instance of vector list of width @a width in an arena
  * @param width The width of each vector in the list
+ * @param arena The arena to allocate the list from, NULL for the heap
  * @returns The instance or VECTOR_LIST_ERROR in case of an error
  */
-vector_list_t* vector_list_create(uint32_t width) {
-	vector_list_t* list = (vector_list_t*)malloc(sizeof(vector_list_t));
+vector_list_t* vector_list_create_in_arena(uint32_t width, vector_arena_t* arena) {
+	vector_list_t* list = (vector_list_t*)arena_allocate(arena, sizeof(vector_list_t));
 	if (list == NULL) {
 		return VECTOR_LIST_ERROR;
 	}
 	list->size=0;
 	list->width=width;
-	list->head=NULL;
-	list->tail=NULL;
-	list->cursor=NULL;
+	list->capacity=0;
+	list->cursor=INVALID_CURSOR;
+	list->elements=NULL;
+	list->arena=arena;
 	return list;
 }
 
+/**
+ * @brief Creates a new instance of vector list of width @a width
+ * @param width The width of each vector in the list
+ * @returns The instance or VECTOR_LIST_ERROR in case of an error
+ */
+vector_list_t* vector_list_create(uint32_t width) {
+	return vector_list_create_in_arena(width, NULL);
+}
+
 /**
  * @brief Frees a list
  * @param list a vector list
+ * @note  Lists in arenas are recycled by their arena
  */
 void vector_list_free(vector_list_t* list) {
 	if (list == VECTOR_LIST_ERROR) return;
-	vector_list_node_t* current = list->head;
-	while(current != NULL) {
-		free(current->elements);
-		vector_list_node_t* prev = current;
-		current=current->next;
-		free(prev);
-	}
+	vector_arena_t* arena = list->arena;
+	arena_release(arena, list->elements, sizeof(scalar_t)*list->width*list->capacity);
+	arena_release(arena, list, sizeof(vector_list_t));
 }
 
 /**
@@ -89,41 +207,47 @@ uint32_t vector_list_get_size(vector_list_t* list) {
  * @brief Adds new empty vector to the list
  * @param list Pointer to the list
  * @returns On success returns 1, otherwise 0
+ * @note  Invalidates pointers to the vectors of the list in case the list grows
  */
 int vector_list_push_back(vector_list_t* list) {
 	if (list == VECTOR_LIST_ERROR) return 0;
 
-	vector_list_node_t* node = (vector_list_node_t*)malloc(sizeof(vector_list_node_t));
-	if (node == NULL) return 0;
-
-	void* elements = (void*)malloc(sizeof(scalar_t)*list->width);
-	if (elements == NULL) {
-		free(node);
-		return 0;
+	// Grow the list
+	if (list->size == list->capacity) {
+		uint32_t new_capacity = list->capacity ? 2*list->capacity : LIST_INITIAL_CAPACITY;
+		size_t vector_size = sizeof(scalar_t)*list->width;
+		scalar_t* elements = (scalar_t*)arena_allocate(list->arena, vector_size*new_capacity);
+		if (elements == NULL) return 0;
+		if (list->size > 0) {
+			memcpy(elements, list->elements, vector_size*list->size);
+		}
+		arena_release(list->arena, list->elements, vector_size*list->capacity);
+		list->elements = elements;
+		list->capacity = new_capacity;
 	}
 
 	// Initialize all elements to be zero
-	memset(elements, 0, list->width*sizeof(scalar_t));
-	node->prev = list->tail;
-	node->next = NULL;
-	node->elements = elements;
-
-	// Update list tail
-	if (list->tail != NULL) {
-		list->tail->next = node;
-	}
-	list->tail = node;
-
-	// Update list head
-	if (list->head == NULL) {
-		list->head = node;
-	}
+	memset(list->elements + list->size*list->width, 0, list->width*sizeof(scalar_t));
 
 	// Update list size
 	++list->size;
 	return 1;
 }
 
+/**
+ * @brief Returns the index of a position (negative numbers allowed)
+ * @note Might throw exceptions
+ */
+static uint32_t list_index(vector_list_t* list, int pos) {
+	if (list == VECTOR_LIST_ERROR || list->size == 0) {
+		throw error("invalid inputs");
+	}
+	int size = list->size;
+	pos %= size;
+	if (pos < 0) pos += size;
+	return pos;
+}
+
 /**
  * @brief Removes node at position fro a vector list
  * @param pos The position of the vector (negative numbers allowed)
@@ -131,37 +255,19 @@ int vector_list_push_back(vector_list_t* list) {
  * @note Might throw exceptions
  */
 void vector_list_remove_at(vector_list_t* list, int pos) {
-	if (list == VECTOR_LIST_ERROR || list->size == 0) {
-		throw error("invalid inputs");
-	}
+	uint32_t index = list_index(list, pos);
 
-	// Get the relevant node
-	vector_list_node_t* node = list->head;
-	while(pos<0) pos+=list->size;
-	pos %= list->size;
-	for (int i=0; i<pos; ++i) {
-		node=node->next;
+	// In case the vector is the cursor, move cursor to previous
+	if (list->cursor != INVALID_CURSOR && list->cursor >= index) {
+		list->cursor = list->cursor > 0 ? list->cursor-1 : INVALID_CURSOR;
 	}
 
-	if (node == NULL) return;
-
-	// In case the node is the cursor, move cursor to previous
-	if (list->cursor == node) list->cursor=list->cursor->prev;
-
-	// Update connectivity to previous
-	if (node == list->head) list->head = node->next;
-	else node->prev->next = node->next;
-
-	// Update connectivity to next
-	if (node == list->tail) list->tail = node->prev;
-	else node->next->prev = node->prev;
+	// Close the gap
+	memmove(list->elements + index*list->width, list->elements + (index+1)*list->width,
+			sizeof(scalar_t)*list->width*(list->size-index-1));
 
 	// Update size
 	--list->size;
-
-	// Remove node
-	free(node->elements);
-	free(node);
 }
 
 /**
@@ -171,21 +277,7 @@ void vector_list_remove_at(vector_list_t* list, int pos) {
  * @note Might throw exceptions
  */
 void* vector_list_get(vector_list_t* list, int pos) {
-	if (list == VECTOR_LIST_ERROR || list->size == 0) {
-		throw error("invalid inputs");
-	}
-
-	// Get the relevant node
-	vector_list_node_t* node = list->head;
-	while(pos<0) pos+=list->size;
-	pos %= list->size;
-	for (int i=0; i<pos; ++i) {
-		node=node->next;
-	}
-
-	// Get the element
-	if (node == NULL) throw error("Cannot get vector with pos " << pos);
-	return node->elements;
+	return list->elements + list_index(list, pos)*list->width;
 }
 
 /**
@@ -197,7 +289,7 @@ void* vector_list_get_last(vector_list_t* list) {
 	if (list == VECTOR_LIST_ERROR || list->size == 0) {
 		throw error("invalid inputs");
 	}
-	return list->tail->elements;
+	return list->elements + (list->size-1)*list->width;
 }
 
 /**
@@ -209,7 +301,7 @@ void* vector_list_push_back_and_get(vector_list_t* list) {
 	if (!vector_list_push_back(list)) {
 		throw error("Error while pushing back new element");
 	}
-	return list->tail->elements;
+	return list->elements + (list->size-1)*list->width;
 }
 
 /**
@@ -222,11 +314,12 @@ void* vector_list_begin(vector_list_t* list) {
 	if (list == VECTOR_LIST_ERROR) {
 		throw error("Got VECTOR_LIST_ERROR: " << list);
 	}
-	list->cursor=list->head;
-	if (list->cursor != NULL) {
-		return list->cursor->elements;
+	if (list->size == 0) {
+		list->cursor = INVALID_CURSOR;
+		return NULL;
 	}
-	return NULL;
+	list->cursor = 0;
+	return list->elements;
 }
 
 /**
@@ -240,13 +333,23 @@ void* vector_list_iterate(vector_list_t* list) {
 		throw error("Got VECTOR_LIST_ERROR: " << list);
 	}
 	// In case of invalid iterator
-	if (list->cursor == NULL) return VECTOR_LIST_ERROR;
+	if (list->cursor == INVALID_CURSOR) return VECTOR_LIST_ERROR;
 	// Get next element
-	list->cursor = list->cursor->next;
-	// In case of invalid iterator
-	if (list->cursor == NULL) return VECTOR_LIST_ERROR;
-	// Return the elements of the current node
-	return list->cursor->elements;
+	if (++list->cursor >= list->size) {
+		list->cursor = INVALID_CURSOR;
+		return VECTOR_LIST_ERROR;
+	}
+	return list->elements + list->cursor*list->width;
+}
+
+/**
+ * @brief Returns a pointer to the contiguous vectors of the list
+ * @returns The vectors (row major, width scalars each), NULL for empty lists
+ * @note  The pointer is invalidated when the list grows
+ */
+scalar_t* vector_list_data(vector_list_t* list) {
+	if (list == VECTOR_LIST_ERROR || list->size == 0) return NULL;
+	return list->elements;
 }
 
 
@@ -286,12 +389,9 @@ matrix_t* vector_list_to_matrix(vector_list_t* list) {
 	if (mat == MATRIX_ERROR) {
 		throw error("cannot allocate memory for output matrix");
 	}
-	vector_list_node_t* cursor = list->head;
-	for (uint32_t r=0; r<mat->rows; ++r) {
-		for (uint32_t c=0; c<mat->cols; ++c) {
-			GET_SCALAR(mat,r,c) = ((scalar_t*)cursor->elements)[c];
-		}
-		cursor=cursor->next;
+	// Both are row major
+	if (list->size > 0) {
+		memcpy(mat->elements, list->elements, sizeof(scalar_t)*list->size*list->width);
 	}
 	return mat;
 }
@@ -310,6 +410,13 @@ void vector_list_sort(vector_list_t* list, uint32_t col, int(*compare)(const voi
 	if (list == VECTOR_LIST_ERROR || list->width <= col) {
 		throw error("vector_list_sort: Got invalid input");
 	}
+	if (list->size == 0) return;
+
+	// The vectors are contiguous, and can be sorted in place by the first column
+	if (col == 0) {
+		qsort(list->elements, list->size, list->width*sizeof(scalar_t), compare);
+		return;
+	}
 
 	// Create a temporary array with shuffled values
 	scalar_t* arr = (scalar_t*)malloc(sizeof(scalar_t)*list->size*list->width);
@@ -317,15 +424,13 @@ void vector_list_sort(vector_list_t* list, uint32_t col, int(*compare)(const voi
 	int counter = 0;
 
 	// Fill data to temporary array
-	vector_list_node_t* node = list->head;
 	for (uint32_t i=0; i<list->size; i++) {
-		scalar_t* elements = (scalar_t*)node->elements;
+		scalar_t* elements = list->elements + i*list->width;
 		arr[counter++] = elements[col];
 		for (uint32_t j=0; j<list->width; j++) {
 			if (j == col) continue;
 			arr[counter++] = elements[j];
 		}
-		node=node->next;
 	}
 
 	// Quicksort the temporary array
@@ -333,18 +438,15 @@ void vector_list_sort(vector_list_t* list, uint32_t col, int(*compare)(const voi
 
 	// Update list values
 	counter = 0;
-	node = list->head;
 	for (uint32_t i=0; i<list->size; i++) {
-		scalar_t* elements = (scalar_t*)node->elements;
+		scalar_t* elements = list->elements + i*list->width;
 		elements[col]=arr[counter++];
 		for (uint32_t j=0; j<list->width; j++) {
 			if (j == col) continue;
 			elements[j]=arr[counter++];
 		}
-		node=node->next;
 	}
 
 	// Free temporary memory
 	free(arr);
 }
-
@@ -0,0 +1,216 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * This micro-benchmark is used to check a single iSet.
+ * Use it to load one iSet out of a NuevoMatch classifier file, and classify a trace with it.
+ * The RQRMI inference, the secondary search and the validation phase are measured separately,
+ * for every supported batch size.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include <x86intrin.h>
+
+#include <logging.h>
+#include <object_io.h>
+#include <argument_handler.h>
+#include <rule_db.h>
+#include <interval_set.h>
+#include <nuevomatch.h>
+
+// Holds information regarding the simulation
+const char* classifier_filename = NULL;
+uint32_t iset_index = 0;
+uint32_t max_batch_size = 0;
+int repeats = 1;
+trace_packet* trace = NULL;
+uint32_t num_of_packets = 0;
+
+// Holds arguments information
+static argument_t my_arguments[] = {
+		// Name,		Required,	IsBoolean,	Default,	Help
+		{"-f",			1,			0,			NULL,		"NuevoMatch classifier filename to load"},
+		{"-t",			1,			0,			NULL,		"Textual trace filename"},
+		{"-i",			0,			0,			"0",		"The index of the iSet to load"},
+		{"-n",			0,			0,			NULL,		"Number of packets to read from the trace (default: all)"},
+		{"-r",			0,			0,			"1",		"Number of repeats"},
+		{"--max-batch",	0,			0,			"512",		"The maximal batch size to measure"},
+		{NULL,			0,			0,			NULL,		"iSet benchmark tool. Compile library with 'make release'. "} /* Sentinel */
+};
+
+/**
+ * @brief Holds the cycles spent at each phase of the iSet
+ */
+struct phase_cycles_t {
+	uint64_t inference;
+	uint64_t search;
+	uint64_t validation;
+	uint32_t matches;
+};
+
+/**
+ * @brief Classifies the trace by the iSet, measures each phase separately
+ * @param iset The iSet
+ * @param batches The packets of the trace, arranged in batches
+ * @param rqrmi_info Holds the RQRMI information per batch
+ * @param positions Holds the secondary search output per packet
+ */
+template <uint32_t N>
+phase_cycles_t run_phases(IntervalSet<N>* iset, std::vector<PacketBatch<N>>& batches,
+		std::vector<IntervalSetInfoBatch<N>>& rqrmi_info, std::vector<uint32_t>& positions)
+{
+	phase_cycles_t output = {0, 0, 0, 0};
+	uint32_t num_of_batches = batches.size();
+
+	// RQRMI inference
+	uint64_t start_cycles = __rdtsc();
+	for (uint32_t b=0; b<num_of_batches; ++b) {
+		rqrmi_info[b] = iset->rqrmi_search(batches[b]);
+	}
+	output.inference = __rdtsc() - start_cycles;
+
+	// Secondary search
+	start_cycles = __rdtsc();
+	for (uint32_t b=0; b<num_of_batches; ++b) {
+		for (uint32_t i=0; i<N; ++i) {
+			IntervalSet<N>::secondary_search_multi(&iset, 1, &rqrmi_info[b], i, &positions[b*N+i]);
+		}
+	}
+	output.search = __rdtsc() - start_cycles;
+
+	// Validation phase
+	start_cycles = __rdtsc();
+	for (uint32_t b=0; b<num_of_batches; ++b) {
+		for (uint32_t i=0; i<N; ++i) {
+			if (batches[b][i] == nullptr) continue;
+			classifier_output_t result = iset->do_validation(batches[b][i], positions[b*N+i]);
+			output.matches += (result.priority >= 0);
+		}
+	}
+	output.validation = __rdtsc() - start_cycles;
+
+	return output;
+}
+
+/**
+ * @brief Measures the iSet with batch size N, reports the results
+ */
+template <uint32_t N>
+void measure_batch_size() {
+
+	// Load the iSet with batch size N
+	ObjectReader reader(classifier_filename);
+	IntervalSet<N>* iset = NuevoMatch<N>::load_iset(reader, iset_index);
+
+	// Arrange the packets in batches, pad the last one with invalid packets
+	uint32_t num_of_batches = (num_of_packets + N - 1) / N;
+	std::vector<PacketBatch<N>> batches(num_of_batches);
+	for (uint32_t i=0; i<num_of_batches*N; ++i) {
+		batches[i/N][i%N] = (i < num_of_packets) ? trace[i].get() : nullptr;
+	}
+	std::vector<IntervalSetInfoBatch<N>> rqrmi_info(num_of_batches);
+	std::vector<uint32_t> positions(num_of_batches*N);
+
+	// Warm cache
+	run_phases(iset, batches, rqrmi_info, positions);
+
+	// Take the minimum of each phase over all repeats, to filter out interrupts
+	struct timespec start_time, end_time;
+	phase_cycles_t cycles = {(uint64_t)-1, (uint64_t)-1, (uint64_t)-1, 0};
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for (int r=0; r<repeats; ++r) {
+		phase_cycles_t current = run_phases(iset, batches, rqrmi_info, positions);
+		cycles.inference = std::min(cycles.inference, current.inference);
+		cycles.search = std::min(cycles.search, current.search);
+		cycles.validation = std::min(cycles.validation, current.validation);
+		cycles.matches = current.matches;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+	double total_clock_us = (end_time.tv_sec * 1e9 + end_time.tv_nsec - start_time.tv_sec * 1e9 - start_time.tv_nsec)/1000;
+	double throughput = (double)num_of_packets * repeats / total_clock_us;
+
+	printf("%-10u %-12.2lf %-12.2lf %-12.2lf %-12.3lf %u\n", N,
+			(double)cycles.inference / num_of_packets,
+			(double)cycles.search / num_of_packets,
+			(double)cycles.validation / num_of_packets,
+			throughput, cycles.matches);
+
+	delete iset;
+}
+
+/**
+ * @brief Measures all batch sizes from N up to the maximal batch size
+ */
+template <uint32_t N>
+void measure_batch_sizes() {
+	if (N > max_batch_size) return;
+	measure_batch_size<N>();
+	measure_batch_sizes<N*2>();
+}
+
+template <>
+void measure_batch_sizes<1024>() {}
+
+int main(int argc, char** argv) {
+
+	// Print message buffer to stderr
+	SimpleLogger::get().set_sticky_force(true);
+
+	// Parse arguments
+	parse_arguments(argc, argv, my_arguments);
+	classifier_filename = ARG("-f")->value;
+	iset_index = atoi(ARG("-i")->value);
+	repeats = atoi(ARG("-r")->value);
+	max_batch_size = atoi(ARG("--max-batch")->value);
+
+	// Read the trace
+	message_s("Reading trace file...");
+	trace = read_trace_file(ARG("-t")->value, std::vector<uint32_t>(), &num_of_packets);
+	if (trace == NULL || num_of_packets == 0) {
+		throw error("Cannot read trace file. Exiting.");
+	}
+	if (ARG("-n")->available) {
+		num_of_packets = std::min(num_of_packets, (uint32_t)atoi(ARG("-n")->value));
+	}
+
+	message_s("Measuring iSet " << iset_index << " with " << num_of_packets << " packets, " <<
+			repeats << " repeats (cycles per packet)...");
+	printf("%-10s %-12s %-12s %-12s %-12s %s\n", "batch", "inference", "search", "validation", "Mpps", "matches");
+
+	// Catch iSet errors
+	try {
+		measure_batch_sizes<1>();
+	} catch (const std::exception& e) {
+		warning(e.what());
+		throw error("iSet benchmark failed. Compile with DEBUG flag for extended info. Exiting");
+	}
+
+	// Free memory
+	message_s("Done");
+	delete[] trace;
+}
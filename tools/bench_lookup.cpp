@@ -22,46 +22,58 @@
  */
 
 /**
- * This micro-benchmark is used to check the RQRMI inference.
- * Use it to load a model from the file-system, and generate samples for inference
+ * This micro-benchmark is used to check the RQRMI lookup.
+ * Use it to load a model from the file-system, and generate samples for lookup.
+ * Compares the pipelined lookup (LookupCPU, two worker threads) with the
+ * inline lookup (LookupInline, calling thread) across batch sizes.
+ * With --updatable, runs a steady insert/delete stream alongside lookups
+ * (LookupUpdatable) and validates the results against a reference.
  */
 
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <atomic>
 #include <map>
+#include <vector>
+#include <thread>
 #include <time.h>
 
 #include <logging.h>
 #include <argument_handler.h>
+#include <string_operations.h>
 #include <object_io.h>
 #include <matrix_operations.h>
 #include <algorithms.h>
 #include <lookup.h>
+#include <lookup_updatable.h>
 
 using namespace std;
 
-// Define batch size for lookups
-#define BATCH 128
+// A lookup result, the same for all batch sizes
+typedef Lookup<1>::result_t result_t;
 
 scalar_t *samples;
-map<scalar_t, typename LookupCPU<BATCH>::result_t> expected_results;
+map<scalar_t, uint32_t> expected_results;
+result_t *results;
 volatile uint32_t num_of_results = 0;
 
-
-LookupCPU<BATCH>::result_t *results;
-
-void generate_dataset(uint32_t num_of_samples, LookupCPU<BATCH>* lookup);
-void perform_lookup(uint32_t num_of_samples, Lookup<BATCH>* lookup);
+void generate_dataset(uint32_t num_of_samples, Lookup<1>* lookup);
 
 // Holds arguments information
 static argument_t my_arguments[] = {
-		// Name,	Required,	IsBoolean,	Default,	Help
-		{"-f",		1,			0,			NULL,		"Lookup data filename to load"},
-		{"-s",		0,			0,			"256",		"Lookup queue size"},
-		{"-n",		1,			0,			NULL,		"Number of random generated samples"},
-		{"-r",		0,			0,			NULL,		"Number of repeats"},
-		{NULL,		0,			0,			NULL,		"Lookup benchmark tool."} /* Sentinel */
+		// Name,		Required,	IsBoolean,	Default,					Help
+		{"-f",			1,			0,			NULL,						"Lookup data filename to load"},
+		{"-s",			0,			0,			"256",						"Lookup queue size"},
+		{"-n",			1,			0,			NULL,						"Number of random generated samples"},
+		{"-r",			0,			0,			NULL,						"Number of repeats"},
+		{"--mode",		0,			0,			"both",						"Lookup mode: cpu (worker threads), inline (calling thread), or both"},
+		{"--batches",	0,			0,			"1,4,8,16,32,64,128",		"Comma separated batch sizes to measure"},
+		{"--updatable",	0,			1,			NULL,						"Run a steady insert/delete stream alongside lookups (LookupUpdatable), validate against a reference"},
+		{"--updates",	0,			0,			"20000",					"Number of updates per batch size with --updatable"},
+		{"--threshold",	0,			0,			"1024",						"The delta size that triggers a merge with --updatable"},
+		{NULL,			0,			0,			NULL,						"Lookup benchmark tool."} /* Sentinel */
 };
 
 
@@ -71,6 +83,7 @@ static argument_t my_arguments[] = {
 class MyListener : public LookupListener {
 protected:
 	void on_new_result(scalar_t input, uint32_t index, int found) {
+		// Skip padding inputs
 		if (input < 0) return;
 		results[num_of_results].found = found;
 		results[num_of_results].input = input;
@@ -79,24 +92,119 @@ protected:
 	}
 };
 
+/**
+ * @brief Performs the lookup of all samples with LookupCPU
+ */
+template <uint32_t N>
+void perform_lookup(uint32_t num_of_samples, LookupCPU<N>* lookup) {
+	typename LookupCPU<N>::batch_t job;
+
+	// Out of domain inputs are not reported
+	for (uint32_t i=0; i<num_of_samples; i+=N) {
+		for (uint32_t j=0; j<N; ++j) {
+			job[j] = (i+j < num_of_samples) ? samples[i+j] : -1;
+		}
+		while (!lookup->search(job));
+	}
 
-int main(int argc, char** argv) {
+	// Wait for all results
+	while (num_of_results < num_of_samples) {
+		continue;
+	}
 
-	// Print message buffer to stderr
-	SimpleLogger::get().set_sticky_force(true);
+	num_of_results=0;
+}
 
-	// Parse arguments
-	parse_arguments(argc, argv, my_arguments);
-	const char* filename=my_arguments[0].value;
-	int queue_size=atoi(my_arguments[1].value);
-	uint32_t num_of_samples=atoi(my_arguments[2].value);
-	int repeats = my_arguments[3].available ? atoi(my_arguments[3].value) : 1;
+/**
+ * @brief Performs the lookup of all samples with LookupInline
+ */
+template <uint32_t N>
+void perform_lookup(uint32_t num_of_samples, LookupInline<N>* lookup) {
+	scalar_t job[N];
+	typename LookupInline<N>::result_t output[N];
+
+	// The remainder is padded
+	for (uint32_t i=0; i<num_of_samples; i+=N) {
+		uint32_t count = MIN(N, num_of_samples-i);
+		for (uint32_t j=0; j<N; ++j) {
+			job[j] = (j < count) ? samples[i+j] : -1;
+		}
+		lookup->search(job, output);
+		for (uint32_t j=0; j<count; ++j) {
+			results[i+j].input = output[j].input;
+			results[i+j].index = output[j].index;
+			results[i+j].found = output[j].found;
+		}
+	}
+}
 
-	// Open the file
-	ObjectReader handler(filename);
+/**
+ * @brief Starts measuring the worker statistics of LookupCPU
+ */
+template <uint32_t N>
+void start_statistics(LookupCPU<N>* lookup) {
+	lookup->start_performance_measurement();
+}
+
+/**
+ * @brief LookupInline has no worker threads, hence no statistics
+ */
+template <uint32_t N>
+void start_statistics(LookupInline<N>* lookup) {}
+
+/**
+ * @brief Stops measuring the worker statistics of LookupCPU, prints them
+ */
+template <uint32_t N>
+void stop_statistics(LookupCPU<N>* lookup) {
+	lookup->stop_performance_measurement();
+	lookup->print();
+}
+
+/**
+ * @brief LookupInline has no worker threads, hence no statistics
+ */
+template <uint32_t N>
+void stop_statistics(LookupInline<N>* lookup) {}
+
+/**
+ * @brief Validates the results of a lookup
+ * @returns The number of errors
+ */
+uint32_t validate_results(uint32_t num_of_samples, Lookup<1>* reference) {
+	uint32_t errors = 0;
+	for (uint32_t i=0; i<num_of_samples; ++i) {
+		// Search for current result
+		auto it = expected_results.find(results[i].input);
+		if (it == expected_results.end() && results[i].found == 1) {
+			message_s("Error with input: sample " << results[i].input << " was found in lookup but not in database");
+			++errors;
+		} else if (it != expected_results.end() && results[i].found == 0) {
+			message_s("Error with input: sample " << results[i].input << " was not found in lookup but was in database");
+			++errors;
+		} else if (it != expected_results.end() && results[i].index != it->second) {
+			scalar_pair_t actual_result = reference->get_record(results[i].index);
+			scalar_pair_t expected_result = reference->get_record(it->second);
+			message_s("Error with input " << results[i].input << ". Actual index: " <<
+					results[i].index << " [" <<  actual_result.first << "," << actual_result.second <<
+					"). Expected index: " << it->second << " [" << expected_result.first << "," << expected_result.second << ")");
+			++errors;
+		}
+	}
+	return errors;
+}
+
+/**
+ * @brief Measures a lookup with batch size N
+ * @tparam L The lookup class
+ * @returns The average time per sample in microseconds
+ */
+template <typename L>
+double measure_lookup(const char* filename, uint32_t queue_size, uint32_t num_of_samples, int repeats) {
 
 	// Create a new instance
-	LookupCPU<BATCH>* lookup = new LookupCPU<BATCH>();
+	ObjectReader handler(filename);
+	L* lookup = new L();
 	lookup->set_queue_size(queue_size);
 	lookup->load(handler);
 
@@ -109,26 +217,20 @@ int main(int argc, char** argv) {
 
 	// Catch model evaluation errors
 	try {
-
-		// Generate the samples
-		generate_dataset(num_of_samples, lookup);
-
-		// Warm cache (is it necessary?)
-		message_s("Warming cache...");
+		// Warm cache
 		for (int j=0; j<repeats*3; ++j) {
 			perform_lookup(num_of_samples, lookup);
 		}
 
-		// Simulate until number of packets
-		message_s("Starting simulation (batching: " << BATCH << ")...");
-		lookup->start_performance_measurement();
+		start_statistics(lookup);
 		clock_gettime(CLOCK_MONOTONIC, &start_time);
-		// Repeat R times
 		for(int r=0; r<repeats; r++) {
 			perform_lookup(num_of_samples, lookup);
 		}
 		clock_gettime(CLOCK_MONOTONIC, &end_time);
-		lookup->stop_performance_measurement();
+
+		// Print worker statistics of lookup
+		stop_statistics(lookup);
 
 	} catch (const std::exception& e) {
 		warning(e.what());
@@ -136,38 +238,231 @@ int main(int argc, char** argv) {
 	}
 
 	double total_clock_us = (end_time.tv_sec * 1e9 + end_time.tv_nsec - start_time.tv_sec * 1e9 - start_time.tv_nsec)/1000;
+	delete lookup;
+	return total_clock_us/num_of_samples/repeats;
+}
+
+/**
+ * @brief Measures and validates both lookup modes with batch size N
+ */
+template <uint32_t N>
+void run_benchmark(const char* filename, uint32_t queue_size, uint32_t num_of_samples, int repeats,
+		bool cpu_mode, bool inline_mode, Lookup<1>* reference)
+{
+	double cpu_us = 0, inline_us = 0;
+	uint32_t cpu_errors = 0, inline_errors = 0;
+	if (cpu_mode) {
+		cpu_us = measure_lookup<LookupCPU<N>>(filename, queue_size, num_of_samples, repeats);
+		cpu_errors = validate_results(num_of_samples, reference);
+	}
+	if (inline_mode) {
+		inline_us = measure_lookup<LookupInline<N>>(filename, queue_size, num_of_samples, repeats);
+		inline_errors = validate_results(num_of_samples, reference);
+	}
+
+	std::string line = SimpleLogger::format("Batch %3u: ", N);
+	if (cpu_mode) {
+		line += SimpleLogger::format("cpu %.4f us/sample (%u errors) ", cpu_us, cpu_errors);
+	}
+	if (inline_mode) {
+		line += SimpleLogger::format("inline %.4f us/sample (%u errors) ", inline_us, inline_errors);
+	}
+	if (cpu_mode && inline_mode) {
+		line += SimpleLogger::format("speedup %.2fx", cpu_us / inline_us);
+	}
+	message_s(line);
+}
 
-	long total_samples=num_of_samples;
+/**
+ * @brief Applies updates to an updatable lookup and to a reference of its live records.
+ *        Alternately deletes a random live record, and inserts back a random deleted record
+ *        with half of its length.
+ * @param lookup The updatable lookup
+ * @param num_of_updates The number of updates to apply
+ * @param[in,out] live The live records (start to end)
+ * @param[in,out] live_starts The starts of all live records, for random selection
+ * @param[in,out] removed The deleted records
+ * @returns The number of failed updates
+ */
+template <uint32_t N>
+uint32_t apply_updates(LookupUpdatable<N>* lookup, uint32_t num_of_updates, map<scalar_t, scalar_t>& live,
+		vector<scalar_t>& live_starts, vector<scalar_pair_t>& removed)
+{
+	uint32_t failed = 0;
+	for (uint32_t i=0; i<num_of_updates; ++i) {
+		if (i % 2 == 0 || removed.empty()) {
+			uint32_t pos = rand() % live_starts.size();
+			scalar_t start = live_starts[pos];
+			live_starts[pos] = live_starts.back();
+			live_starts.pop_back();
+			removed.push_back((scalar_pair_t){ start, live[start] });
+			live.erase(start);
+			failed += !lookup->remove(start);
+		} else {
+			uint32_t pos = rand() % removed.size();
+			scalar_pair_t record = removed[pos];
+			removed[pos] = removed.back();
+			removed.pop_back();
+			scalar_t middle = record.first + (record.second - record.first) / 2;
+			if (middle > record.first) {
+				record.second = middle;
+			}
+			live[record.first] = record.second;
+			live_starts.push_back(record.first);
+			failed += !lookup->insert(record.first, record.second);
+		}
+	}
+	return failed;
+}
 
-	message_s("Total time to simulate " << num_of_samples << " samples: " << total_clock_us <<
-			" us. Average time per sample: " << total_clock_us/total_samples/repeats << " us.");
+/**
+ * @brief Measures lookups with batch size N alongside a steady stream of updates,
+ *        validates the results against a reference of the live records
+ */
+template <uint32_t N>
+void run_updatable(const char* filename, uint32_t num_of_samples, uint32_t num_of_updates,
+		uint32_t merge_threshold, Lookup<1>* reference)
+{
+	const uint32_t num_of_rounds = 10;
+	typename LookupUpdatable<N>::result_t output[N];
+	scalar_t job[N];
+
+	LookupUpdatable<N> lookup(merge_threshold);
+	lookup.load(ObjectReader(filename));
+
+	// The live records
+	map<scalar_t, scalar_t> live;
+	vector<scalar_t> live_starts;
+	vector<scalar_pair_t> removed;
+	for (uint32_t i=0; i<reference->get_size(); ++i) {
+		scalar_pair_t record = reference->get_record(i);
+		live[record.first] = record.second;
+		live_starts.push_back(record.first);
+	}
 
-	// Print worker statistics of lookup
-	lookup->print();
+	uint32_t errors = 0, failed_updates = 0;
+	uint64_t num_of_lookups = 0;
+	double lookup_us = 0, update_us = 0;
+	struct timespec start_time, end_time;
 
-	// Check correctness
-	message_s("Validating correctness...");
-	for (uint32_t i=0; i<num_of_results; ++i) {
-		// Search for current result
-		auto it = expected_results.find(results[i].input);
-		if (it == expected_results.end() && results[i].found == 1) {
-			message_s("Error with input: sample " << results[i].input << " was found in lookup but not in database");
-		} else if (it != expected_results.end() && results[i].found == 0) {
-			message_s("Error with input: sample " << results[i].input << " was not found in lookup but was in database");
-		} else if (it != expected_results.end() && results[i].found) {
-			if (results[i].index != it->second.index) {
-				scalar_pair_t actual_result = lookup->get_record(results[i].index);
-				scalar_pair_t expected_result = lookup->get_record(it->second.index);
-				message_s("Error with input " << results[i].input << ". Actual index: " <<
-						results[i].index << " [" <<  actual_result.first << "," << actual_result.second <<
-						"). Expected index: %u [" << expected_result.first << "," << expected_result.second << ")");
+	for (uint32_t r=0; r<num_of_rounds; ++r) {
+
+		// Apply updates on another thread, while looking up on this one
+		std::atomic<bool> updating(true);
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		std::thread updater([&]() {
+			failed_updates += apply_updates(&lookup, num_of_updates / num_of_rounds, live, live_starts, removed);
+			updating = false;
+		});
+		while (updating) {
+			for (uint32_t i=0; i<num_of_samples && updating; i+=N) {
+				for (uint32_t j=0; j<N; ++j) {
+					job[j] = samples[(i+j) % num_of_samples];
+				}
+				lookup.search(job, output);
+				num_of_lookups += N;
+				// The records change during lookups, only check that found records hold their keys
+				for (uint32_t j=0; j<N; ++j) {
+					if (output[j].found && !(output[j].start <= job[j] && job[j] < output[j].end)) {
+						message_s("Error with input " << job[j] << ": found record [" << output[j].start <<
+								"," << output[j].end << ") that does not hold it");
+						++errors;
+					}
+				}
+			}
+		}
+		updater.join();
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		update_us += (end_time.tv_sec * 1e9 + end_time.tv_nsec - start_time.tv_sec * 1e9 - start_time.tv_nsec)/1000;
+
+		// Validate all samples once the updates of the round are done
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		for (uint32_t i=0; i<num_of_samples; i+=N) {
+			for (uint32_t j=0; j<N; ++j) {
+				job[j] = (i+j < num_of_samples) ? samples[i+j] : -1;
+			}
+			lookup.search(job, output);
+			for (uint32_t j=0; j<N && i+j<num_of_samples; ++j) {
+				auto it = live.upper_bound(job[j]);
+				bool found = (it != live.begin()) && (job[j] < (--it)->second);
+				if (found != (bool)output[j].found || (found && output[j].start != it->first)) {
+					message_s("Error with input " << job[j] << ": found " << output[j].found <<
+							" [" << output[j].start << "," << output[j].end << "), expected " << found);
+					++errors;
+				}
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		lookup_us += (end_time.tv_sec * 1e9 + end_time.tv_nsec - start_time.tv_sec * 1e9 - start_time.tv_nsec)/1000;
+	}
+
+	message_s(SimpleLogger::format("Batch %3u: updatable %.4f us/sample (quiescent), %.0f updates/s with %lu concurrent lookups, "
+			"%u merges, delta size %u, %u failed updates, %u errors",
+			N, lookup_us / num_of_samples / num_of_rounds, num_of_updates / update_us * 1e6, num_of_lookups,
+			lookup.get_num_of_merges(), lookup.get_delta_size(), failed_updates, errors));
+}
+
+int main(int argc, char** argv) {
+
+	// Print message buffer to stderr
+	SimpleLogger::get().set_sticky_force(true);
+
+	// Parse arguments
+	parse_arguments(argc, argv, my_arguments);
+	const char* filename=ARG("-f")->value;
+	int queue_size=atoi(ARG("-s")->value);
+	uint32_t num_of_samples=atoi(ARG("-n")->value);
+	int repeats = ARG("-r")->available ? atoi(ARG("-r")->value) : 1;
+	const char* mode = ARG("--mode")->value;
+	bool cpu_mode = !strcmp(mode, "cpu") || !strcmp(mode, "both");
+	bool inline_mode = !strcmp(mode, "inline") || !strcmp(mode, "both");
+	bool updatable_mode = ARG("--updatable")->available;
+	uint32_t num_of_updates = atoi(ARG("--updates")->value);
+	uint32_t merge_threshold = atoi(ARG("--threshold")->value);
+	if (!cpu_mode && !inline_mode) {
+		throw error("Unknown lookup mode '" << mode << "'. Exiting.");
+	}
+	std::vector<uint32_t> batches = string_operations::split<uint32_t>(ARG("--batches")->value, ",", string_operations::str2int);
+
+	// The reference lookup is only used for reading records
+	ObjectReader handler(filename);
+	LookupInline<1> reference;
+	reference.load(handler);
+
+	// Generate the samples
+	generate_dataset(num_of_samples, &reference);
+
+	message_s("Starting simulation (mode: " << (updatable_mode ? "updatable" : mode) << ", repeats: " << repeats << ")...");
+	for (uint32_t batch : batches) {
+		if (updatable_mode) {
+			switch (batch) {
+			case 1: run_updatable<1>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 4: run_updatable<4>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 8: run_updatable<8>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 16: run_updatable<16>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 32: run_updatable<32>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 64: run_updatable<64>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			case 128: run_updatable<128>(filename, num_of_samples, num_of_updates, merge_threshold, &reference); break;
+			default: warning("Batch size " << batch << " is not supported (1, 4, 8, 16, 32, 64, 128)");
 			}
+			continue;
+		}
+		switch (batch) {
+		case 1: run_benchmark<1>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 4: run_benchmark<4>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 8: run_benchmark<8>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 16: run_benchmark<16>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 32: run_benchmark<32>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 64: run_benchmark<64>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		case 128: run_benchmark<128>(filename, queue_size, num_of_samples, repeats, cpu_mode, inline_mode, &reference); break;
+		default: warning("Batch size " << batch << " is not supported (1, 4, 8, 16, 32, 64, 128)");
 		}
 	}
 
 	// Free memory
+	free(samples);
+	free(results);
 	message_s("Done");
-	delete lookup;
 }
 
 /**
@@ -175,65 +470,28 @@ int main(int argc, char** argv) {
  * @param num_of_samples Number of required samples
  * @param lookup The lookup object
  */
-void generate_dataset(uint32_t num_of_samples, LookupCPU<BATCH>* lookup) {
+void generate_dataset(uint32_t num_of_samples, Lookup<1>* lookup) {
 
 	message_s("Generating " << num_of_samples << " samples for database with " << lookup->get_size() << " pairs...");
 
 	// Generate the samples DB
 	samples = (scalar_t*)malloc(sizeof(scalar_t) * num_of_samples);
-	results = (LookupCPU<BATCH>::result_t*)malloc(sizeof(LookupCPU<BATCH>::result_t) * num_of_samples);
+	results = (result_t*)malloc(sizeof(result_t) * num_of_samples);
 	if (samples == NULL || results == NULL) {
 		throw error("Cannot allocate memory for generated samples. Exiting.");
 	}
 
-	// Initialize randomization
-	srand(time(NULL));
-
 	uint32_t counter=0;
 	for (uint32_t i=0; i<num_of_samples; ++i) {
 
 		scalar_pair_t range = lookup->get_record(counter);
 		scalar_t range_start = range.first;
 		scalar_t range_end = SCALAR_PREV(range.second); //inclusive
-		counter = (counter+1) % lookup->get_size();
 
 		// Get random key between start and end
 		scalar_t key = gen_uniform_random_scalar(range_start, range_end);
 		samples[i] = key;
-		expected_results[key].index = i;
-	}
-}
-
-/**
- * @brief Performs the lookup
- */
-void perform_lookup(uint32_t num_of_samples, Lookup<BATCH>* lookup) {
-	Lookup<BATCH>::batch_t job;
-
-	// First handle the remainder
-	uint32_t rem = num_of_samples % BATCH;
-	for (uint32_t i=0; i<rem; ++i) {
-		job[i] = i;
-	}
-	for (uint32_t i=rem; i<BATCH; ++i) {
-		job[i] = -1; // Invalid
-	}
-	while (!lookup->search(job));
-
-	// Handle all the rest
-	for (uint32_t i=rem; i<num_of_samples; i+=BATCH) {
-		// Build job
-		for (uint32_t j=0; j<BATCH; ++j) {
-			job[j] = rem+i+j;
-		}
-		// Perform lookup
-		while (!lookup->search(job));
-	}
-
-	// Wait for all results
-	while (num_of_results < num_of_samples) {
-		continue;
+		expected_results[key] = counter;
+		counter = (counter+1) % lookup->get_size();
 	}
-
-	num_of_results=0;
 }
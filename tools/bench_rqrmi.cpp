@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <x86intrin.h>
 
 #include <algorithms.h>
 #include <logging.h>
@@ -36,13 +37,17 @@
 #include <matrix_operations.h>
 #include <rqrmi_model.h>
 #include <rqrmi_fast.h>
+#include <rqrmi_fast_quantized.h>
+#include <rule_db.h>
 #include <argument_handler.h>
 
 void generate_dataset(int num_of_samples);
+void read_dataset(int num_of_samples, const char* trace_filename, uint32_t column);
 
 // Holds information regarding the simulation
 int num_of_samples = 0;
 bool use_fast = false;
+bool cold_cache = false;
 scalar_t* samples = NULL;
 scalar_t* results = NULL;
 
@@ -50,23 +55,32 @@ scalar_t* results = NULL;
 static argument_t my_arguments[] = {
 		// Name,		Required,	IsBoolean,	Default,	Help
 		{"-f",			1,			0,			NULL,		"RQRMI filename to load"},
-		{"-n",			1,			0,			NULL,		"Number of random generated samples"},
+		{"-n",			1,			0,			NULL,		"Number of samples"},
 		{"-p",			0,			1,			NULL,		"Store & print results at the end (alters performance measurements)"},
+		{"--trace",		0,			0,			NULL,		"Draw the samples from a textual trace file instead of random values"},
+		{"--column",	0,			0,			"0",		"The header column of the trace to use as samples"},
+		{"--cold",		0,			1,			NULL,		"Evict the model from all cache levels before each evaluation. Requires --fast."},
+		{"--stages",	0,			1,			NULL,		"Report the cycles spent at each stage of the model"},
 
 		/* Use RQRMIfast for performing calculation */
 		{"--fast",		0,			1,			NULL,		"(Optimization) Set to true for using fast RQRMI evaluation. "
 															"The SIMD engine should be set in compilation time. "
 															"Works only for RQRMI models, not RMI."},
+		{"--quantized",	0,			1,			NULL,		"(Optimization) Set to true for using int16 fixed-point RQRMI evaluation. "
+															"Implies --fast."},
 		{NULL,			0,			0,			NULL,		"RQRMI benchmark tool. Compile library with 'make release'. "} /* Sentinel */
 };
 
 /**
  * @brief Performs fast RQRMI inference using SIMD acceleration
  * @param rqrmi_fast An RQRMIFast instance
+ * @returns The number of TSC cycles spent on evaluation
+ * @note In cold-cache mode only the evaluation itself is measured
  */
-void fast_evaluate(void* arg) {
+uint64_t fast_evaluate(void* arg) {
 	RQRMIFast& rqrmi_fast = *(RQRMIFast*)arg;
 	wide_scalar_t inputs, outputs, status, error;
+	uint64_t cycles = 0, start_cycles = __rdtsc();
 	// Perform fast evaluation using vector of inputs
 	infof("Running batches from main samples...");
 	int i;
@@ -74,7 +88,14 @@ void fast_evaluate(void* arg) {
 		for (uint32_t k=0; k<rqrmi_fast.input_width(); ++k) {
 			inputs.scalars[k] = samples[i+k];
 		}
-		rqrmi_fast.evaluate(inputs, status, outputs, error);
+		if (cold_cache) {
+			rqrmi_fast.flush_caches();
+			uint64_t current = __rdtsc();
+			rqrmi_fast.evaluate(inputs, status, outputs, error);
+			cycles += __rdtsc() - current;
+		} else {
+			rqrmi_fast.evaluate(inputs, status, outputs, error);
+		}
 		for (uint32_t k=0; k<rqrmi_fast.input_width(); ++k) {
 			results[i+k] = outputs.scalars[k];
 		}
@@ -86,21 +107,80 @@ void fast_evaluate(void* arg) {
 	for (; i<num_of_samples; ++i) {
 		inputs.scalars[counter++] = samples[i];
 	}
-	rqrmi_fast.evaluate(inputs, status, outputs, error);
+	if (cold_cache) {
+		rqrmi_fast.flush_caches();
+		uint64_t current = __rdtsc();
+		rqrmi_fast.evaluate(inputs, status, outputs, error);
+		cycles += __rdtsc() - current;
+	} else {
+		rqrmi_fast.evaluate(inputs, status, outputs, error);
+		cycles = __rdtsc() - start_cycles;
+	}
 	for (uint32_t k=0; k<counter; ++k) {
 		results[start+k] = outputs.scalars[k];
 	}
+	return cycles;
 }
 
 /**
  * @brief Performs slow RMI/RQRMI inference using generic engine
  * @param model A pointer to an RQRMI model
+ * @returns The number of TSC cycles spent on evaluation
  */
-void slow_evaluate(void* arg) {
+uint64_t slow_evaluate(void* arg) {
 	rqrmi_model_t* model = (rqrmi_model_t*)arg;
+	uint64_t start_cycles = __rdtsc();
 	for (int i=0; i<num_of_samples; ++i) {
 		results[i] = rqrmi_evaluate_model(model, samples[i]);
 	}
+	return __rdtsc() - start_cycles;
+}
+
+/**
+ * @brief Creates an evaluation instance for the model, by the tool arguments
+ */
+RQRMIFast* create_instance(rqrmi_model_t* model, bool use_quantized) {
+	if (use_quantized) {
+		return new RQRMIFastQuantized(model);
+	}
+	return RQRMIFast::create(model);
+}
+
+/**
+ * @brief Measures the cycles spent at each stage of the model. Stage s is measured by
+ *        the difference between evaluating the model truncated to s+1 stages and to s stages.
+ * @param model The RQRMI model
+ * @param use_quantized Whether to measure the quantized evaluation
+ * @param evaluations The number of times all samples were evaluated by each measurement
+ */
+void measure_stages(rqrmi_model_t* model, bool use_quantized, uint32_t evaluations) {
+	uint32_t num_of_stages = rqrmi_get_num_of_stages(model);
+	uint64_t previous = 0;
+	double vectors = (num_of_samples + RQRMIFast::input_width() - 1) / RQRMIFast::input_width();
+
+	for (uint32_t s=1; s<=num_of_stages; ++s) {
+		rqrmi_set_num_of_stages(model, s);
+		RQRMIFast* rqrmi_fast = use_fast ? create_instance(model, use_quantized) : nullptr;
+
+		// Take the minimum over all evaluations, to filter out interrupts
+		uint64_t cycles = (uint64_t)-1;
+		for (uint32_t j=0; j<evaluations; ++j) {
+			uint64_t current = use_fast ? fast_evaluate(rqrmi_fast) : slow_evaluate(model);
+			cycles = std::min(cycles, current);
+		}
+		delete rqrmi_fast;
+
+		uint64_t stage_cycles = cycles > previous ? cycles - previous : 0;
+		if (use_fast) {
+			loggerf("Stage %u: %.2lf cycles per vector, %.2lf cycles per lane (cumulative: %.2lf cycles per vector)",
+					s-1, stage_cycles/vectors, (double)stage_cycles/num_of_samples, cycles/vectors);
+		} else {
+			loggerf("Stage %u: %.2lf cycles per sample (cumulative: %.2lf cycles per sample)",
+					s-1, (double)stage_cycles/num_of_samples, (double)cycles/num_of_samples);
+		}
+		previous = cycles;
+	}
+	rqrmi_set_num_of_stages(model, num_of_stages);
 }
 
 int main(int argc, char** argv) {
@@ -110,6 +190,7 @@ int main(int argc, char** argv) {
 	const char* model_filename=ARG("-f")->value;
 	num_of_samples=atoi( ARG("-n")->value );
 	bool print_results = ARG("-p")->available;
+	cold_cache = ARG("--cold")->available;
 
 	// Open the file
 	ObjectReader reader(model_filename);
@@ -125,20 +206,41 @@ int main(int argc, char** argv) {
 	struct timespec start_time, end_time;
 
 	// Do we use AVX, SSR or normal computation?
-	use_fast = ARG("--fast")->available;
-	RQRMIFast rqrmi_fast = RQRMIFast(model);
+	bool use_quantized = ARG("--quantized")->available;
+	use_fast = ARG("--fast")->available || use_quantized;
+	RQRMIFast* rqrmi_fast = create_instance(model, use_quantized);
+	if (use_quantized) {
+		logger("Using RQRMIFastQuantized (" << rqrmi_fast->get_num_of_stages() << " stages, hidden width " <<
+				rqrmi_fast->get_hidden_width() << ")");
+	} else if (use_fast) {
+		logger("Using RQRMIFast " << (rqrmi_fast->is_specialized() ? "specialized" : "generic") <<
+				" path (" << rqrmi_fast->get_num_of_stages() << " stages, hidden width " <<
+				rqrmi_fast->get_hidden_width() << ")");
+	}
+
+	// The generic model cannot be evicted from cache
+	if (cold_cache && !use_fast) {
+		warning("Cold-cache mode requires --fast. Measuring with warm cache.");
+		cold_cache = false;
+	}
 
 	// Catch model evaluation errors
 	// Generate the samples
-	loggerf("Generating %d samples...", num_of_samples);
-	generate_dataset(num_of_samples);
+	if (ARG("--trace")->available) {
+		uint32_t column = atoi(ARG("--column")->value);
+		loggerf("Reading %d samples from column %u of trace...", num_of_samples, column);
+		read_dataset(num_of_samples, ARG("--trace")->value, column);
+	} else {
+		loggerf("Generating %d samples...", num_of_samples);
+		generate_dataset(num_of_samples);
+	}
 
 	// Set inference method
-	void(*inference_method)(void*);
+	uint64_t(*inference_method)(void*);
 	void* arg;
 	if (use_fast) {
 		inference_method = fast_evaluate;
-		arg = &rqrmi_fast;
+		arg = rqrmi_fast;
 	} else {
 		inference_method = slow_evaluate;
 		arg = model;
@@ -146,14 +248,15 @@ int main(int argc, char** argv) {
 
 	// Warm cache (is it necessary?)
 	logger("Warming cache...");
-	for (int j=0; j<100000/num_of_samples; ++j) {
+	int warmup_evaluations = 100000/num_of_samples;
+	for (int j=0; j<warmup_evaluations; ++j) {
 		inference_method(arg);
 	}
 
 	// Simulate until number of packets
-	logger("Starting simulation...");
+	logger("Starting simulation (" << (cold_cache ? "cold" : "warm") << " cache)...");
 	clock_gettime(CLOCK_MONOTONIC, &start_time);
-	inference_method(arg);
+	uint64_t total_cycles = inference_method(arg);
 	clock_gettime(CLOCK_MONOTONIC, &end_time);
 
 
@@ -164,6 +267,22 @@ int main(int argc, char** argv) {
 		"Average time per sample: %.7lf us.",
 		num_of_samples, total_clock_us, total_clock_us/total_packets);
 
+	// Report cycles. Each vector evaluates input_width lanes at once
+	if (use_fast) {
+		uint32_t vectors = (num_of_samples + RQRMIFast::input_width() - 1) / RQRMIFast::input_width();
+		loggerf("Total cycles: %lu. Cycles per vector: %.2lf. Cycles per lane: %.2lf.",
+				total_cycles, (double)total_cycles/vectors, (double)total_cycles/total_packets);
+	} else {
+		loggerf("Total cycles: %lu. Cycles per sample: %.2lf.",
+				total_cycles, (double)total_cycles/total_packets);
+	}
+
+	// Report cycles per stage
+	if (ARG("--stages")->available) {
+		logger("Measuring cycles per stage...");
+		measure_stages(model, use_quantized, MAX(warmup_evaluations, 1));
+	}
+
 	// Print results to stdout only if necessary
 	if (print_results) {
 		loggerf("Printing results to stdout");
@@ -173,16 +292,24 @@ int main(int argc, char** argv) {
 	}
 
 	// Free memory
+	delete rqrmi_fast;
 	rqrmi_free_model(model);
 }
 
-void generate_dataset(int num_of_samples) {
-	// Generate the samples DB
+/**
+ * @brief Allocates the samples and results arrays
+ */
+void allocate_dataset(int num_of_samples) {
 	samples = (scalar_t*)malloc(sizeof(scalar_t) * num_of_samples);
 	results = (scalar_t*)malloc(sizeof(scalar_t) * num_of_samples);
 	if (samples == NULL || results == NULL) {
 		throw error("Cannot allocate memory for generated samples. Exiting.");
 	}
+}
+
+void generate_dataset(int num_of_samples) {
+	// Generate the samples DB
+	allocate_dataset(num_of_samples);
 
 	// Initialize randomization
 	srand(time(NULL));
@@ -192,3 +319,24 @@ void generate_dataset(int num_of_samples) {
 	}
 }
 
+/**
+ * @brief Reads the samples from a column of a textual trace file.
+ *        The trace is repeated in case it holds less packets than required.
+ */
+void read_dataset(int num_of_samples, const char* trace_filename, uint32_t column) {
+	uint32_t num_of_packets;
+	trace_packet* trace = read_trace_file(trace_filename, std::vector<uint32_t>(), &num_of_packets);
+	if (trace == NULL || num_of_packets == 0) {
+		throw error("Cannot read samples from trace file. Exiting.");
+	}
+	if (column >= trace[0].header.size()) {
+		throw error("Trace has only " << trace[0].header.size() << " columns. Exiting.");
+	}
+
+	allocate_dataset(num_of_samples);
+	for (int i=0; i<num_of_samples; ++i) {
+		samples[i] = trace[i % num_of_packets].header[column];
+	}
+	delete[] trace;
+}
+
@@ -470,8 +470,6 @@ GenericClassifier* mode_nuevomatch() {
 		config.remainder_classifier = new NeuroCuts();
 	} else if (!strcmp(remainder_type, "tuplemerge")) {
 		config.remainder_classifier = new TupleMerge();
-		 // Note: this is due to licb critical error when trying to build base on previous data and failing!
-		config.force_rebuilding_remainder = true;
 	} else {
 		throw errorf("Remainder classifier type is not valid. Got '%s'.", remainder_type);
 	}
@@ -0,0 +1,316 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * This tool trains an RQRMI model natively, without the Python library.
+ * Use it to index a textual file of records (one key / range start per line),
+ * and write a model file that can be loaded by bench_rqrmi or by the Python library.
+ * With --base, an existing model is retrained incrementally: only last stage submodels
+ * whose responsibility contains added or removed records are retrained.
+ * With --lookup64, the records are also read as 64-bit integer keys, and a Lookup64
+ * file of the model and the keys is written.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include <logging.h>
+#include <argument_handler.h>
+#include <string_operations.h>
+#include <rqrmi_trainer.h>
+#include <object_io.h>
+#include <lookup.h>
+
+// Holds arguments information
+static argument_t my_arguments[] = {
+		// Name,		Required,	IsBoolean,	Default,	Help
+		{"-i",			1,			0,			NULL,		"Textual records filename, one key / range start per line"},
+		{"-o",			1,			0,			NULL,		"Output model filename"},
+		{"--stages",	0,			0,			NULL,		"Comma separated stage widths (default: by the number of records, as LookupCpu)"},
+		{"--epochs",	0,			0,			NULL,		"Comma separated epochs per stage (default: 10 per stage, 20 for the last). With --base, epochs of the last stage"},
+		{"--hidden",	0,			0,			"8",		"Number of hidden neurons per submodel"},
+		{"--batch",		0,			0,			"32",		"Mini-batch size"},
+		{"--lr",		0,			0,			"0.001",	"Adam learning rate"},
+		{"--samples",	0,			0,			"1500",		"Initial number of samples per submodel"},
+		{"--error",		0,			0,			"64",		"Retrain last stage submodels with higher error (in records)"},
+		{"--threads",	0,			0,			"0",		"Number of training threads (0 for all available cores)"},
+		{"--seed",		0,			0,			"0",		"Seed for weight initialization and shuffling"},
+		{"--base",		0,			0,			NULL,		"Existing model filename to retrain incrementally (requires --base-records)"},
+		{"--base-records",0,		0,			NULL,		"Textual records filename indexed by the existing model"},
+		{"--lookup64",	0,			0,			NULL,		"Also write a Lookup64 file of the model and the records as 64-bit keys"},
+		{NULL,			0,			0,			NULL,		"Native RQRMI trainer tool."} /* Sentinel */
+};
+
+/**
+ * @brief Reads a textual file of records, returns them sorted and unique
+ */
+std::vector<scalar_t> read_records(const char* filename) {
+	FILE* file = fopen(filename, "r");
+	if (file == NULL) {
+		throw error("Cannot open records file '" << filename << "'");
+	}
+	std::vector<scalar_t> records;
+	double value;
+	while (fscanf(file, "%lf", &value) == 1) {
+		records.push_back(value);
+	}
+	fclose(file);
+
+	std::sort(records.begin(), records.end());
+	uint32_t num_of_records = records.size();
+	records.erase(std::unique(records.begin(), records.end()), records.end());
+	if (records.size() < num_of_records) {
+		warning("Removed " << num_of_records - records.size() << " duplicate records");
+	}
+	return records;
+}
+
+/**
+ * @brief Reads a textual file of records to an Nx1 matrix, sorted and unique
+ */
+matrix_t* read_record_matrix(const char* filename) {
+	std::vector<scalar_t> records = read_records(filename);
+	if (records.empty()) {
+		throw error("Records file '" << filename << "' is empty. Exiting.");
+	}
+	matrix_t* record_matrix = new_matrix(records.size(), 1);
+	for (uint32_t i=0; i<records.size(); ++i) {
+		GET_SCALAR(record_matrix, i, 0) = records[i];
+	}
+	return record_matrix;
+}
+
+/**
+ * @brief Reads a binary model file
+ * @param[out] size The size of the model in bytes
+ * @returns A buffer the user should free
+ */
+void* read_model(const char* filename, uint32_t* size) {
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL) {
+		throw error("Cannot open model file '" << filename << "'");
+	}
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	void* model = malloc(*size);
+	bool read = (fread(model, 1, *size, file) == *size);
+	fclose(file);
+	if (!read) {
+		free(model);
+		throw error("Cannot read model file '" << filename << "'");
+	}
+	return model;
+}
+
+/**
+ * @brief Writes a Lookup64 file of a model and the 64-bit keys of a records file.
+ *        Each key is a single-value record [key, key+1).
+ * @param filename The output filename
+ * @param records_filename Textual records filename, one key per line
+ * @param model The packed model
+ * @param size The size of the model in bytes
+ */
+void write_lookup64(const char* filename, const char* records_filename, void* model, uint32_t size) {
+	FILE* file = fopen(records_filename, "r");
+	if (file == NULL) {
+		throw error("Cannot open records file '" << records_filename << "'");
+	}
+	std::vector<uint64_t> keys;
+	unsigned long long value;
+	while (fscanf(file, "%llu", &value) == 1) {
+		keys.push_back(value);
+	}
+	fclose(file);
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	if (!keys.empty() && keys.back() == UINT64_MAX) {
+		warning("Removed key " << UINT64_MAX << ", its record cannot have an exclusive end");
+		keys.pop_back();
+	}
+	uint32_t num_of_records = keys.size();
+
+	// Pack the model and the records
+	ObjectPacker model_packer, database_packer, output;
+	model_packer.push(model, size);
+	database_packer << num_of_records;
+	for (uint32_t i=0; i<num_of_records; ++i) {
+		database_packer << keys[i] << (uint64_t)(keys[i]+1);
+	}
+	output << model_packer << database_packer;
+
+	// Validate all keys are found
+	Lookup64<1> lookup;
+	lookup.load(ObjectReader(output));
+	uint32_t not_found = 0;
+	for (uint32_t i=0; i<num_of_records; ++i) {
+		Lookup64<1>::result_t result;
+		lookup.search(&keys[i], &result);
+		not_found += !result.found || (result.index != i);
+	}
+	if (not_found > 0) {
+		throw error("Lookup64 did not find " << not_found << " of " << num_of_records << " keys. Exiting.");
+	}
+
+	unsigned char* buffer;
+	unsigned int buffer_size;
+	output.pack(&buffer, &buffer_size);
+	file = fopen(filename, "wb");
+	bool written = (file != NULL) && (fwrite(buffer, 1, buffer_size, file) == buffer_size);
+	if (file != NULL) fclose(file);
+	delete[] buffer;
+	if (!written) {
+		throw error("Cannot write Lookup64 file '" << filename << "'. Exiting.");
+	}
+	message_s("Lookup64 file written with " << num_of_records << " keys.");
+}
+
+int main(int argc, char** argv) {
+
+	// Print message buffer to stderr
+	SimpleLogger::get().set_sticky_force(true);
+
+	// Parse arguments
+	parse_arguments(argc, argv, my_arguments);
+
+	message_s("Reading records...");
+	matrix_t* record_matrix = read_record_matrix(ARG("-i")->value);
+	uint32_t num_of_records = record_matrix->rows;
+
+	// Set hyper parameters
+	rqrmi_trainer_params_t params;
+	rqrmi_trainer_default_params(&params);
+	params.hidden_width = atoi(ARG("--hidden")->value);
+	params.batch_size = atoi(ARG("--batch")->value);
+	params.learning_rate = atof(ARG("--lr")->value);
+	params.samples_per_bucket = atoi(ARG("--samples")->value);
+	params.threshold_submodel_error = atof(ARG("--error")->value);
+	params.num_of_threads = atoi(ARG("--threads")->value);
+	params.seed = atoi(ARG("--seed")->value);
+
+	struct timespec start_time, end_time;
+	uint32_t size;
+	void* model;
+
+	if (ARG("--base")->available) {
+
+		// Retrain an existing model
+		if (!ARG("--base-records")->available) {
+			throw error("Incremental training requires --base-records. Exiting.");
+		}
+		matrix_t* base_record_matrix = read_record_matrix(ARG("--base-records")->value);
+		uint32_t base_size;
+		void* base_model = read_model(ARG("--base")->value, &base_size);
+
+		uint32_t epochs = ARG("--epochs")->available ? atoi(ARG("--epochs")->value) : 20;
+		uint32_t num_of_retrained;
+
+		message_s("Retraining RQRMI model over " << num_of_records << " records (previously "
+				<< base_record_matrix->rows << " records)...");
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		model = rqrmi_trainer_retrain_model(base_model, base_size, base_record_matrix, record_matrix,
+				epochs, &params, &size, &num_of_retrained);
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		free(base_model);
+		free_matrix(base_record_matrix);
+		free_matrix(record_matrix);
+		if (model == RQRMI_TRAINER_ERROR) {
+			throw error("Retraining failed. Compile with DEBUG flag for extended info. Exiting.");
+		}
+		message_s("Retrained " << num_of_retrained << " submodels.");
+
+	} else {
+
+		// Set stage structure
+		std::vector<uint32_t> stage_widths;
+		if (ARG("--stages")->available) {
+			stage_widths = string_operations::split<uint32_t>(ARG("--stages")->value, ",", string_operations::str2int);
+		} else if (num_of_records < 1e3) {
+			stage_widths = {1, 4};
+		} else if (num_of_records < 1e4) {
+			stage_widths = {1, 4, 16};
+		} else if (num_of_records < 1e5) {
+			stage_widths = {1, 4, 128};
+		} else {
+			stage_widths = {1, 8, 256};
+		}
+		uint32_t num_of_stages = stage_widths.size();
+
+		std::vector<uint32_t> epochs;
+		if (ARG("--epochs")->available) {
+			epochs = string_operations::split<uint32_t>(ARG("--epochs")->value, ",", string_operations::str2int);
+		} else {
+			epochs.resize(num_of_stages, 10);
+			epochs.back() = 20;
+		}
+		if (epochs.size() != num_of_stages) {
+			throw error("Got " << epochs.size() << " epoch values for " << num_of_stages << " stages. Exiting.");
+		}
+
+		// Train the model
+		message_s("Training RQRMI model with " << num_of_stages << " stages over " << num_of_records << " records...");
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		model = rqrmi_trainer_train_model(record_matrix, num_of_stages, stage_widths.data(), epochs.data(), &params, &size);
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		free_matrix(record_matrix);
+		if (model == RQRMI_TRAINER_ERROR) {
+			throw error("Training failed. Compile with DEBUG flag for extended info. Exiting.");
+		}
+	}
+	double total_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+	message_s("Training time: " << total_time << " seconds. Model size: " << size << " bytes.");
+
+	// Print the error of the last stage
+	rqrmi_model_t* loaded_model = rqrmi_load_model(model, size);
+	if (loaded_model == RQRMI_MODEL_ERROR) {
+		free(model);
+		throw error("Cannot load trained model. Exiting.");
+	}
+	uint32_t max_error = 0;
+	uint32_t last_stage = rqrmi_get_num_of_stages(loaded_model)-1;
+	for (uint32_t m=0; m<rqrmi_get_num_of_submodels(loaded_model, last_stage); ++m) {
+		rqrmi_submodel_info_t submodel;
+		rqrmi_get_submodel_info(loaded_model, last_stage, m, &submodel);
+		max_error = std::max(max_error, submodel.error);
+	}
+	rqrmi_free_model(loaded_model);
+	message_s("Maximum submodel error: " << max_error << " records.");
+
+	if (ARG("--lookup64")->available) {
+		write_lookup64(ARG("--lookup64")->value, ARG("-i")->value, model, size);
+	}
+
+	// Write the model
+	FILE* file = fopen(ARG("-o")->value, "wb");
+	bool written = (file != NULL) && (fwrite(model, 1, size, file) == size);
+	if (file != NULL) fclose(file);
+	free(model);
+	if (!written) {
+		throw error("Cannot write model file '" << ARG("-o")->value << "'. Exiting.");
+	}
+
+	message_s("Done");
+}
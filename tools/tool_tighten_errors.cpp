@@ -0,0 +1,200 @@
+/*
+ * MIT License
+ * Copyright (c) 2019 Alon Rashelbach
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * This tool tightens the RQRMI error bounds of an existing NuevoMatch classifier file.
+ * The error of each last stage submodel is recalculated exactly, by evaluating the model on its
+ * breakpoints and on the rule edges, and the error lists of all iSets are rewritten.
+ * Smaller errors mean fewer secondary search iterations per packet.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <logging.h>
+#include <object_io.h>
+#include <argument_handler.h>
+#include <matrix_operations.h>
+#include <rqrmi_model.h>
+#include <rqrmi_tools.h>
+
+// Holds arguments information
+static argument_t my_arguments[] = {
+		// Name,		Required,	IsBoolean,	Default,	Help
+		{"-i",			1,			0,			NULL,		"Input NuevoMatch classifier filename"},
+		{"-o",			0,			0,			NULL,		"Output classifier filename (default: only report the errors)"},
+		{NULL,			0,			0,			NULL,		"Tightens the RQRMI error bounds of NuevoMatch classifiers."} /* Sentinel */
+};
+
+/**
+ * @brief Returns the number of secondary search iterations for an error value
+ */
+static uint32_t search_iterations(uint32_t error) {
+	uint32_t iterations = 0;
+	do {
+		++iterations;
+		error >>= 1;
+	} while (error > 0);
+	return iterations;
+}
+
+/**
+ * @brief Recalculates the error list of an iSet RQRMI model
+ * @param iset_idx The index of the iSet, for reporting
+ * @param model_handler The packed RQRMI model
+ * @param index_db_handler The packed index database of the iSet
+ * @param[out] model_buffer The packed RQRMI model with the new error list
+ * @throws In case of model errors
+ */
+static void tighten_iset(uint32_t iset_idx, ObjectReader& model_handler, ObjectReader& index_db_handler,
+		std::vector<uint8_t>& model_buffer)
+{
+	model_buffer.assign((uint8_t*)model_handler.buffer(), (uint8_t*)model_handler.buffer() + model_handler.size());
+
+	rqrmi_model_t* model = rqrmi_load_model(model_handler.buffer(), model_handler.size());
+	if (model == RQRMI_MODEL_ERROR) {
+		throw error("Cannot load the RQRMI model of iSet " << iset_idx);
+	}
+	matrix_t* database = load_matrix(index_db_handler.buffer(), index_db_handler.size());
+	if (database == MATRIX_ERROR) {
+		rqrmi_free_model(model);
+		throw error("Cannot load the index database of iSet " << iset_idx);
+	}
+
+	// The first column holds the rule starts, the second (when available) the rule ends
+	std::vector<scalar_t> starts(database->rows), ends(database->rows);
+	for (uint32_t i=0; i<database->rows; ++i) {
+		starts[i] = GET_SCALAR(database, i, 0);
+		ends[i] = database->cols > 1 ? GET_SCALAR(database, i, 1) : starts[i];
+	}
+	bool contiguous = database->cols < 2;
+	uint32_t num_of_records = database->rows;
+	free_matrix(database);
+
+	// The error list is the last part of the packed model
+	const uint32_t* old_errors;
+	uint32_t width;
+	rqrmi_get_error_list(model, &old_errors, &width);
+	uint32_t offset = model_buffer.size() - std::min<uint32_t>(model_buffer.size(), width * sizeof(uint32_t));
+	if (model_buffer.size() < width * sizeof(uint32_t) ||
+		memcmp(&model_buffer[offset], old_errors, width * sizeof(uint32_t)) != 0)
+	{
+		rqrmi_free_model(model);
+		throw error("The error list of iSet " << iset_idx << " is not at the end of its packed model");
+	}
+
+	std::vector<uint32_t> new_errors(width);
+	try {
+		rqrmi_tools_calculate_exact_errors(model, starts.data(), contiguous ? NULL : ends.data(),
+				num_of_records, new_errors.data());
+	} catch (const std::exception& e) {
+		rqrmi_free_model(model);
+		throw error("Cannot calculate the errors of iSet " << iset_idx << ": " << e.what());
+	}
+
+	// Report
+	uint32_t old_max = 0, new_max = 0, num_of_wider = 0;
+	double old_avg = 0, new_avg = 0;
+	for (uint32_t i=0; i<width; ++i) {
+		old_max = std::max(old_max, old_errors[i]);
+		new_max = std::max(new_max, new_errors[i]);
+		old_avg += (double)old_errors[i] / width;
+		new_avg += (double)new_errors[i] / width;
+		num_of_wider += (new_errors[i] > old_errors[i]);
+	}
+	message_s("iSet " << iset_idx << " (" << num_of_records << " rules): "
+			<< "maximum error " << old_max << " -> " << new_max << ", "
+			<< "average error " << old_avg << " -> " << new_avg << ", "
+			<< "search iterations " << search_iterations(old_max) << " -> " << search_iterations(new_max));
+	if (num_of_wider > 0) {
+		warning("iSet " << iset_idx << ": the stored error of " << num_of_wider << " submodels was too small");
+	}
+	rqrmi_free_model(model);
+
+	memcpy(&model_buffer[offset], new_errors.data(), width * sizeof(uint32_t));
+}
+
+int main(int argc, char** argv) {
+
+	// Print message buffer to stderr
+	SimpleLogger::get().set_sticky_force(true);
+
+	// Parse arguments
+	parse_arguments(argc, argv, my_arguments);
+
+	ObjectReader reader(ARG("-i")->value);
+
+	// Copy the static information
+	uint32_t num_of_isets, num_of_rules, size, build_time;
+	reader >> num_of_isets >> num_of_rules >> size >> build_time;
+
+	ObjectPacker output;
+	output << num_of_isets << num_of_rules << size << build_time;
+
+	// Rewrite the model of each iSet, keep all other objects as is
+	for (uint32_t i=0; i<num_of_isets; ++i) {
+		ObjectReader sub_reader;
+		reader >> sub_reader;
+
+		ObjectReader model_handler = sub_reader.extract();
+		ObjectReader index_db_handler = sub_reader.extract();
+
+		std::vector<uint8_t> model_buffer;
+		tighten_iset(i, model_handler, index_db_handler, model_buffer);
+
+		ObjectPacker iset_packer;
+		iset_packer << (uint32_t)model_buffer.size();
+		iset_packer.push(model_buffer.data(), model_buffer.size());
+		iset_packer << index_db_handler.size();
+		iset_packer.push(index_db_handler.buffer(), index_db_handler.size());
+		iset_packer.push(sub_reader.buffer(), sub_reader.size());
+		output << iset_packer;
+	}
+
+	if (!ARG("-o")->available) {
+		message_s("No output filename, classifier was not written");
+		return 0;
+	}
+
+	// The remainder classifier
+	output.push(reader.buffer(), reader.size());
+
+	unsigned char* data;
+	unsigned int data_size;
+	output.pack(&data, &data_size);
+
+	FILE* file = fopen(ARG("-o")->value, "wb");
+	bool written = (file != NULL) && (fwrite(data, 1, data_size, file) == data_size);
+	if (file != NULL) fclose(file);
+	delete[] data;
+	if (!written) {
+		throw error("Cannot write classifier file '" << ARG("-o")->value << "'. Exiting.");
+	}
+
+	message_s("Done");
+}